@@ -2,6 +2,29 @@
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <ctime>
+
+// The JIT needs x86-64 with the System V calling convention and mmap()
+// Build with -DTINY_NO_JIT to leave it out
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)) && !defined(TINY_NO_JIT)
+#define TINY_JIT
+#include <sys/mman.h>
+#endif
+
+// Bytecode images are mapped with mmap() where it is available, read otherwise
+#if defined(__unix__) || defined(__APPLE__)
+#define TINY_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// --self-test captures the output of the engines with dup2() where it is available
+#if defined(__unix__) || defined(__APPLE__)
+#define TINY_CAPTURE
+#endif
+
 using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -113,11 +136,107 @@ struct OutFile
 ////////////////////////////////////////////////////////////////////////////////////
 // Compiler Parameters /////////////////////////////////////////////////////////////
 
+// Execution engines selectable with --engine=
+// tree: recursive tree-walking interpreter (RunProgram)
+// vm: bytecode compiled from the tree, run by a stack-based virtual machine
+// reg: three-operand code over typed virtual registers, run by a register machine
+// jit: x86-64 machine code generated from the tree (where supported, else reg)
+// closure: every node compiled once into a function pointer bound to its operands
+// tm: Tiny Machine code run by the TM simulator
+// tiered: tree interpreter that moves hot loops to compiled code
+// trace: tree interpreter that compiles the path hot innermost loops take
+enum Engine {ENGINE_TREE, ENGINE_VM, ENGINE_REG, ENGINE_JIT, ENGINE_CLOSURE, ENGINE_TM, ENGINE_TIERED, ENGINE_TRACE};
+
+const char* EngineStr[]=
+            {
+                "tree", "vm", "reg", "jit", "closure", "tm", "tiered", "trace"
+            };
+
+#define NUM_ENGINES ((int)(sizeof(EngineStr)/sizeof(EngineStr[0])))
+
+// How the virtual machines dispatch instructions, selectable with --dispatch=
+// switch: a loop around one central switch (portable)
+// threaded: direct threading, code is predecoded into handler addresses and every
+// handler jumps to the next one with a computed goto (GCC and Clang only)
+// Build with -DTINY_DISPATCH_SWITCH to leave threaded dispatch out
+enum Dispatch {DISPATCH_SWITCH, DISPATCH_THREADED};
+
+const char* DispatchStr[]=
+            {
+                "switch", "threaded"
+            };
+
+#if defined(__GNUC__) && !defined(TINY_DISPATCH_SWITCH)
+#define TINY_THREADED_DISPATCH
+#define DEFAULT_DISPATCH DISPATCH_THREADED
+#define NUM_DISPATCHES 2
+#else
+#define DEFAULT_DISPATCH DISPATCH_SWITCH
+#define NUM_DISPATCHES 1
+#endif
+
+// Translations selectable with --emit=
+// c: standalone C program written to output.c
+// tm: Tiny Machine assembly written to output.tm
+// image: register code image written to output.img, run with --run-image
+// elf: static x86-64 Linux executable written to output.elf
+enum Emit {EMIT_NONE, EMIT_C, EMIT_TM, EMIT_IMAGE, EMIT_ELF};
+
+const char* EmitStr[]=
+            {
+                "none", "c", "tm", "image", "elf"
+            };
+
+#define NUM_EMITS ((int)(sizeof(EmitStr)/sizeof(EmitStr[0])))
+
+// Loop backedges after which the tiered engine compiles a loop
+#define DEFAULT_TIER_THRESHOLD 1000
+
+// Copies of a loop body per test of its condition when a loop is unrolled
+#define DEFAULT_UNROLL_FACTOR 4
+
+// Optimization level: 0 none, 1 tree passes, 2 every pass, repeated to a fixed point
+#define DEFAULT_OPT_LEVEL 2
+
+// --enable-pass and --disable-pass options kept
+#define MAX_PASS_SWITCHES 32
+
+// Command line options
+struct CompilerOptions
+{
+    const char* in_str;     // TINY source file (default input.txt)
+    const char* image_str;  // if set, run this bytecode image instead of compiling
+    Engine engine;          // engine used to run the program
+    bool stats;             // print execution statistics to stderr
+    bool disasm;            // print the generated register code
+    Dispatch dispatch;      // instruction dispatch of the virtual machines
+    int bench_runs;         // if not 0, benchmark the virtual machines instead of running
+    Emit emit;              // translation written out before the program runs
+    int tier_threshold;     // backedges after which the tiered engine compiles a loop
+    bool print_ir;          // print the SSA form the optimizer works on
+    int unroll_factor;      // copies of a loop body per loop condition test, 1: no unrolling
+    int opt_level;          // optimization passes run (see OptPass::level)
+    const char* pass_switch[MAX_PASS_SWITCHES];     // names of passes turned on or off, later ones win
+    bool pass_enabled[MAX_PASS_SWITCHES];
+    int num_pass_switches;
+    bool opt_report;        // print the time each optimization pass takes and the program size after it
+    const char* specialize_str;     // if set, known values of the first read statements (see Specialize())
+    bool self_test;         // run the compiler's own checks instead of compiling
+
+    CompilerOptions() {in_str="input.txt"; image_str=0; engine=ENGINE_TREE; stats=false; disasm=false;
+                       dispatch=DEFAULT_DISPATCH; bench_runs=0; emit=EMIT_NONE;
+                       tier_threshold=DEFAULT_TIER_THRESHOLD; print_ir=false;
+                       unroll_factor=DEFAULT_UNROLL_FACTOR; opt_level=DEFAULT_OPT_LEVEL;
+                       num_pass_switches=0; opt_report=false;
+                       specialize_str=0; self_test=false;}
+};
+
 struct CompilerInfo
 {
     InFile in_file;
     OutFile out_file;
     OutFile debug_file;
+    CompilerOptions options;
 
     CompilerInfo(const char* in_str, const char* out_str, const char* debug_str)
                 : in_file(in_str), out_file(out_str), debug_file(debug_str)
@@ -357,11 +476,14 @@ struct TreeNode
 
     int line_num;                       // Source line number for error reporting
 
+    bool unchecked;                     // OPER_NODE: cannot divide by zero or see a negative exponent (see AnalyzeRanges())
+
     // Default constructor: initialize all fields
     TreeNode() {
         int i;
         for(i=0;i<MAX_CHILDREN;i++) child[i]=0;
         sibling=0;
+        unchecked=false;
         expr_data_type=VOID;
         var_type=VOID;          // Add var_type initialization
         real_num=0.0;           // Initialize real_num to 0.0
@@ -829,6 +951,8 @@ void PrintTree(TreeNode* node, int sh=0)
         // Print numeric value based on type
         if(node->expr_data_type == REAL)
             printf("[%lf]", node->real_num);
+        else if(node->expr_data_type == BOOLEAN)
+            printf("[%s]", node->num ? "true" : "false");
         else
             printf("[%d]", node->num);
     }
@@ -999,6 +1123,40 @@ struct SymbolTable
             var_info[i]=0;
         }
     }
+
+    // Removes the variables with used[memloc] false and numbers the others from 0,
+    // keeping their order. Returns the number removed
+    int Compact(bool* used)
+    {
+        int i, n=0, removed=0;
+        int* new_loc=new int[num_vars+1];
+        for(i=0;i<num_vars;i++) new_loc[i]=used[i] ? n++ : -1;
+
+        for(i=0;i<SYMBOL_HASH_SIZE;i++)
+        {
+            VariableInfo** link=&var_info[i];
+            while(*link)
+            {
+                VariableInfo* curv=*link;
+                if(new_loc[curv->memloc]>=0) {curv->memloc=new_loc[curv->memloc]; link=&curv->next_var; continue;}
+
+                *link=curv->next_var;
+                LineLocation* curl=curv->head_line;
+                while(curl)
+                {
+                    LineLocation* pl=curl;
+                    curl=curl->next;
+                    delete pl;
+                }
+                delete[] curv->name;
+                delete curv;
+                removed++;
+            }
+        }
+        num_vars=n;
+        delete[] new_loc;
+        return removed;
+    }
 };
 
 // Enhanced semantic analysis with full type checking for the type system
@@ -1255,50 +1413,15 @@ double RealPower(double a, int b)
     return 0.0;
 }
 
-// Enhanced evaluate function that handles all three types: int, real, and boolean
-// Returns a TypedValue containing the result of evaluating the expression
-// Supports type mixing with automatic conversion where appropriate
-TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables)
+// Applies a binary operator to two already evaluated operands
+// This is the single definition of operator semantics: Evaluate uses it at runtime
+// and the optimizer uses it to fold constant expressions at compile time
+TypedValue EvaluateOper(TokenType oper, TypedValue a, TypedValue b)
 {
     TypedValue result;
-    
-    // NUM_NODE: numeric literal (int or real)
-    if(node->node_kind==NUM_NODE)
-    {
-        // Check if this is a real literal or integer literal
-        if(node->expr_data_type == REAL)
-        {
-            // Parse as real number
-            result = TypedValue(node->real_num);
-            result.type = REAL;
-        }
-        else
-        {
-            // Parse as integer
-            result = TypedValue(node->num);
-            result.type = INTEGER;
-        }
-        return result;
-    }
-    
-    // ID_NODE: variable reference
-    if(node->node_kind==ID_NODE)
-    {
-        VariableInfo* var = symbol_table->Find(node->id);
-        if(!var)
-        {
-            printf("ERROR Undefined variable '%s'\n", node->id);
-            throw 0;
-        }
-        return variables[var->memloc];
-    }
-
-    // OPER_NODE: binary operations
-    TypedValue a = Evaluate(node->child[0], symbol_table, variables);
-    TypedValue b = Evaluate(node->child[1], symbol_table, variables);
 
     // Comparison operators: < = > >= <=
-    if(node->oper==EQUAL)
+    if(oper==EQUAL)
     {
         // Equality comparison
         if(a.type == REAL || b.type == REAL)
@@ -1317,7 +1440,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
     
-    if(node->oper==LESS_THAN)
+    if(oper==LESS_THAN)
     {
         // Less than comparison
         if(a.type == REAL || b.type == REAL)
@@ -1336,7 +1459,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
 
-    if(node->oper==GREATER_THAN)
+    if(oper==GREATER_THAN)
     {
         // Greater than comparison
         if(a.type == REAL || b.type == REAL)
@@ -1355,7 +1478,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
 
-    if(node->oper==GREATER_EQUAL)
+    if(oper==GREATER_EQUAL)
     {
         // Greater than or equal comparison
         if(a.type == REAL || b.type == REAL)
@@ -1374,7 +1497,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
 
-    if(node->oper==LESS_EQUAL)
+    if(oper==LESS_EQUAL)
     {
         // Less than or equal comparison
         if(a.type == REAL || b.type == REAL)
@@ -1394,7 +1517,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
     }
     
     // Arithmetic operators: + - * / ^ &
-    if(node->oper==AND_OP)
+    if(oper==AND_OP)
     {
         // Arithmetic & operation: a^2 - b^2
         if(a.type == REAL || b.type == REAL)
@@ -1415,7 +1538,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
     }
 
     // Arithmetic operators: + - * / ^
-    if(node->oper==PLUS)
+    if(oper==PLUS)
     {
         if(a.type == REAL || b.type == REAL)
         {
@@ -1434,7 +1557,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
     
-    if(node->oper==MINUS)
+    if(oper==MINUS)
     {
         if(a.type == REAL || b.type == REAL)
         {
@@ -1451,7 +1574,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
     
-    if(node->oper==TIMES)
+    if(oper==TIMES)
     {
         if(a.type == REAL || b.type == REAL)
         {
@@ -1468,7 +1591,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
     
-    if(node->oper==DIVIDE)
+    if(oper==DIVIDE)
     {
         if(a.type == REAL || b.type == REAL)
         {
@@ -1495,7 +1618,7 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
         return result;
     }
     
-    if(node->oper==POWER)
+    if(oper==POWER)
     {
         if(a.type == REAL || b.type == REAL)
         {
@@ -1516,11 +1639,67 @@ TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* varia
     return result;
 }
 
+// Enhanced evaluate function that handles all three types: int, real, and boolean
+// Returns a TypedValue containing the result of evaluating the expression
+// Supports type mixing with automatic conversion where appropriate
+TypedValue Evaluate(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables)
+{
+    TypedValue result;
+    
+    // NUM_NODE: numeric literal (int or real, or a boolean produced by constant folding)
+    if(node->node_kind==NUM_NODE)
+    {
+        // Check if this is a real literal or integer literal
+        if(node->expr_data_type == REAL)
+        {
+            // Parse as real number
+            result = TypedValue(node->real_num);
+            result.type = REAL;
+        }
+        else if(node->expr_data_type == BOOLEAN)
+        {
+            result = TypedValue(node->num, true);
+        }
+        else
+        {
+            // Parse as integer
+            result = TypedValue(node->num);
+            result.type = INTEGER;
+        }
+        return result;
+    }
+    
+    // ID_NODE: variable reference
+    if(node->node_kind==ID_NODE)
+    {
+        VariableInfo* var = symbol_table->Find(node->id);
+        if(!var)
+        {
+            printf("ERROR Undefined variable '%s'\n", node->id);
+            throw 0;
+        }
+        return variables[var->memloc];
+    }
+
+    // OPER_NODE: binary operations
+    TypedValue a = Evaluate(node->child[0], symbol_table, variables);
+    TypedValue b = Evaluate(node->child[1], symbol_table, variables);
+
+    return EvaluateOper(node->oper, a, b);
+}
+
 // Enhanced runtime execution with full type support
 // Executes the abstract syntax tree with proper handling of int, real, and bool types
 // Variables are stored as TypedValue structures in the variables array
+// Set by engines that build on the interpreter (see RunTiered()), runs repeat
+// statements in place of RunProgram()
+void (*repeat_hook)(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables)=0;
+
 void RunProgram(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables)
 {
+    // Statement lists emptied by the optimizer are null
+    if(!node) return;
+
     // IF statement: if (condition) then ... [else ...] end
     if(node->node_kind==IF_NODE)
     {
@@ -1648,13 +1827,18 @@ void RunProgram(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables
     if(node->node_kind==REPEAT_NODE)
     {
         // Execute loop body repeatedly until condition becomes true
-        do
+        // With --engine=tiered or trace the loop may move to compiled code once it is hot
+        if(repeat_hook) repeat_hook(node, symbol_table, variables);
+        else
         {
-            // Execute loop body (first child)
-            RunProgram(node->child[0], symbol_table, variables);
-            // Evaluate condition (second child)
+            do
+            {
+                // Execute loop body (first child)
+                RunProgram(node->child[0], symbol_table, variables);
+                // Evaluate condition (second child)
+            }
+            while(!Evaluate(node->child[1], symbol_table, variables).bool_val);
         }
-        while(!Evaluate(node->child[1], symbol_table, variables).bool_val);
     }
     
     // Process sibling nodes (for statement sequences)
@@ -1686,53 +1870,8254 @@ void RunProgram(TreeNode* syntax_tree, SymbolTable* symbol_table)
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
-// Scanner and Compiler ////////////////////////////////////////////////////////////
+// Optimizer ///////////////////////////////////////////////////////////////////////
 
-void StartCompiler(CompilerInfo* pci)
+// Powers with a larger constant exponent are left to runtime, folding them would
+// recurse as deep as Power() does, or loop as long as RealPower()
+#define MAX_FOLD_POWER 4096
+
+// Counts the nodes of a subtree (the node and its children, not its siblings)
+int CountNodes(TreeNode* node)
 {
-    TreeNode* syntax_tree=Parse(pci);
+    int i, n=1;
+    for(i=0;i<MAX_CHILDREN;i++) if(node->child[i]) n+=CountNodes(node->child[i]);
+    return n;
+}
 
-    SymbolTable symbol_table;
-    Analyze(syntax_tree, &symbol_table);
+inline bool IsComparison(TokenType oper)
+{
+    return oper==EQUAL || oper==LESS_THAN || oper==GREATER_THAN || oper==GREATER_EQUAL || oper==LESS_EQUAL;
+}
 
-    printf("Symbol Table:\n");
-    symbol_table.Print();
-    printf("---------------------------------\n"); fflush(NULL);
+// Returns the value held by a NUM_NODE, typed exactly as Evaluate() would return it
+TypedValue ConstValue(TreeNode* node)
+{
+    if(node->expr_data_type==REAL) return TypedValue(node->real_num);
+    if(node->expr_data_type==BOOLEAN) return TypedValue(node->num, true);
+    return TypedValue(node->num);
+}
 
-    printf("Syntax Tree:\n");
-    PrintTree(syntax_tree);
-    printf("---------------------------------\n"); fflush(NULL);
+// Replaces node (and its children) by a NUM_NODE holding v
+// Boolean constants are NUM_NODEs with expr_data_type BOOLEAN
+void MakeConst(TreeNode* node, TypedValue v)
+{
+    int i;
+    for(i=0;i<MAX_CHILDREN;i++) if(node->child[i]) {DestroyTree(node->child[i]); node->child[i]=0;}
 
-    printf("Run Program:\n");
-    RunProgram(syntax_tree, &symbol_table);
-    printf("---------------------------------\n"); fflush(NULL);
+    node->node_kind=NUM_NODE;
+    node->expr_data_type=v.type;
+    if(v.type==REAL) node->real_num=v.real_val;
+    else if(v.type==BOOLEAN) node->num=v.bool_val;
+    else node->num=v.int_val;
+}
 
-    symbol_table.Destroy();
-    DestroyTree(syntax_tree);
+// Operations that fail at runtime are not folded, so the error still happens when
+// (and only if) the program reaches them
+bool CanFold(TokenType oper, TypedValue a, TypedValue b)
+{
+    if(oper==DIVIDE)
+    {
+        if(b.type==REAL) return b.real_val!=0.0;
+        // INT_MIN / -1 overflows, which traps like a division by zero
+        if(a.type!=REAL && a.int_val==-2147483647-1 && b.int_val==-1) return false;
+        return b.int_val!=0;
+    }
+    if(oper==POWER)
+    {
+        // A real exponent is truncated to an int, one too large for that is left as well
+        if(b.type==REAL) return b.real_val<=MAX_FOLD_POWER;
+        return b.int_val<=MAX_FOLD_POWER;
+    }
+    return true;
 }
 
-////////////////////////////////////////////////////////////////////////////////////
-// Scanner only ////////////////////////////////////////////////////////////////////
+// Constant folding: evaluates every OPER_NODE whose operands are constants and
+// replaces it by a NUM_NODE, bottom up so whole constant subtrees collapse
+// Must run after Analyze() since it relies on expr_data_type
+// Returns the number of nodes eliminated
+int FoldConstants(TreeNode* node)
+{
+    int i, eliminated=0;
 
-void StartScanner(CompilerInfo* pci)
+    for(i=0;i<MAX_CHILDREN;i++)
+        if(node->child[i])
+            eliminated+=FoldConstants(node->child[i]);
+
+    if(node->node_kind==OPER_NODE &&
+       node->child[0]->node_kind==NUM_NODE && node->child[1]->node_kind==NUM_NODE)
+    {
+        TypedValue a=ConstValue(node->child[0]);
+        TypedValue b=ConstValue(node->child[1]);
+        if(CanFold(node->oper, a, b))
+        {
+            MakeConst(node, EvaluateOper(node->oper, a, b));
+            eliminated+=2;
+        }
+    }
+
+    if(node->sibling) eliminated+=FoldConstants(node->sibling);
+    return eliminated;
+}
+
+// Counts the nodes of a whole statement list (each statement and its siblings)
+int CountListNodes(TreeNode* list)
 {
-    Token token;
+    int n=0;
+    while(list) {n+=CountNodes(list); list=list->sibling;}
+    return n;
+}
 
-    while(true)
+// Links the statement list rest after the last statement of list
+// Returns the head of the combined list
+TreeNode* SpliceList(TreeNode* list, TreeNode* rest)
+{
+    if(!list) return rest;
+    TreeNode* last=list;
+    while(last->sibling) last=last->sibling;
+    last->sibling=rest;
+    return list;
+}
+
+// Dead-branch elimination over the statement list starting at *link
+// - if with a constant condition is replaced by the branch that is taken
+// - repeat ... until true runs its body once and is replaced by it
+// - statements after repeat ... until false can never run and are removed
+// Statement lists may become empty (a null child or a null program)
+// Returns the number of nodes eliminated
+int EliminateDeadBranches(TreeNode** link)
+{
+    int eliminated=0;
+
+    while(*link)
     {
-        GetNextToken(pci, &token);
-        printf("[%d] %s (%s)\n", pci->in_file.cur_line_num, token.str, TokenTypeStr[token.type]); fflush(NULL);
-        if(token.type==ENDFILE || token.type==ERROR) break;
+        TreeNode* node=*link;
+
+        if(node->node_kind==IF_NODE)
+        {
+            eliminated+=EliminateDeadBranches(&node->child[1]);
+            eliminated+=EliminateDeadBranches(&node->child[2]);
+
+            if(node->child[0]->node_kind==NUM_NODE)
+            {
+                int taken=node->child[0]->num ? 1 : 2;
+                TreeNode* branch=node->child[taken];
+                node->child[taken]=0;
+
+                *link=SpliceList(branch, node->sibling);
+                node->sibling=0;
+                eliminated+=CountNodes(node);
+                DestroyTree(node);
+                continue; // the spliced statements are visited again from *link
+            }
+        }
+
+        if(node->node_kind==REPEAT_NODE)
+        {
+            eliminated+=EliminateDeadBranches(&node->child[0]);
+
+            if(node->child[1]->node_kind==NUM_NODE && node->child[1]->num)
+            {
+                TreeNode* body=node->child[0];
+                node->child[0]=0;
+
+                *link=SpliceList(body, node->sibling);
+                node->sibling=0;
+                eliminated+=CountNodes(node);
+                DestroyTree(node);
+                continue;
+            }
+
+            if(node->child[1]->node_kind==NUM_NODE && node->sibling)
+            {
+                eliminated+=CountListNodes(node->sibling);
+                DestroyTree(node->sibling);
+                node->sibling=0;
+            }
+        }
+
+        link=&node->sibling;
     }
+    return eliminated;
 }
 
-////////////////////////////////////////////////////////////////////////////////////
+// True if evaluating the expression may stop the program with a runtime error,
+// which is the only side effect an expression can have: a division (by zero, or of
+// INT_MIN by -1), or a variable that is never declared or assigned
+bool MayFail(TreeNode* node, SymbolTable* symbol_table)
+{
+    int i;
+    if(node->node_kind==ID_NODE && !symbol_table->Find(node->id)) return true;
+    if(node->node_kind==OPER_NODE && node->oper==DIVIDE && !node->unchecked)
+    {
+        TreeNode* dividend=node->child[0];
+        TreeNode* divisor=node->child[1];
+        if(divisor->node_kind!=NUM_NODE) return true;
+        if(divisor->expr_data_type==REAL ? divisor->real_num==0.0 : divisor->num==0) return true;
+        // INT_MIN / -1 overflows, which traps like a division by zero
+        if(divisor->expr_data_type==INTEGER && divisor->num==-1 && dividend->expr_data_type!=REAL &&
+           !(dividend->node_kind==NUM_NODE && dividend->num!=-2147483647-1)) return true;
+    }
+    for(i=0;i<MAX_CHILDREN;i++) if(node->child[i] && MayFail(node->child[i], symbol_table)) return true;
+    return false;
+}
 
-int main()
+// Sets is_read[memloc] for every variable referenced by an ID_NODE
+void MarkReadVariables(TreeNode* node, SymbolTable* symbol_table, bool* is_read)
 {
-    printf("Start main()\n"); fflush(NULL);
+    int i;
+    if(node->node_kind==ID_NODE)
+    {
+        VariableInfo* var=symbol_table->Find(node->id);
+        if(var) is_read[var->memloc]=true;
+    }
+    for(i=0;i<MAX_CHILDREN;i++) if(node->child[i]) MarkReadVariables(node->child[i], symbol_table, is_read);
+    if(node->sibling) MarkReadVariables(node->sibling, symbol_table, is_read);
+}
+
+// Removes assignments and declarations of variables that are never read
+// read statements are kept since they consume input
+int RemoveUnreadWrites(TreeNode** link, SymbolTable* symbol_table, bool* is_read)
+{
+    int eliminated=0;
+
+    while(*link)
+    {
+        TreeNode* node=*link;
+
+        if(node->node_kind==IF_NODE)
+        {
+            eliminated+=RemoveUnreadWrites(&node->child[1], symbol_table, is_read);
+            eliminated+=RemoveUnreadWrites(&node->child[2], symbol_table, is_read);
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            eliminated+=RemoveUnreadWrites(&node->child[0], symbol_table, is_read);
+        }
+        else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+        {
+            VariableInfo* var=symbol_table->Find(node->id);
+            if(var && !is_read[var->memloc] && !(node->child[0] && MayFail(node->child[0], symbol_table)))
+            {
+                *link=node->sibling;
+                node->sibling=0;
+                eliminated+=CountNodes(node);
+                DestroyTree(node);
+                continue;
+            }
+        }
+
+        link=&node->sibling;
+    }
+    return eliminated;
+}
+
+// Dead-write elimination: removing a write may leave another variable unread
+// (y := x; with y unread makes x unread too), so it repeats until nothing changes
+int EliminateDeadWrites(TreeNode** link, SymbolTable* symbol_table)
+{
+    int i, eliminated=0, removed;
+    bool* is_read=new bool[symbol_table->num_vars+1];
+
+    do
+    {
+        for(i=0;i<symbol_table->num_vars;i++) is_read[i]=false;
+        if(*link) MarkReadVariables(*link, symbol_table, is_read);
+        removed=RemoveUnreadWrites(link, symbol_table, is_read);
+        eliminated+=removed;
+    }
+    while(removed>0);
+
+    delete[] is_read;
+    return eliminated;
+}
+
+// Dead-store elimination: a backward liveness analysis over the statement lists.
+// live[memloc] is true if the variable's value may be read before it is assigned
+// again. Each function takes the live set after the statements and leaves the one
+// before them. An assignment or declaration of a variable that is not live is
+// removed if its expression cannot fail; with remove false nothing is changed,
+// which is used to find the live set of a loop before removing anything from it
+int DeadStoresInList(TreeNode** link, SymbolTable* symbol_table, bool* live, bool remove);
+
+int DeadStoresInStmt(TreeNode** link, SymbolTable* symbol_table, bool* live, bool remove)
+{
+    int i, n=symbol_table->num_vars, eliminated=0;
+    TreeNode* node=*link;
+
+    if(node->node_kind==IF_NODE)
+    {
+        bool* live_else=new bool[n+1];
+        for(i=0;i<n;i++) live_else[i]=live[i];
+        eliminated+=DeadStoresInList(&node->child[1], symbol_table, live, remove);
+        eliminated+=DeadStoresInList(&node->child[2], symbol_table, live_else, remove);
+        for(i=0;i<n;i++) live[i]=live[i] || live_else[i];
+        MarkReadVariables(node->child[0], symbol_table, live);
+        delete[] live_else;
+    }
+    else if(node->node_kind==REPEAT_NODE)
+    {
+        // Live before the condition: after the loop, at the top of the body (the
+        // next iteration) and in the condition itself
+        bool* live_cond=new bool[n+1];
+        for(i=0;i<n;i++) live_cond[i]=live[i];
+        bool changed=true;
+        while(changed)
+        {
+            MarkReadVariables(node->child[1], symbol_table, live_cond);
+            for(i=0;i<n;i++) live[i]=live_cond[i];
+            DeadStoresInList(&node->child[0], symbol_table, live, false);
+            changed=false;
+            for(i=0;i<n;i++) if(live[i] && !live_cond[i]) {live_cond[i]=true; changed=true;}
+        }
+        for(i=0;i<n;i++) live[i]=live_cond[i];
+        eliminated+=DeadStoresInList(&node->child[0], symbol_table, live, remove);
+        delete[] live_cond;
+    }
+    else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE || node->node_kind==READ_NODE)
+    {
+        VariableInfo* var=symbol_table->Find(node->id);
+        if(var && node->node_kind!=READ_NODE && !live[var->memloc] && !(node->child[0] && MayFail(node->child[0], symbol_table)))
+        {
+            if(remove)
+            {
+                *link=node->sibling;
+                node->sibling=0;
+                eliminated+=CountNodes(node);
+                DestroyTree(node);
+            }
+            return eliminated;
+        }
+        if(var) live[var->memloc]=false;
+        if(node->child[0]) MarkReadVariables(node->child[0], symbol_table, live);
+    }
+    else if(node->child[0]) MarkReadVariables(node->child[0], symbol_table, live);
+    return eliminated;
+}
+
+int DeadStoresInList(TreeNode** link, SymbolTable* symbol_table, bool* live, bool remove)
+{
+    int n=0, eliminated=0;
+    for(TreeNode* node=*link;node;node=node->sibling) n++;
+    TreeNode*** links=new TreeNode**[n+1];
+
+    n=0;
+    for(;*link;link=&(*link)->sibling) links[n++]=link;
+    while(n>0) eliminated+=DeadStoresInStmt(links[--n], symbol_table, live, remove);
+
+    delete[] links;
+    return eliminated;
+}
+
+// Nothing is live at the end of the program
+int EliminateDeadStores(TreeNode** link, SymbolTable* symbol_table)
+{
+    int i, eliminated;
+    bool* live=new bool[symbol_table->num_vars+1];
+    for(i=0;i<symbol_table->num_vars;i++) live[i]=false;
+    eliminated=*link ? DeadStoresInList(link, symbol_table, live, true) : 0;
+    delete[] live;
+    return eliminated;
+}
 
-    CompilerInfo compiler_info("input.txt", "output.txt", "debug.txt");
+// Marks every variable the tree names (read, assigned or declared)
+void MarkUsedVariables(TreeNode* node, SymbolTable* symbol_table, bool* used)
+{
+    int i;
+    if(node->node_kind==ID_NODE || node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE || node->node_kind==READ_NODE)
+    {
+        VariableInfo* var=symbol_table->Find(node->id);
+        if(var) used[var->memloc]=true;
+    }
+    for(i=0;i<MAX_CHILDREN;i++) if(node->child[i]) MarkUsedVariables(node->child[i], symbol_table, used);
+    if(node->sibling) MarkUsedVariables(node->sibling, symbol_table, used);
+}
+
+// Variable pruning: variables the optimized program no longer names are dropped
+// from the symbol table and the others renumbered, so every engine allocates only
+// the slots that are used. Must run after every other pass (the memlocs change)
+int PruneVariables(TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    int i;
+    bool* used=new bool[symbol_table->num_vars+1];
+    for(i=0;i<symbol_table->num_vars;i++) used[i]=false;
+    if(syntax_tree) MarkUsedVariables(syntax_tree, symbol_table, used);
+    int removed=symbol_table->Compact(used);
+    delete[] used;
+    return removed;
+}
+
+// Loop unrolling: a repeat loop whose trip count is known at compile time (a counter
+// set to a constant before the loop, stepped by a constant once per iteration and
+// compared with a constant in the until condition) has its body copied factor times,
+// so the condition is tested once per copy group. The iterations that do not fill a
+// group are copied in front of the loop. A loop whose copies all fit in
+// MAX_UNROLL_NODES is replaced by them.
+#define MAX_UNROLL_NODES 256
+
+// Copies a subtree with its siblings
+TreeNode* CopyTree(TreeNode* node)
+{
+    int i;
+    TreeNode* copy=new TreeNode;
+    *copy=*node;
+    if(node->node_kind==ID_NODE || node->node_kind==READ_NODE || node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+        AllocateAndCopy(&copy->id, node->id);
+
+    for(i=0;i<MAX_CHILDREN;i++) if(node->child[i]) copy->child[i]=CopyTree(node->child[i]);
+    if(node->sibling) copy->sibling=CopyTree(node->sibling);
+    return copy;
+}
+
+bool StmtAssigns(TreeNode* stmt, const char* id);
+
+bool ListAssigns(TreeNode* list, const char* id)
+{
+    for(;list;list=list->sibling) if(StmtAssigns(list, id)) return true;
+    return false;
+}
+
+// True if the statement (or one nested in it) may assign the variable
+bool StmtAssigns(TreeNode* stmt, const char* id)
+{
+    if(stmt->node_kind==ASSIGN_NODE || stmt->node_kind==DECL_NODE || stmt->node_kind==READ_NODE) return Equals(stmt->id, id);
+    if(stmt->node_kind==IF_NODE) return ListAssigns(stmt->child[1], id) || ListAssigns(stmt->child[2], id);
+    if(stmt->node_kind==REPEAT_NODE) return ListAssigns(stmt->child[0], id);
+    return false;
+}
+
+bool IsIntConst(TreeNode* node) {return node->node_kind==NUM_NODE && node->expr_data_type==INTEGER;}
+
+bool IsVarNode(TreeNode* node, const char* id) {return node->node_kind==ID_NODE && Equals(node->id, id);}
+
+// Sets *step if the statement is id := id + c, id := c + id or id := id - c
+bool CounterStep(TreeNode* stmt, const char* id, long long* step)
+{
+    if(stmt->node_kind!=ASSIGN_NODE || !Equals(stmt->id, id)) return false;
+    TreeNode* e=stmt->child[0];
+    if(e->node_kind!=OPER_NODE) return false;
+    if(e->oper==PLUS && IsVarNode(e->child[0], id) && IsIntConst(e->child[1])) *step=e->child[1]->num;
+    else if(e->oper==PLUS && IsIntConst(e->child[0]) && IsVarNode(e->child[1], id)) *step=e->child[0]->num;
+    else if(e->oper==MINUS && IsVarNode(e->child[0], id) && IsIntConst(e->child[1])) *step=-(long long)e->child[1]->num;
+    else return false;
+    return *step!=0;
+}
+
+bool CompareCounter(TokenType oper, long long v, long long limit)
+{
+    switch(oper)
+    {
+        case EQUAL: return v==limit;
+        case LESS_THAN: return v<limit;
+        case LESS_EQUAL: return v<=limit;
+        case GREATER_THAN: return v>limit;
+        default: return v>=limit;
+    }
+}
+
+// Number of iterations of a loop whose counter starts at start, is stepped by step
+// and ends the loop once "counter oper limit" holds, 0 if the counter would leave the
+// int range first (it would wrap around) or the condition never holds
+long long TripCount(long long start, long long step, TokenType oper, long long limit)
+{
+    if(CompareCounter(oper, start+step, limit)) return 1;
+
+    long long trips;
+    if(oper==EQUAL)
+    {
+        if((limit-start)%step!=0) return 0;
+        trips=(limit-start)/step;
+        if(trips<1) return 0;
+    }
+    else
+    {
+        // Only a condition that stays true once it holds is found by bisection
+        bool rising=oper==GREATER_THAN || oper==GREATER_EQUAL;
+        if(rising!=(step>0)) return 0;
+        long long lo=1, hi=2;
+        while(!CompareCounter(oper, start+hi*step, limit)) {lo=hi; hi*=2; if(hi>(1LL<<32)) return 0;}
+        while(hi-lo>1)
+        {
+            long long mid=(lo+hi)/2;
+            if(CompareCounter(oper, start+mid*step, limit)) hi=mid; else lo=mid;
+        }
+        trips=hi;
+    }
+
+    long long last=start+trips*step;
+    if(last<-2147483648LL || last>2147483647LL) return 0;
+    return trips;
+}
+
+// Links count copies of the statement list body after *tail, moves *tail to the last
+void AppendCopies(TreeNode*** tail, TreeNode* body, long long count)
+{
+    for(;count>0;count--)
+    {
+        TreeNode* copy=CopyTree(body);
+        **tail=copy;
+        while(copy->sibling) copy=copy->sibling;
+        *tail=&copy->sibling;
+    }
+}
+
+// Trip count of a repeat loop in the statement list starting at list, 0 if it is not
+// known
+long long LoopTripCount(TreeNode* list, TreeNode* loop, SymbolTable* symbol_table)
+{
+    TreeNode* cond=loop->child[1];
+    if(cond->node_kind!=OPER_NODE || !IsComparison(cond->oper)) return 0;
+
+    // counter oper limit, or limit oper counter with the comparison mirrored
+    TokenType oper=cond->oper;
+    TreeNode* counter=cond->child[0];
+    TreeNode* limit=cond->child[1];
+    if(counter->node_kind!=ID_NODE)
+    {
+        counter=cond->child[1];
+        limit=cond->child[0];
+        if(oper==LESS_THAN) oper=GREATER_THAN;
+        else if(oper==LESS_EQUAL) oper=GREATER_EQUAL;
+        else if(oper==GREATER_THAN) oper=LESS_THAN;
+        else if(oper==GREATER_EQUAL) oper=LESS_EQUAL;
+    }
+    if(counter->node_kind!=ID_NODE || !IsIntConst(limit)) return 0;
+    VariableInfo* var=symbol_table->Find(counter->id);
+    if(!var || var->var_type!=INTEGER) return 0;
+
+    // Stepped exactly once, by a statement of the body itself
+    long long step=0;
+    int steps=0;
+    for(TreeNode* s=loop->child[0];s;s=s->sibling)
+    {
+        if(CounterStep(s, counter->id, &step)) steps++;
+        else if(StmtAssigns(s, counter->id)) return 0;
+    }
+    if(steps!=1) return 0;
+
+    // Set to a constant by the last statement before the loop that assigns it
+    TreeNode* init=0;
+    for(TreeNode* s=list;s!=loop;s=s->sibling) if(StmtAssigns(s, counter->id)) init=s;
+    if(!init || init->node_kind==READ_NODE || !init->child[0] || !IsIntConst(init->child[0])) return 0;
+    if(init->node_kind!=ASSIGN_NODE && init->node_kind!=DECL_NODE) return 0;
+
+    return TripCount(init->child[0]->num, step, oper, limit->num);
+}
+
+// Unrolls the loops of the statement list starting at *link, inner loops first
+// Returns the number of loops unrolled
+int UnrollLoops(TreeNode** link, SymbolTable* symbol_table, int factor)
+{
+    int unrolled=0;
+    TreeNode** head=link;
+
+    while(*link)
+    {
+        TreeNode* node=*link;
+
+        if(node->node_kind==IF_NODE)
+        {
+            unrolled+=UnrollLoops(&node->child[1], symbol_table, factor);
+            unrolled+=UnrollLoops(&node->child[2], symbol_table, factor);
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            unrolled+=UnrollLoops(&node->child[0], symbol_table, factor);
+
+            long long trips=LoopTripCount(*head, node, symbol_table);
+            int size=node->child[0] ? CountListNodes(node->child[0]) : 0;
+            int copies=factor;
+            while(copies>1 && copies*size>MAX_UNROLL_NODES) copies--;
+
+            if(trips>0 && size>0 && trips*size<=MAX_UNROLL_NODES)
+            {
+                // Replaced by its iterations
+                TreeNode* body=node->child[0];
+                node->child[0]=0;
+                TreeNode* first=0;
+                TreeNode** tail=&first;
+                AppendCopies(&tail, body, trips);
+                *tail=node->sibling;
+                *link=first;
+                node->sibling=0;
+                DestroyTree(node);
+                DestroyTree(body);
+                link=tail;
+                unrolled++;
+                continue;
+            }
+
+            if(trips>=copies && copies>1 && size>0)
+            {
+                // The remaining iterations go in front, the loop runs whole groups
+                TreeNode* body=node->child[0];
+                TreeNode** tail=link;
+                AppendCopies(&tail, body, trips%copies);
+                *tail=node;
+                node->child[0]=0;
+                TreeNode** body_tail=&node->child[0];
+                AppendCopies(&body_tail, body, copies);
+                DestroyTree(body);
+                unrolled++;
+            }
+        }
+
+        link=&node->sibling;
+    }
+    return unrolled;
+}
+
+// Algebraic simplification: rewrites operators into cheaper forms that compute
+// exactly the same value, bottom up:
+//   a & b -> (a-b)*(a+b)      int, a and b variables or constants
+//   x ^ 2 -> x*x              int or real, x a variable
+//   x ^ 3 -> x*x*x            int, x a variable
+//   x * 1, 1 * x -> x         int or real
+//   x * 0, 0 * x -> 0         int, x cannot fail at runtime
+//   x + 0, 0 + x -> x         int
+//   x - 0 -> x                int or real
+//   0 - (0 - x) -> x          int (the unary minus of a unary minus)
+// Int rules hold because int arithmetic wraps around. Real ones are left out where
+// rounding, the sign of zero or an infinity could differ (a*a-b*b, -0.0 + 0 is +0.0,
+// inf * 0 is nan). An operand that is evaluated twice must be a leaf, so nothing is
+// computed twice, and an operand that is dropped must not be able to fail. The tree
+// interpreter only knows the type of a value at runtime (an unassigned variable is
+// VOID, which computes as an int), so the real rules need exact_types: the program
+// is statically typed and every real expression holds a real.
+// Returns the number of rules applied
+
+bool IsSimpleLeaf(TreeNode* node) {return node->node_kind==ID_NODE || node->node_kind==NUM_NODE;}
+
+bool IsConstValue(TreeNode* node, int value)
+{
+    if(node->node_kind!=NUM_NODE) return false;
+    if(node->expr_data_type==REAL) return node->real_num==(double)value;
+    return node->expr_data_type==INTEGER && node->num==value;
+}
+
+TreeNode* NewOperNode(TokenType oper, ExprDataType type, TreeNode* a, TreeNode* b, int line)
+{
+    TreeNode* node=new TreeNode;
+    node->node_kind=OPER_NODE;
+    node->oper=oper;
+    node->expr_data_type=type;
+    node->line_num=line;
+    node->child[0]=a;
+    node->child[1]=b;
+    return node;
+}
+
+// Replaces *link by its child k
+void ReplaceByChild(TreeNode** link, int k)
+{
+    TreeNode* node=*link;
+    *link=node->child[k];
+    node->child[k]=0;
+    DestroyTree(node);
+}
+
+// Applies the first rule that matches *link, returns false if none does
+bool SimplifyOper(TreeNode** link, SymbolTable* symbol_table, bool exact_types)
+{
+    TreeNode* node=*link;
+    TreeNode* a=node->child[0];
+    TreeNode* b=node->child[1];
+    ExprDataType type=node->expr_data_type;
+    bool is_int=type==INTEGER && a->expr_data_type==INTEGER && b->expr_data_type==INTEGER;
+    bool is_real=exact_types && type==REAL;
+
+    if(node->oper==AND_OP && is_int && IsSimpleLeaf(a) && IsSimpleLeaf(b))
+    {
+        TreeNode* diff=NewOperNode(MINUS, INTEGER, a, b, node->line_num);
+        TreeNode* sum=NewOperNode(PLUS, INTEGER, CopyTree(a), CopyTree(b), node->line_num);
+        node->oper=TIMES;
+        node->child[0]=diff;
+        node->child[1]=sum;
+        return true;
+    }
+
+    if(node->oper==POWER && a->node_kind==ID_NODE && a->expr_data_type==type && (is_int || is_real))
+    {
+        if(IsConstValue(b, 2) || (is_int && IsConstValue(b, 3)))
+        {
+            bool cube=IsConstValue(b, 3);
+            DestroyTree(b);
+            node->oper=TIMES;
+            node->child[1]=CopyTree(a);
+            if(cube) *link=NewOperNode(TIMES, type, node, CopyTree(a), node->line_num);
+            return true;
+        }
+        return false;
+    }
+
+    // Identities: the remaining operand must already have the result's type
+    if(node->oper==TIMES && (is_int || is_real))
+    {
+        if(IsConstValue(b, 1) && a->expr_data_type==type) {ReplaceByChild(link, 0); return true;}
+        if(IsConstValue(a, 1) && b->expr_data_type==type) {ReplaceByChild(link, 1); return true;}
+    }
+    if(node->oper==TIMES && is_int && (IsConstValue(a, 0) || IsConstValue(b, 0)) && !MayFail(node, symbol_table))
+    {
+        MakeConst(node, TypedValue(0));
+        return true;
+    }
+    if(node->oper==PLUS && is_int)
+    {
+        if(IsConstValue(b, 0)) {ReplaceByChild(link, 0); return true;}
+        if(IsConstValue(a, 0)) {ReplaceByChild(link, 1); return true;}
+    }
+    if(node->oper==MINUS && (is_int || is_real))
+    {
+        if(IsConstValue(b, 0) && a->expr_data_type==type) {ReplaceByChild(link, 0); return true;}
+        if(is_int && IsConstValue(a, 0) && b->node_kind==OPER_NODE && b->oper==MINUS && IsConstValue(b->child[0], 0) &&
+           b->child[1]->expr_data_type==INTEGER)
+        {
+            ReplaceByChild(&node->child[1], 1);
+            ReplaceByChild(link, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+int SimplifyAlgebra(TreeNode* node, SymbolTable* symbol_table, bool exact_types)
+{
+    int i, applied=0;
+    for(;node;node=node->sibling)
+        for(i=0;i<MAX_CHILDREN;i++)
+        {
+            if(!node->child[i]) continue;
+            applied+=SimplifyAlgebra(node->child[i], symbol_table, exact_types);
+            // A rewritten operand may match again, and so may the operators it created
+            while(node->child[i]->node_kind==OPER_NODE && SimplifyOper(&node->child[i], symbol_table, exact_types))
+                applied+=1+SimplifyAlgebra(node->child[i], symbol_table, exact_types);
+        }
+    return applied;
+}
+
+// Range analysis: computes an interval for every int variable at every statement
+// and for every int expression, and sets unchecked on the divisions whose divisor
+// can never be 0 (nor -1 with a dividend that may be INT_MIN) and the powers whose
+// exponent can never be negative, so backends can leave those checks out (and
+// MayFail() knows the division cannot fail).
+// Bounds are computed in long long. A result that may leave the int range wraps
+// around, so it gets the full range. An unassigned variable holds 0 in every engine.
+// Conditions narrow the ranges: in the then part of if x < 10, x is at most 9, and
+// a repeat body is entered again only when its until condition was false. A loop
+// is analyzed again until the ranges at its top stop changing; after
+// MAX_RANGE_ROUNDS rounds a bound that still moves is widened to the end of the int
+// range. Only int values are tracked, real ones are unbounded.
+// Returns the number of checks removed
+#define MAX_RANGE_ROUNDS 16
+#define RANGE_MIN (-2147483647LL-1)
+#define RANGE_MAX 2147483647LL
+
+struct Range
+{
+    long long lo, hi;           // empty if lo>hi: the statement is never reached
+};
+
+Range MakeRange(long long lo, long long hi) {Range r; r.lo=lo; r.hi=hi; return r;}
+
+Range FullRange() {return MakeRange(RANGE_MIN, RANGE_MAX);}
+
+bool IsEmptyRange(Range r) {return r.lo>r.hi;}
+
+// The range of a computed value, which wraps around if it leaves the int range
+Range WrappedRange(long long lo, long long hi)
+{
+    if(lo>hi) return MakeRange(1, 0);
+    if(lo<RANGE_MIN || hi>RANGE_MAX) return FullRange();
+    return MakeRange(lo, hi);
+}
+
+Range JoinRanges(Range a, Range b)
+{
+    if(IsEmptyRange(a)) return b;
+    if(IsEmptyRange(b)) return a;
+    return MakeRange(a.lo<b.lo ? a.lo : b.lo, a.hi>b.hi ? a.hi : b.hi);
+}
+
+long long MinOf4(long long a, long long b, long long c, long long d)
+{
+    long long m=a<b ? a : b;
+    if(c<m) m=c;
+    return d<m ? d : m;
+}
+
+long long MaxOf4(long long a, long long b, long long c, long long d)
+{
+    long long m=a>b ? a : b;
+    if(c>m) m=c;
+    return d>m ? d : m;
+}
+
+Range SquareRange(Range a)
+{
+    long long lo=a.lo*a.lo, hi=a.hi*a.hi;
+    if(lo>hi) {long long t=lo; lo=hi; hi=t;}
+    if(a.lo<=0 && a.hi>=0) lo=0;
+    return MakeRange(lo, hi);
+}
+
+struct RangeState
+{
+    SymbolTable* symbol_table;
+    int num_vars;
+    bool* tracked;              // by memloc: the variable is an int
+};
+
+Range ExprRange(RangeState* rs, TreeNode* node, Range* env);
+
+// True if no value in the range of an operand is 0 (or below 0 if negative)
+bool ExcludesValue(RangeState* rs, TreeNode* node, Range* env, bool negative)
+{
+    if(node->node_kind==NUM_NODE && node->expr_data_type==REAL) return negative ? node->real_num>=0.0 : node->real_num!=0.0;
+    if(node->expr_data_type!=INTEGER) return false;
+    Range r=ExprRange(rs, node, env);
+    if(IsEmptyRange(r)) return true;
+    return negative ? r.lo>=0 : (r.lo>0 || r.hi<0);
+}
+
+Range ExprRange(RangeState* rs, TreeNode* node, Range* env)
+{
+    if(node->node_kind==NUM_NODE) return node->expr_data_type==INTEGER ? MakeRange(node->num, node->num) : FullRange();
+    if(node->node_kind==ID_NODE)
+    {
+        VariableInfo* var=rs->symbol_table->Find(node->id);
+        return var && rs->tracked[var->memloc] ? env[var->memloc] : FullRange();
+    }
+    if(node->node_kind!=OPER_NODE) return FullRange();
+
+    if(node->oper==DIVIDE || node->oper==POWER)
+    {
+        node->unchecked=ExcludesValue(rs, node->child[1], env, node->oper==POWER);
+    }
+
+    Range a=ExprRange(rs, node->child[0], env);
+    Range b=ExprRange(rs, node->child[1], env);
+    // INT_MIN / -1 traps like a division by zero
+    if(node->oper==DIVIDE && node->expr_data_type==INTEGER && a.lo==RANGE_MIN && b.lo<=-1 && b.hi>=-1)
+        node->unchecked=false;
+    if(node->expr_data_type!=INTEGER || IsComparison(node->oper)) return FullRange();
+    if(IsEmptyRange(a) || IsEmptyRange(b)) return MakeRange(1, 0);
+
+    switch(node->oper)
+    {
+        case PLUS: return WrappedRange(a.lo+b.lo, a.hi+b.hi);
+        case MINUS: return WrappedRange(a.lo-b.hi, a.hi-b.lo);
+        case TIMES: return WrappedRange(MinOf4(a.lo*b.lo, a.lo*b.hi, a.hi*b.lo, a.hi*b.hi), MaxOf4(a.lo*b.lo, a.lo*b.hi, a.hi*b.lo, a.hi*b.hi));
+        case DIVIDE:
+        {
+            // |a/b| <= |a|, and it is only computed if b is not 0
+            long long m=-a.lo>a.hi ? -a.lo : a.hi;
+            return WrappedRange(-m, m);
+        }
+        case AND_OP:
+        {
+            Range sa=SquareRange(a), sb=SquareRange(b);
+            return WrappedRange(sa.lo-sb.hi, sa.hi-sb.lo);
+        }
+        default: return FullRange();
+    }
+}
+
+// Narrows env to the values for which cond is truth
+void RefineRanges(RangeState* rs, TreeNode* cond, bool truth, Range* env)
+{
+    if(cond->node_kind!=OPER_NODE || !IsComparison(cond->oper)) return;
+    if(cond->child[0]->expr_data_type!=INTEGER || cond->child[1]->expr_data_type!=INTEGER) return;
+
+    int k;
+    for(k=0;k<2;k++)
+    {
+        TreeNode* id=cond->child[k];
+        if(id->node_kind!=ID_NODE) continue;
+        VariableInfo* var=rs->symbol_table->Find(id->id);
+        if(!var || !rs->tracked[var->memloc]) continue;
+
+        // id oper other, with the operator mirrored if id is on the right
+        Range other=ExprRange(rs, cond->child[1-k], env);
+        if(IsEmptyRange(other)) continue;
+        TokenType oper=cond->oper;
+        if(k==1)
+        {
+            if(oper==LESS_THAN) oper=GREATER_THAN;
+            else if(oper==GREATER_THAN) oper=LESS_THAN;
+            else if(oper==LESS_EQUAL) oper=GREATER_EQUAL;
+            else if(oper==GREATER_EQUAL) oper=LESS_EQUAL;
+        }
+        if(!truth)
+        {
+            if(oper==LESS_THAN) oper=GREATER_EQUAL;
+            else if(oper==GREATER_THAN) oper=LESS_EQUAL;
+            else if(oper==LESS_EQUAL) oper=GREATER_THAN;
+            else if(oper==GREATER_EQUAL) oper=LESS_THAN;
+        }
+
+        Range* r=&env[var->memloc];
+        if(oper==EQUAL && truth) {if(other.lo>r->lo) r->lo=other.lo; if(other.hi<r->hi) r->hi=other.hi;}
+        else if(oper==EQUAL)
+        {
+            if(other.lo==other.hi && r->lo==other.lo) r->lo++;
+            else if(other.lo==other.hi && r->hi==other.lo) r->hi--;
+        }
+        else if(oper==LESS_THAN && other.hi-1<r->hi) r->hi=other.hi-1;
+        else if(oper==LESS_EQUAL && other.hi<r->hi) r->hi=other.hi;
+        else if(oper==GREATER_THAN && other.lo+1>r->lo) r->lo=other.lo+1;
+        else if(oper==GREATER_EQUAL && other.lo>r->lo) r->lo=other.lo;
+    }
+}
+
+void RangesOfStmtSeq(RangeState* rs, TreeNode* node, Range* env);
+
+void RangesOfRepeat(RangeState* rs, TreeNode* node, Range* env)
+{
+    int i, n=rs->num_vars, round;
+    Range* entry=new Range[n+1];
+    Range* cur=new Range[n+1];
+    for(i=0;i<n;i++) entry[i]=env[i];
+
+    for(round=1;;round++)
+    {
+        for(i=0;i<n;i++) cur[i]=entry[i];
+        RangesOfStmtSeq(rs, node->child[0], cur);
+        ExprRange(rs, node->child[1], cur);
+        for(i=0;i<n;i++) env[i]=cur[i];
+        RefineRanges(rs, node->child[1], false, cur);
+
+        bool changed=false;
+        for(i=0;i<n;i++)
+        {
+            Range r=JoinRanges(entry[i], cur[i]);
+            if(r.lo==entry[i].lo && r.hi==entry[i].hi) continue;
+            if(round>=MAX_RANGE_ROUNDS)
+            {
+                if(r.lo<entry[i].lo) r.lo=RANGE_MIN;
+                if(r.hi>entry[i].hi) r.hi=RANGE_MAX;
+            }
+            entry[i]=r;
+            changed=true;
+        }
+        if(!changed) break;
+    }
+    RefineRanges(rs, node->child[1], true, env);
+
+    delete[] entry;
+    delete[] cur;
+}
+
+void RangesOfStmtSeq(RangeState* rs, TreeNode* node, Range* env)
+{
+    int i, n=rs->num_vars;
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==IF_NODE)
+        {
+            Range* other=new Range[n+1];
+            ExprRange(rs, node->child[0], env);
+            for(i=0;i<n;i++) other[i]=env[i];
+            RefineRanges(rs, node->child[0], true, env);
+            RefineRanges(rs, node->child[0], false, other);
+            RangesOfStmtSeq(rs, node->child[1], env);
+            RangesOfStmtSeq(rs, node->child[2], other);
+            for(i=0;i<n;i++) env[i]=JoinRanges(env[i], other[i]);
+            delete[] other;
+        }
+        else if(node->node_kind==REPEAT_NODE) RangesOfRepeat(rs, node, env);
+        else if(node->node_kind==WRITE_NODE) ExprRange(rs, node->child[0], env);
+        else
+        {
+            VariableInfo* var=rs->symbol_table->Find(node->id);
+            Range r=FullRange();
+            if(node->child[0]) r=ExprRange(rs, node->child[0], env);
+            else if(node->node_kind==DECL_NODE) r=MakeRange(0, 0);
+            if(var && rs->tracked[var->memloc]) env[var->memloc]=r;
+        }
+    }
+}
+
+int CountUnchecked(TreeNode* node)
+{
+    int i, n=0;
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==OPER_NODE && node->unchecked) n++;
+        for(i=0;i<MAX_CHILDREN;i++) if(node->child[i]) n+=CountUnchecked(node->child[i]);
+    }
+    return n;
+}
+
+// A node visited in several rounds of a loop keeps what the last one found, so the
+// checks removed are counted over the whole tree
+int AnalyzeRanges(TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    int i;
+    RangeState rs;
+    rs.symbol_table=symbol_table;
+    rs.num_vars=symbol_table->num_vars;
+    rs.tracked=new bool[rs.num_vars+1];
+    Range* env=new Range[rs.num_vars+1];
+
+    for(i=0;i<rs.num_vars;i++) rs.tracked[i]=false;
+    for(i=0;i<SYMBOL_HASH_SIZE;i++)
+        for(VariableInfo* v=symbol_table->var_info[i];v;v=v->next_var)
+            if(v->var_type==INTEGER) rs.tracked[v->memloc]=true;
+    for(i=0;i<rs.num_vars;i++) env[i]=MakeRange(0, 0);
+
+    int before=CountUnchecked(syntax_tree);
+    RangesOfStmtSeq(&rs, syntax_tree, env);
+    int removed=CountUnchecked(syntax_tree)-before;
+
+    delete[] rs.tracked;
+    delete[] env;
+    return removed>0 ? removed : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Static Typing ///////////////////////////////////////////////////////////////////
+
+// The tree interpreter is dynamically typed: a variable holds a VOID value until it is
+// first assigned, and an ID_NODE analyzed before the assignment that declares its
+// variable is typed INTEGER. Compiled engines use the analyzer's types instead, which
+// only agree with the interpreter when:
+// - every ID_NODE has the type of its variable, and
+// - every real or bool variable is assigned before it is read (a VOID value behaves
+//   exactly like an int 0, so int variables need no such check), and
+// - no declaration gives its variable another type than the symbol table's (the
+//   interpreter forces the stored value to the declared type)
+// Programs that do not satisfy this are always run by the tree interpreter.
+
+bool IsExprStaticallyTyped(TreeNode* node, SymbolTable* symbol_table, bool* assigned)
+{
+    int i;
+    if(node->node_kind==ID_NODE)
+    {
+        VariableInfo* var=symbol_table->Find(node->id);
+        if(!var || var->var_type!=node->expr_data_type) return false;
+        if(var->var_type!=INTEGER && !assigned[var->memloc]) return false;
+    }
+    for(i=0;i<MAX_CHILDREN;i++)
+        if(node->child[i] && !IsExprStaticallyTyped(node->child[i], symbol_table, assigned)) return false;
+    return true;
+}
+
+// Checks the statement list starting at node, assigned[] holds the variables that are
+// definitely assigned on entry and is updated to those definitely assigned on exit
+bool IsStmtSeqStaticallyTyped(TreeNode* node, SymbolTable* symbol_table, bool* assigned)
+{
+    int i, n=symbol_table->num_vars;
+
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==IF_NODE)
+        {
+            if(!IsExprStaticallyTyped(node->child[0], symbol_table, assigned)) return false;
+
+            bool* else_assigned=new bool[n+1];
+            for(i=0;i<n;i++) else_assigned[i]=assigned[i];
+
+            bool ok=IsStmtSeqStaticallyTyped(node->child[1], symbol_table, assigned) &&
+                    IsStmtSeqStaticallyTyped(node->child[2], symbol_table, else_assigned);
+
+            // Only what both branches assign is definitely assigned after the if
+            for(i=0;i<n;i++) assigned[i]=assigned[i] && else_assigned[i];
+            delete[] else_assigned;
+            if(!ok) return false;
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            // The body runs at least once and every later iteration starts with at least
+            // as many assigned variables, so checking the first iteration is enough
+            if(!IsStmtSeqStaticallyTyped(node->child[0], symbol_table, assigned)) return false;
+            if(!IsExprStaticallyTyped(node->child[1], symbol_table, assigned)) return false;
+        }
+        else
+        {
+            if(node->node_kind==WRITE_NODE || node->child[0])
+                if(!IsExprStaticallyTyped(node->child[0], symbol_table, assigned)) return false;
+
+            if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE || node->node_kind==READ_NODE)
+            {
+                VariableInfo* var=symbol_table->Find(node->id);
+                if(!var) return false;
+                if(node->node_kind==DECL_NODE && node->var_type!=var->var_type) return false;
+                assigned[var->memloc]=true;
+            }
+        }
+    }
+    return true;
+}
+
+bool IsStaticallyTyped(TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    int i;
+    bool* assigned=new bool[symbol_table->num_vars+1];
+    for(i=0;i<symbol_table->num_vars;i++) assigned[i]=false;
+
+    bool ok=IsStmtSeqStaticallyTyped(syntax_tree, symbol_table, assigned);
+
+    delete[] assigned;
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Bytecode Generator //////////////////////////////////////////////////////////////
+
+// Makes room for at least need elements in a growable array of capacity cap
+template<class T> void Reserve(T*& arr, int& cap, int need)
+{
+    if(need<=cap) return;
+    int new_cap=cap>0 ? cap : 64;
+    while(new_cap<need) new_cap*=2;
+    T* new_arr=new T[new_cap];
+    int i;
+    for(i=0;i<cap;i++) new_arr[i]=arr[i];
+    if(arr) delete[] arr;
+    arr=new_arr;
+    cap=new_cap;
+}
+
+// Variable names and types by memloc, used by read prompts
+// Names point into the symbol table
+struct VariableLayout
+{
+    int num_vars;
+    char** names;
+    ExprDataType* types;
+
+    VariableLayout() {num_vars=0; names=0; types=0;}
+    ~VariableLayout() {if(names) delete[] names; if(types) delete[] types;}
+
+    void Set(SymbolTable* symbol_table)
+    {
+        int i;
+        num_vars=symbol_table->num_vars;
+        names=new char*[num_vars+1];
+        types=new ExprDataType[num_vars+1];
+        for(i=0;i<SYMBOL_HASH_SIZE;i++)
+        {
+            VariableInfo* cur=symbol_table->var_info[i];
+            for(;cur;cur=cur->next_var)
+            {
+                names[cur->memloc]=cur->name;
+                types[cur->memloc]=cur->var_type;
+            }
+        }
+    }
+};
+
+// Stack machine instructions
+// Each instruction is one opcode word followed by its operand words (if any)
+// Instructions are typed: suffix I works on ints (and bools), R on reals, B on bools
+// Comparisons push 1 or 0, mixed int/real operands are converted by I2R before the op
+enum OpCode{
+                OP_PUSHI,       // PUSHI k: push int constant k
+                OP_PUSHR,       // PUSHR k: push real constant reals[k]
+                OP_LOAD,        // LOAD v: push variable v
+                OP_STORE,       // STORE v: pop into variable v
+                OP_I2R,         // convert top of stack from int to real
+                OP_R2I,         // convert top of stack from real to int (truncates)
+                OP_ADDI, OP_ADDR, OP_SUBI, OP_SUBR, OP_MULI, OP_MULR, OP_DIVI, OP_DIVR,
+                OP_POWI, OP_POWR,   // POWR: real base, int exponent
+                OP_ANDI, OP_ANDR,   // a & b = a^2 - b^2
+                OP_EQI, OP_EQR, OP_LTI, OP_LTR, OP_GTI, OP_GTR, OP_GEI, OP_GER, OP_LEI, OP_LER,
+                OP_JMP,         // JMP t: jump to t
+                OP_JF,          // JF t: pop, jump to t if false (0)
+                OP_WRITEI, OP_WRITER, OP_WRITEB,    // pop and write
+                OP_READI, OP_READR, OP_READB,       // READx v: read into variable v
+                OP_HALT
+           };
+
+// Used for debugging only /////////////////////////////////////////////////////////
+const char* OpCodeStr[]=
+            {
+                "PushI", "PushR", "Load", "Store", "I2R", "R2I",
+                "AddI", "AddR", "SubI", "SubR", "MulI", "MulR", "DivI", "DivR",
+                "PowI", "PowR", "AndI", "AndR",
+                "EqI", "EqR", "LtI", "LtR", "GtI", "GtR", "GeI", "GeR", "LeI", "LeR",
+                "Jmp", "JF",
+                "WriteI", "WriteR", "WriteB",
+                "ReadI", "ReadR", "ReadB",
+                "Halt"
+            };
+
+// A runtime value of a compiled program, the static type tells which member is used
+// (bools are stored in i as 0 or the value read)
+union VMValue
+{
+    int i;
+    double r;
+};
+
+struct BytecodeProgram
+{
+    int* code;              // instruction words
+    int code_size, code_cap;
+
+    double* reals;          // real constant pool
+    int num_reals, reals_cap;
+
+    VariableLayout vars;    // variable v lives in slot v (its memloc)
+
+    int stack_depth, max_stack;     // tracked while generating
+
+    BytecodeProgram() {code=0; code_size=code_cap=0; reals=0; num_reals=reals_cap=0; stack_depth=max_stack=0;}
+    ~BytecodeProgram()
+    {
+        if(code) delete[] code;
+        if(reals) delete[] reals;
+    }
+
+    // Appends one word, returns its index
+    int Emit(int w)
+    {
+        Reserve(code, code_cap, code_size+1);
+        code[code_size]=w;
+        return code_size++;
+    }
+
+    // Appends an instruction and records its effect on the stack depth
+    int Emit(OpCode op, int stack_change)
+    {
+        stack_depth+=stack_change;
+        if(stack_depth>max_stack) max_stack=stack_depth;
+        return Emit(op);
+    }
+
+    int AddReal(double r)
+    {
+        int i;
+        for(i=0;i<num_reals;i++) if(memcmp(&reals[i], &r, sizeof(r))==0) return i;
+        Reserve(reals, reals_cap, num_reals+1);
+        reals[num_reals]=r;
+        return num_reals++;
+    }
+};
+
+// Picks the int or real form of a typed instruction
+inline OpCode TypedOp(OpCode int_op, ExprDataType type) {return (OpCode)(type==REAL ? int_op+1 : int_op);}
+
+// Operator token to int-typed opcode (the real form follows it)
+OpCode OperOpCode(TokenType oper)
+{
+    switch(oper)
+    {
+        case PLUS: return OP_ADDI;
+        case MINUS: return OP_SUBI;
+        case TIMES: return OP_MULI;
+        case DIVIDE: return OP_DIVI;
+        case POWER: return OP_POWI;
+        case AND_OP: return OP_ANDI;
+        case EQUAL: return OP_EQI;
+        case LESS_THAN: return OP_LTI;
+        case GREATER_THAN: return OP_GTI;
+        case GREATER_EQUAL: return OP_GEI;
+        case LESS_EQUAL: return OP_LEI;
+        default: throw 0;
+    }
+}
+
+// Emits code leaving the value of the expression on top of the stack
+void GenerateExpr(BytecodeProgram* prog, TreeNode* node, SymbolTable* symbol_table)
+{
+    if(node->node_kind==NUM_NODE)
+    {
+        if(node->expr_data_type==REAL) {prog->Emit(OP_PUSHR, 1); prog->Emit(prog->AddReal(node->real_num));}
+        else {prog->Emit(OP_PUSHI, 1); prog->Emit(node->num);}
+        return;
+    }
+
+    if(node->node_kind==ID_NODE)
+    {
+        prog->Emit(OP_LOAD, 1); prog->Emit(symbol_table->Find(node->id)->memloc);
+        return;
+    }
+
+    ExprDataType left_type=node->child[0]->expr_data_type;
+    ExprDataType right_type=node->child[1]->expr_data_type;
+
+    // Operands are computed in the type of the operation, like EvaluateOper() does:
+    // any real operand makes the operation real, except the exponent of ^ which is an int
+    ExprDataType op_type=(left_type==REAL || right_type==REAL) ? REAL : INTEGER;
+
+    GenerateExpr(prog, node->child[0], symbol_table);
+    if(op_type==REAL && left_type!=REAL) prog->Emit(OP_I2R, 0);
+
+    GenerateExpr(prog, node->child[1], symbol_table);
+    if(node->oper==POWER) {if(right_type==REAL) prog->Emit(OP_R2I, 0);}
+    else if(op_type==REAL && right_type!=REAL) prog->Emit(OP_I2R, 0);
+
+    prog->Emit(TypedOp(OperOpCode(node->oper), op_type), -1);
+}
+
+void GenerateStmtSeq(BytecodeProgram* prog, TreeNode* node, SymbolTable* symbol_table)
+{
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==IF_NODE)
+        {
+            GenerateExpr(prog, node->child[0], symbol_table);
+            prog->Emit(OP_JF, -1); int jump_else=prog->Emit(0);
+            GenerateStmtSeq(prog, node->child[1], symbol_table);
+            if(node->child[2])
+            {
+                prog->Emit(OP_JMP, 0); int jump_end=prog->Emit(0);
+                prog->code[jump_else]=prog->code_size;
+                GenerateStmtSeq(prog, node->child[2], symbol_table);
+                prog->code[jump_end]=prog->code_size;
+            }
+            else prog->code[jump_else]=prog->code_size;
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            int loop_start=prog->code_size;
+            GenerateStmtSeq(prog, node->child[0], symbol_table);
+            GenerateExpr(prog, node->child[1], symbol_table);
+            prog->Emit(OP_JF, -1); prog->Emit(loop_start);
+        }
+        else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+        {
+            VariableInfo* var=symbol_table->Find(node->id);
+            if(node->child[0]) GenerateExpr(prog, node->child[0], symbol_table);
+            else if(var->var_type==REAL) {prog->Emit(OP_PUSHR, 1); prog->Emit(prog->AddReal(0.0));}
+            else {prog->Emit(OP_PUSHI, 1); prog->Emit(0);}
+            prog->Emit(OP_STORE, -1); prog->Emit(var->memloc);
+        }
+        else if(node->node_kind==READ_NODE)
+        {
+            VariableInfo* var=symbol_table->Find(node->id);
+            prog->Emit(var->var_type==REAL ? OP_READR : var->var_type==BOOLEAN ? OP_READB : OP_READI, 0);
+            prog->Emit(var->memloc);
+        }
+        else if(node->node_kind==WRITE_NODE)
+        {
+            ExprDataType type=node->child[0]->expr_data_type;
+            GenerateExpr(prog, node->child[0], symbol_table);
+            prog->Emit(type==REAL ? OP_WRITER : type==BOOLEAN ? OP_WRITEB : OP_WRITEI, -1);
+        }
+    }
+}
+
+// Compiles the analyzed tree (which must be statically typed) into prog
+void GenerateBytecode(BytecodeProgram* prog, TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    prog->vars.Set(symbol_table);
+    GenerateStmtSeq(prog, syntax_tree, symbol_table);
+    prog->Emit(OP_HALT, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// SSA Form ////////////////////////////////////////////////////////////////////////
+
+// Mid-level IR for dataflow optimizations: the program as basic blocks of
+// instructions in SSA form. Every instruction defines at most one value, and an
+// operand refers directly to the instruction whose value it reads, so a variable
+// read is replaced by the last value assigned to it. Blocks are built from the
+// if and repeat statements of the tree and the structure they came from is kept
+// (IRRegion). After the SSA passes the IR is translated back into a tree (see
+// LeaveSSA()), which every engine and backend compiles, so an optimization written
+// once for the IR benefits all of them.
+// Only statically typed programs are translated (see IsStaticallyTyped()).
+//
+// Control flow (phi arguments are in the order of the block's predecessors):
+//   if:     cond block -> then (true), else (false); then end, else end -> join
+//   repeat: preheader -> header; latch -> exit (true), header (false)
+// An if always gets an else block (empty if there is no else part) so that the
+// copies leaving SSA form adds for phis always have a block to go in
+
+enum IROp {IR_CONST, IR_PHI, IR_OPER, IR_COPY, IR_READ, IR_WRITE};
+
+struct IRBlock;
+
+struct IRInstr
+{
+    IROp op;
+    ExprDataType type;          // type of the value, VOID for write
+    TokenType oper;             // IR_OPER, operands are converted as in EvaluateOper()
+    TypedValue value;           // IR_CONST
+    IRInstr* arg[2];            // oper: both, copy and write: arg[0], phi: one per predecessor
+    VariableInfo* var;          // variable that holds the value, 0 if it has none (yet)
+    IRBlock* block;
+    IRInstr* prev;
+    IRInstr* next;
+    IRInstr* repl;              // value that replaces this one, see IRApplyReplacements()
+    int id;                     // index in IRProgram::instrs
+    int line;
+
+    // Leaving SSA form
+    int uses;
+    IRInstr* user;              // the only user if uses==1, 0 if that is a block condition
+    bool pending;
+    bool inlined;               // computed inside the expression of its user
+
+    // Value numbering
+    int order;                  // position in its block
+    IRInstr* hash_next;
+};
+
+struct IRBlock
+{
+    int id;
+    IRInstr* first;
+    IRInstr* last;
+    IRBlock* pred[2];
+    IRBlock* succ[2];           // with a condition succ[0] is taken when it is true
+    int num_preds, num_succs;
+    IRInstr* cond;              // condition of the if or repeat that ends the block
+    IRBlock* idom;              // immediate dominator, 0 for the entry block
+    int depth;                  // depth in the dominator tree
+    unsigned* live_in;          // leaving SSA form: values live after the phis
+};
+
+enum IRRegionKind {IR_REGION_BLOCK, IR_REGION_IF, IR_REGION_REPEAT};
+
+// Statement structure of the blocks: a list of regions per statement list
+// The condition of an if ends the block before it, an if or repeat is always followed
+// by a block (its join or exit), and a repeat body starts with the loop header
+struct IRRegion
+{
+    IRRegionKind kind;
+    IRBlock* block;             // IR_REGION_BLOCK
+    IRRegion* body[2];          // if: then and else lists, repeat: body list
+    IRRegion* next;
+    int line;
+};
+
+struct IRProgram
+{
+    SymbolTable* symbol_table;
+    IRBlock** blocks;           // in creation order, a block's dominators come before it
+    int num_blocks, blocks_cap;
+    IRInstr** instrs;           // every instruction created, by id
+    int num_instrs, instrs_cap;
+    IRRegion** regions;
+    int num_regions, regions_cap;
+    IRRegion* body;
+    int num_temps;
+
+    IRProgram(SymbolTable* st)
+    {
+        symbol_table=st; body=0; num_temps=0;
+        blocks=0; num_blocks=blocks_cap=0;
+        instrs=0; num_instrs=instrs_cap=0;
+        regions=0; num_regions=regions_cap=0;
+    }
+
+    ~IRProgram()
+    {
+        int i;
+        for(i=0;i<num_blocks;i++) {if(blocks[i]->live_in) delete[] blocks[i]->live_in; delete blocks[i];}
+        for(i=0;i<num_instrs;i++) delete instrs[i];
+        for(i=0;i<num_regions;i++) delete regions[i];
+        if(blocks) delete[] blocks;
+        if(instrs) delete[] instrs;
+        if(regions) delete[] regions;
+    }
+
+    IRBlock* NewBlock(IRBlock* idom)
+    {
+        IRBlock* b=new IRBlock;
+        b->id=num_blocks;
+        b->first=b->last=0;
+        b->pred[0]=b->pred[1]=b->succ[0]=b->succ[1]=0;
+        b->num_preds=b->num_succs=0;
+        b->cond=0;
+        b->idom=idom;
+        b->depth=idom ? idom->depth+1 : 0;
+        b->live_in=0;
+        Reserve(blocks, blocks_cap, num_blocks+1);
+        blocks[num_blocks++]=b;
+        return b;
+    }
+
+    IRRegion* NewRegion(IRRegionKind kind, IRBlock* block, int line)
+    {
+        IRRegion* r=new IRRegion;
+        r->kind=kind;
+        r->block=block;
+        r->body[0]=r->body[1]=r->next=0;
+        r->line=line;
+        Reserve(regions, regions_cap, num_regions+1);
+        regions[num_regions++]=r;
+        return r;
+    }
+
+    // Creates an instruction, appended to block unless it is 0
+    IRInstr* NewInstr(IROp op, ExprDataType type, IRBlock* block, int line)
+    {
+        IRInstr* i=new IRInstr;
+        i->op=op;
+        i->type=type;
+        i->oper=ERROR;
+        i->arg[0]=i->arg[1]=0;
+        i->var=0;
+        i->block=0;
+        i->prev=i->next=i->repl=0;
+        i->id=num_instrs;
+        i->line=line;
+        i->uses=0; i->user=0; i->pending=i->inlined=false;
+        i->order=0; i->hash_next=0;
+        Reserve(instrs, instrs_cap, num_instrs+1);
+        instrs[num_instrs++]=i;
+        if(block) InsertAfter(block, block->last, i);
+        return i;
+    }
+
+    // Links i into block b after pos (at the start if pos is 0)
+    void InsertAfter(IRBlock* b, IRInstr* pos, IRInstr* i)
+    {
+        i->block=b;
+        i->prev=pos;
+        i->next=pos ? pos->next : b->first;
+        if(i->next) i->next->prev=i; else b->last=i;
+        if(pos) pos->next=i; else b->first=i;
+    }
+
+    void Unlink(IRInstr* i)
+    {
+        IRBlock* b=i->block;
+        if(i->prev) i->prev->next=i->next; else b->first=i->next;
+        if(i->next) i->next->prev=i->prev; else b->last=i->prev;
+        i->prev=i->next=0;
+        i->block=0;
+    }
+
+    void Link(IRBlock* from, IRBlock* to)
+    {
+        from->succ[from->num_succs++]=to;
+        to->pred[to->num_preds++]=from;
+    }
+
+    int NumLinkedInstrs(IROp op)
+    {
+        int i, n=0;
+        for(i=0;i<num_blocks;i++)
+            for(IRInstr* x=blocks[i]->first;x;x=x->next) if(x->op==op) n++;
+        return n;
+    }
+};
+
+// Follows replacements to the value that stands for i now
+IRInstr* IRResolve(IRInstr* i)
+{
+    while(i && i->repl) i=i->repl;
+    return i;
+}
+
+// Redirects every operand and condition to its replacement and unlinks the replaced
+// instructions, so a pass can mark replacements while it walks the blocks
+void IRApplyReplacements(IRProgram* prog)
+{
+    int i, k;
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        for(IRInstr* x=b->first;x;x=x->next)
+            for(k=0;k<2;k++) x->arg[k]=IRResolve(x->arg[k]);
+        b->cond=IRResolve(b->cond);
+    }
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRInstr* next;
+        for(IRInstr* x=prog->blocks[i]->first;x;x=next)
+        {
+            next=x->next;
+            if(x->repl) prog->Unlink(x);
+        }
+    }
+}
+
+// A phi whose arguments are all the same value (or the phi itself) is that value
+int IRRemoveTrivialPhis(IRProgram* prog)
+{
+    int i, removed=0;
+    bool changed=true;
+
+    while(changed)
+    {
+        changed=false;
+        for(i=0;i<prog->num_blocks;i++)
+            for(IRInstr* x=prog->blocks[i]->first;x;x=x->next)
+            {
+                if(x->op!=IR_PHI || x->repl) continue;
+                IRInstr* a=IRResolve(x->arg[0]);
+                IRInstr* b=IRResolve(x->arg[1]);
+                IRInstr* same=0;
+                if(a==b || b==x) same=a;
+                else if(a==x) same=b;
+                if(same && same!=x) {x->repl=same; changed=true; removed++;}
+            }
+    }
+    IRApplyReplacements(prog);
+    return removed;
+}
+
+void PrintIRValue(IRInstr* i)
+{
+    if(i->op!=IR_CONST) printf("v%d", i->id);
+    else if(i->type==REAL) printf("%g", i->value.real_val);
+    else if(i->type==BOOLEAN) printf("%s", i->value.bool_val ? "true" : "false");
+    else printf("%d", i->value.int_val);
+}
+
+void PrintIR(IRProgram* prog)
+{
+    int i, k;
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        printf("B%d:", b->id);
+        for(k=0;k<b->num_preds;k++) printf("%s B%d", k ? "," : " preds", b->pred[k]->id);
+        printf("\n");
+
+        for(IRInstr* x=b->first;x;x=x->next)
+        {
+            if(x->op==IR_CONST) continue;
+            printf("    ");
+            if(x->op==IR_WRITE) {printf("write "); PrintIRValue(x->arg[0]);}
+            else
+            {
+                printf("v%d %s = ", x->id, ExprDataTypeStr[x->type]);
+                if(x->op==IR_READ) printf("read");
+                else if(x->op==IR_COPY) PrintIRValue(x->arg[0]);
+                else if(x->op==IR_OPER)
+                {
+                    PrintIRValue(x->arg[0]);
+                    printf(" %s ", TokenTypeStr[x->oper]);
+                    PrintIRValue(x->arg[1]);
+                }
+                else
+                {
+                    printf("phi");
+                    for(k=0;k<b->num_preds;k++) {printf("%s", k ? ", " : " "); PrintIRValue(x->arg[k]);}
+                }
+                if(x->var) printf("  [%s]", x->var->name);
+            }
+            printf("\n");
+        }
+
+        if(b->cond) {printf("    branch "); PrintIRValue(b->cond); printf(" B%d B%d\n", b->succ[0]->id, b->succ[1]->id);}
+        else if(b->num_succs) printf("    jump B%d\n", b->succ[0]->id);
+        else printf("    end\n");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// SSA Construction ////////////////////////////////////////////////////////////////
+
+// Built in one structured walk of the tree: the current value of every variable is
+// tracked, an if merges the values of its branches with phis at the join, and a
+// repeat gets a phi in its header for every variable its body assigns, whose value
+// from the latch is known once the body is built. Phis that turn out not to merge
+// different values are removed at the end.
+
+struct IRBuilder
+{
+    IRProgram* prog;
+    IRBlock* block;             // where instructions are appended
+    IRRegion** tail;            // where the next region is linked
+    IRInstr** cur;              // current value of each variable by memloc, 0 before it is assigned
+    VariableInfo** vars;        // by memloc
+    int num_vars;
+    bool ok;                    // false if the program uses something the IR cannot express
+};
+
+// A variable never assigned holds the default value of its type
+IRInstr* IRDefaultValue(IRProgram* prog, ExprDataType type, IRBlock* block, int line)
+{
+    IRInstr* c=prog->NewInstr(IR_CONST, type, block, line);
+    if(type==REAL) c->value=TypedValue(0.0);
+    else if(type==BOOLEAN) c->value=TypedValue(0, true);
+    else c->value=TypedValue(0);
+    return c;
+}
+
+// The value of var, a default value created in block if it has none yet
+IRInstr* IRCurrentValue(IRBuilder* b, VariableInfo* var, IRBlock* block, int line)
+{
+    if(!b->cur[var->memloc]) b->cur[var->memloc]=IRDefaultValue(b->prog, var->var_type, block, line);
+    return IRResolve(b->cur[var->memloc]);
+}
+
+void IRAppendRegion(IRBuilder* b, IRRegion* r)
+{
+    *b->tail=r;
+    b->tail=&r->next;
+}
+
+// Sets assigned[memloc] for every variable the statement list may assign
+void IRMarkAssigned(TreeNode* node, SymbolTable* symbol_table, bool* assigned)
+{
+    int i;
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE || node->node_kind==READ_NODE)
+            assigned[symbol_table->Find(node->id)->memloc]=true;
+        if(node->node_kind==IF_NODE || node->node_kind==REPEAT_NODE)
+            for(i=0;i<MAX_CHILDREN;i++) IRMarkAssigned(node->child[i], symbol_table, assigned);
+    }
+}
+
+IRInstr* BuildIRExpr(IRBuilder* b, TreeNode* node)
+{
+    if(node->node_kind==NUM_NODE)
+    {
+        IRInstr* c=b->prog->NewInstr(IR_CONST, node->expr_data_type, b->block, node->line_num);
+        c->value=ConstValue(node);
+        return c;
+    }
+    if(node->node_kind==ID_NODE)
+        return IRCurrentValue(b, b->prog->symbol_table->Find(node->id), b->block, node->line_num);
+
+    IRInstr* left=BuildIRExpr(b, node->child[0]);
+    IRInstr* right=BuildIRExpr(b, node->child[1]);
+    IRInstr* x=b->prog->NewInstr(IR_OPER, node->expr_data_type, b->block, node->line_num);
+    x->oper=node->oper;
+    x->arg[0]=left;
+    x->arg[1]=right;
+    return x;
+}
+
+void BuildIRStmtSeq(IRBuilder* b, TreeNode* node);
+
+// Builds a branch of an if starting in block entry, its regions go in *list
+void BuildIRBranch(IRBuilder* b, IRBlock* entry, IRRegion** list, TreeNode* node)
+{
+    b->block=entry;
+    b->tail=list;
+    IRAppendRegion(b, b->prog->NewRegion(IR_REGION_BLOCK, entry, 0));
+    BuildIRStmtSeq(b, node);
+}
+
+void BuildIRIf(IRBuilder* b, TreeNode* node)
+{
+    IRProgram* prog=b->prog;
+    int i, n=b->num_vars;
+
+    IRBlock* cond_block=b->block;
+    cond_block->cond=BuildIRExpr(b, node->child[0]);
+    IRBlock* then_block=prog->NewBlock(cond_block);
+    IRBlock* else_block=prog->NewBlock(cond_block);
+    IRBlock* join=prog->NewBlock(cond_block);
+    prog->Link(cond_block, then_block);
+    prog->Link(cond_block, else_block);
+
+    IRRegion* r=prog->NewRegion(IR_REGION_IF, 0, node->line_num);
+    IRAppendRegion(b, r);
+
+    IRInstr** before=new IRInstr*[n+1];
+    IRInstr** then_values=new IRInstr*[n+1];
+    for(i=0;i<n;i++) before[i]=b->cur[i];
+
+    BuildIRBranch(b, then_block, &r->body[0], node->child[1]);
+    IRBlock* then_end=b->block;
+    for(i=0;i<n;i++) {then_values[i]=b->cur[i]; b->cur[i]=before[i];}
+
+    BuildIRBranch(b, else_block, &r->body[1], node->child[2]);
+    IRBlock* else_end=b->block;
+
+    prog->Link(then_end, join);
+    prog->Link(else_end, join);
+
+    for(i=0;i<n;i++)
+    {
+        if(IRResolve(then_values[i])==IRResolve(b->cur[i])) continue;
+
+        VariableInfo* var=b->vars[i];
+        IRInstr* phi=prog->NewInstr(IR_PHI, var->var_type, join, node->line_num);
+        phi->var=var;
+        if(!then_values[i]) then_values[i]=IRDefaultValue(prog, var->var_type, then_end, node->line_num);
+        phi->arg[0]=IRResolve(then_values[i]);
+        phi->arg[1]=IRCurrentValue(b, var, else_end, node->line_num);
+        b->cur[i]=phi;
+    }
+
+    delete[] before;
+    delete[] then_values;
+
+    b->tail=&r->next;
+    b->block=join;
+    IRAppendRegion(b, prog->NewRegion(IR_REGION_BLOCK, join, 0));
+}
+
+void BuildIRRepeat(IRBuilder* b, TreeNode* node)
+{
+    IRProgram* prog=b->prog;
+    int i, n=b->num_vars;
+
+    IRBlock* preheader=b->block;
+    IRBlock* header=prog->NewBlock(preheader);
+    prog->Link(preheader, header);
+
+    IRRegion* r=prog->NewRegion(IR_REGION_REPEAT, 0, node->line_num);
+    IRAppendRegion(b, r);
+    b->tail=&r->body[0];
+    b->block=header;
+    IRAppendRegion(b, prog->NewRegion(IR_REGION_BLOCK, header, 0));
+
+    bool* assigned=new bool[n+1];
+    IRInstr** phis=new IRInstr*[n+1];
+    for(i=0;i<n;i++) {assigned[i]=false; phis[i]=0;}
+    IRMarkAssigned(node->child[0], prog->symbol_table, assigned);
+
+    for(i=0;i<n;i++)
+    {
+        if(!assigned[i]) continue;
+        VariableInfo* var=b->vars[i];
+        phis[i]=prog->NewInstr(IR_PHI, var->var_type, header, node->line_num);
+        phis[i]->var=var;
+        phis[i]->arg[0]=IRCurrentValue(b, var, preheader, node->line_num);
+        b->cur[i]=phis[i];
+    }
+
+    BuildIRStmtSeq(b, node->child[0]);
+    IRBlock* latch=b->block;
+    latch->cond=BuildIRExpr(b, node->child[1]);
+
+    IRBlock* exit=prog->NewBlock(latch);
+    prog->Link(latch, exit);
+    prog->Link(latch, header);
+    for(i=0;i<n;i++) if(phis[i]) phis[i]->arg[1]=IRResolve(b->cur[i]);
+
+    delete[] assigned;
+    delete[] phis;
+
+    b->tail=&r->next;
+    b->block=exit;
+    IRAppendRegion(b, prog->NewRegion(IR_REGION_BLOCK, exit, 0));
+}
+
+void BuildIRStmtSeq(IRBuilder* b, TreeNode* node)
+{
+    IRProgram* prog=b->prog;
+
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==IF_NODE) {BuildIRIf(b, node); continue;}
+        if(node->node_kind==REPEAT_NODE) {BuildIRRepeat(b, node); continue;}
+
+        if(node->node_kind==WRITE_NODE)
+        {
+            IRInstr* v=BuildIRExpr(b, node->child[0]);
+            IRInstr* w=prog->NewInstr(IR_WRITE, VOID, b->block, node->line_num);
+            w->arg[0]=v;
+            continue;
+        }
+
+        VariableInfo* var=prog->symbol_table->Find(node->id);
+        if(node->node_kind==READ_NODE)
+        {
+            IRInstr* r=prog->NewInstr(IR_READ, var->var_type, b->block, node->line_num);
+            r->var=var;
+            b->cur[var->memloc]=r;
+            continue;
+        }
+
+        // Assignment or declaration
+        if(node->node_kind==DECL_NODE && node->var_type!=var->var_type) b->ok=false;
+
+        IRInstr* v;
+        if(node->child[0]) v=BuildIRExpr(b, node->child[0]);
+        else v=IRDefaultValue(prog, var->var_type, b->block, node->line_num);
+
+        if(v->op==IR_OPER || v->op==IR_CONST) v->var=var;    // created by this statement
+        else
+        {
+            IRInstr* copy=prog->NewInstr(IR_COPY, var->var_type, b->block, node->line_num);
+            copy->arg[0]=v;
+            copy->var=var;
+            v=copy;
+        }
+        b->cur[var->memloc]=v;
+    }
+}
+
+// Returns the IR of the program, or 0 if it cannot be expressed in it
+IRProgram* BuildIR(TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    int i;
+    IRProgram* prog=new IRProgram(symbol_table);
+
+    IRBuilder b;
+    b.prog=prog;
+    b.num_vars=symbol_table->num_vars;
+    b.cur=new IRInstr*[b.num_vars+1];
+    b.vars=new VariableInfo*[b.num_vars+1];
+    b.ok=true;
+    for(i=0;i<b.num_vars;i++) b.cur[i]=0;
+    for(i=0;i<SYMBOL_HASH_SIZE;i++)
+        for(VariableInfo* v=symbol_table->var_info[i];v;v=v->next_var) b.vars[v->memloc]=v;
+
+    b.block=prog->NewBlock(0);
+    b.tail=&prog->body;
+    IRAppendRegion(&b, prog->NewRegion(IR_REGION_BLOCK, b.block, 0));
+    BuildIRStmtSeq(&b, syntax_tree);
+
+    delete[] b.cur;
+    delete[] b.vars;
+    if(!b.ok) {delete prog; return 0;}
+
+    IRRemoveTrivialPhis(prog);
+    return prog;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// SSA Optimizations ///////////////////////////////////////////////////////////////
+
+// Sparse conditional constant propagation: every value starts unknown and is
+// lowered to a constant or to varying, computing opers on constants as at runtime,
+// until nothing changes. Only blocks found reachable are computed, and a branch on
+// a constant reaches one successor, so a phi only merges the values of edges that
+// can be taken. Values found constant become constants, constant conditions are
+// left for dead-branch elimination once the program is a tree again. Copies of a
+// value of the same type are bypassed, so their users read the value itself.
+// Returns the number of values that became constants or bypassed a copy
+enum IRLattice {IR_UNKNOWN, IR_KNOWN, IR_VARYING};
+
+bool IRSameConst(TypedValue a, TypedValue b)
+{
+    if(a.type!=b.type) return false;
+    if(a.type==REAL) return memcmp(&a.real_val, &b.real_val, sizeof(double))==0;
+    if(a.type==BOOLEAN) return a.bool_val==b.bool_val;
+    return a.int_val==b.int_val;
+}
+
+// Lowers the lattice value of x to state (and value), returns true if it changed
+bool IRLower(IRLattice* state, TypedValue* values, IRInstr* x, IRLattice s, TypedValue v)
+{
+    if(s==IR_KNOWN && state[x->id]==IR_KNOWN && !IRSameConst(values[x->id], v)) s=IR_VARYING;
+    if(s<=state[x->id]) return false;
+    state[x->id]=s;
+    values[x->id]=v;
+    return true;
+}
+
+// Marks the edge from b to its successor k as taken, returns true if it was not
+bool IRTakeEdge(IRBlock* b, int k, bool* reached, bool* taken)
+{
+    IRBlock* s=b->succ[k];
+    int j=s->pred[0]==b ? 0 : 1;
+    if(taken[2*s->id+j]) return false;
+    taken[2*s->id+j]=true;
+    reached[s->id]=true;
+    return true;
+}
+
+int IRPropagateConstants(IRProgram* prog)
+{
+    int i, k, changed_values=0;
+    IRLattice* state=new IRLattice[prog->num_instrs+1];
+    TypedValue* values=new TypedValue[prog->num_instrs+1];
+    bool* reached=new bool[prog->num_blocks+1];
+    bool* taken=new bool[2*prog->num_blocks+1];
+    for(i=0;i<prog->num_instrs;i++) state[i]=IR_UNKNOWN;
+    for(i=0;i<prog->num_blocks;i++) reached[i]=taken[2*i]=taken[2*i+1]=false;
+    reached[0]=true;
+
+    // Blocks come after their dominators, so a sweep is repeated only for loops
+    bool changed=true;
+    while(changed)
+    {
+        changed=false;
+        for(i=0;i<prog->num_blocks;i++)
+        {
+            IRBlock* b=prog->blocks[i];
+            if(!reached[b->id]) continue;
+
+            for(IRInstr* x=b->first;x;x=x->next)
+            {
+                IRLattice s=IR_VARYING;
+                TypedValue v=x->value;
+                if(x->op==IR_WRITE) continue;
+                if(x->op==IR_CONST) {s=IR_KNOWN; v=x->value;}
+                else if(x->op==IR_COPY)
+                {
+                    s=state[x->arg[0]->id];
+                    v=values[x->arg[0]->id];
+                    if(x->arg[0]->type!=x->type) s=IR_VARYING;
+                }
+                else if(x->op==IR_OPER)
+                {
+                    IRLattice a=state[x->arg[0]->id], c=state[x->arg[1]->id];
+                    if(a==IR_VARYING || c==IR_VARYING) s=IR_VARYING;
+                    else if(a==IR_UNKNOWN || c==IR_UNKNOWN) s=IR_UNKNOWN;
+                    else if(CanFold(x->oper, values[x->arg[0]->id], values[x->arg[1]->id]))
+                    {
+                        v=EvaluateOper(x->oper, values[x->arg[0]->id], values[x->arg[1]->id]);
+                        s=v.type==x->type ? IR_KNOWN : IR_VARYING;
+                    }
+                }
+                else if(x->op==IR_PHI)
+                {
+                    s=IR_UNKNOWN;
+                    for(k=0;k<b->num_preds;k++)
+                    {
+                        if(!taken[2*b->id+k]) continue;
+                        IRInstr* a=x->arg[k];
+                        if(state[a->id]==IR_UNKNOWN) continue;
+                        if(state[a->id]==IR_VARYING || a->type!=x->type || (s==IR_KNOWN && !IRSameConst(v, values[a->id])))
+                            {s=IR_VARYING; break;}
+                        s=IR_KNOWN;
+                        v=values[a->id];
+                    }
+                }
+                if(IRLower(state, values, x, s, v)) changed=true;
+            }
+
+            if(!b->cond) {if(b->num_succs && IRTakeEdge(b, 0, reached, taken)) changed=true;}
+            else if(state[b->cond->id]==IR_KNOWN) {if(IRTakeEdge(b, values[b->cond->id].bool_val ? 0 : 1, reached, taken)) changed=true;}
+            else if(state[b->cond->id]==IR_VARYING)
+            {
+                if(IRTakeEdge(b, 0, reached, taken)) changed=true;
+                if(IRTakeEdge(b, 1, reached, taken)) changed=true;
+            }
+        }
+    }
+
+    // Constants replace the values computed, a phi's goes after the phis
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        if(!reached[b->id]) continue;
+        IRInstr* last_phi=0;
+        for(IRInstr* x=b->first;x && x->op==IR_PHI;x=x->next) last_phi=x;
+
+        for(IRInstr* x=b->first;x;x=x->next)
+        {
+            if(x->op==IR_CONST || x->op==IR_WRITE || state[x->id]!=IR_KNOWN) continue;
+            changed_values++;
+            if(x->op==IR_PHI)
+            {
+                IRInstr* c=prog->NewInstr(IR_CONST, x->type, 0, x->line);
+                c->value=values[x->id];
+                c->var=x->var;
+                prog->InsertAfter(b, last_phi, c);
+                x->repl=c;
+                continue;
+            }
+            x->op=IR_CONST;
+            x->value=values[x->id];
+            x->arg[0]=x->arg[1]=0;
+        }
+    }
+    IRApplyReplacements(prog);
+
+    // Copy propagation
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        for(IRInstr* x=b->first;x;x=x->next)
+            for(k=0;k<2;k++)
+            {
+                IRInstr* a=x->arg[k];
+                if(!a || a->op!=IR_COPY) continue;
+                while(a->op==IR_COPY && a->arg[0]->type==a->type) a=a->arg[0];
+                if(a!=x->arg[k]) {x->arg[k]=a; changed_values++;}
+            }
+    }
+
+    delete[] state;
+    delete[] values;
+    delete[] reached;
+    delete[] taken;
+    return changed_values;
+}
+
+// True if the instruction must run even if its value is unused
+bool IRHasEffect(IRInstr* i)
+{
+    if(i->op==IR_READ || i->op==IR_WRITE) return true;
+    if(i->op==IR_OPER && i->oper==DIVIDE)
+    {
+        IRInstr* dividend=i->arg[0];
+        IRInstr* divisor=i->arg[1];
+        if(divisor->op!=IR_CONST) return true;
+        if(divisor->type==REAL) return divisor->value.real_val==0.0;
+        // INT_MIN / -1 overflows, which traps like a division by zero
+        if(divisor->value.int_val==-1 && i->type!=REAL)
+            return dividend->op!=IR_CONST || dividend->value.int_val==-2147483647-1;
+        return divisor->value.int_val==0;
+    }
+    return false;
+}
+
+// Dead code elimination: removes every value no effect or branch depends on,
+// including phis that only feed each other across loop iterations
+// Returns the number of values removed (not counting constants)
+int IRDeadCodeElimination(IRProgram* prog)
+{
+    int i, k, n=0, removed=0;
+    bool* live=new bool[prog->num_instrs+1];
+    IRInstr** work=new IRInstr*[prog->num_instrs+1];
+    for(i=0;i<prog->num_instrs;i++) live[i]=false;
+
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        for(IRInstr* x=b->first;x;x=x->next)
+            if(IRHasEffect(x)) {live[x->id]=true; work[n++]=x;}
+        if(b->cond && !live[b->cond->id]) {live[b->cond->id]=true; work[n++]=b->cond;}
+    }
+
+    while(n>0)
+    {
+        IRInstr* x=work[--n];
+        for(k=0;k<2;k++)
+            if(x->arg[k] && !live[x->arg[k]->id]) {live[x->arg[k]->id]=true; work[n++]=x->arg[k];}
+    }
+
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRInstr* next;
+        for(IRInstr* x=prog->blocks[i]->first;x;x=next)
+        {
+            next=x->next;
+            if(live[x->id]) continue;
+            if(x->op!=IR_CONST) removed++;
+            prog->Unlink(x);
+        }
+    }
+
+    delete[] live;
+    delete[] work;
+    return removed;
+}
+
+// The value a copy stands for
+IRInstr* IRLeader(IRInstr* i)
+{
+    while(i->op==IR_COPY) i=i->arg[0];
+    return i;
+}
+
+// Constants are compared by value, everything else by identity
+bool IRSameValue(IRInstr* a, IRInstr* b)
+{
+    if(a==b) return true;
+    if(a->op!=IR_CONST || b->op!=IR_CONST || a->type!=b->type) return false;
+    if(a->type==REAL) return memcmp(&a->value.real_val, &b->value.real_val, sizeof(double))==0;
+    return a->value.int_val==b->value.int_val;
+}
+
+unsigned IRValueHash(IRInstr* i)
+{
+    if(i->op!=IR_CONST) return (unsigned)i->id*2654435761u;
+    unsigned h=(unsigned)i->type*97u;
+    if(i->type==REAL)
+    {
+        unsigned w[2];
+        memcpy(w, &i->value.real_val, sizeof(double));
+        return h^w[0]^(w[1]*31u);
+    }
+    return h^((unsigned)i->value.int_val*40503u);
+}
+
+// Operands of an oper for value numbering, in a canonical order for commutative ones
+void IROperKey(IRInstr* i, IRInstr** a, IRInstr** b)
+{
+    *a=IRLeader(i->arg[0]);
+    *b=IRLeader(i->arg[1]);
+    bool commutative=i->oper==PLUS || i->oper==TIMES || i->oper==EQUAL;
+    if(commutative && IRValueHash(*a)>IRValueHash(*b)) {IRInstr* t=*a; *a=*b; *b=t;}
+}
+
+bool IRDominates(IRInstr* a, IRInstr* b)
+{
+    if(a->block==b->block) return a->order<b->order;
+    IRBlock* x=b->block;
+    while(x && x->depth>a->block->depth) x=x->idom;
+    return x==a->block;
+}
+
+// Global value numbering: an oper computing the same operation on the same values
+// as one that dominates it is replaced by that one's value, across blocks and loop
+// iterations (operands are values, not variables, so nothing can change them)
+// An oper assigned to a variable becomes a copy so the variable still gets its value
+// Returns the number of values replaced
+int IRValueNumbering(IRProgram* prog)
+{
+    int i, replaced=0;
+    int size=64;
+    while(size<2*prog->num_instrs) size*=2;
+    IRInstr** table=new IRInstr*[size];
+    for(i=0;i<size;i++) table[i]=0;
+
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        int order=0;
+        for(IRInstr* x=prog->blocks[i]->first;x;x=x->next) x->order=order++;
+    }
+
+    // Dominators come first in creation order, so they are already in the table
+    for(i=0;i<prog->num_blocks;i++)
+        for(IRInstr* x=prog->blocks[i]->first;x;x=x->next)
+        {
+            if(x->op!=IR_OPER) continue;
+            x->arg[0]=IRResolve(x->arg[0]);
+            x->arg[1]=IRResolve(x->arg[1]);
+
+            IRInstr *a, *b, *ca, *cb, *found=0;
+            IROperKey(x, &a, &b);
+            unsigned h=(IRValueHash(a)*31u+IRValueHash(b))*31u+(unsigned)x->oper*7u+(unsigned)x->type;
+            h&=size-1;
+
+            for(IRInstr* c=table[h];c && !found;c=c->hash_next)
+            {
+                if(c->op!=IR_OPER || c->oper!=x->oper || c->type!=x->type) continue;
+                IROperKey(c, &ca, &cb);
+                if(IRSameValue(a, ca) && IRSameValue(b, cb) && IRDominates(c, x)) found=c;
+            }
+
+            if(!found) {x->hash_next=table[h]; table[h]=x; continue;}
+
+            replaced++;
+            if(!x->var) {x->repl=found; continue;}
+            x->op=IR_COPY;
+            x->arg[0]=found;
+            x->arg[1]=0;
+        }
+
+    delete[] table;
+    IRApplyReplacements(prog);
+    return replaced;
+}
+
+// Loop-invariant code motion: an oper in a repeat body or until condition whose
+// operands are all computed before the loop is moved to the end of the block the
+// loop is entered from, so it is computed once instead of on every iteration
+// Only blocks run on every iteration are looked at and operations that may fail
+// stay where they are, so nothing is computed that the loop would not compute.
+// Inner loops go first, so what they hoist can leave the outer loops too.
+// Returns the number of values hoisted
+int IRHoistLoopInvariants(IRProgram* prog)
+{
+    int i, k, n, hoisted=0;
+    IRBlock** chain=new IRBlock*[prog->num_blocks+1];
+
+    // A repeat's region comes after the regions of the loops around it
+    for(i=prog->num_regions-1;i>=0;i--)
+    {
+        IRRegion* r=prog->regions[i];
+        if(r->kind!=IR_REGION_REPEAT) continue;
+        IRBlock* header=r->body[0]->block;
+        IRBlock* exit=r->next->block;
+        IRBlock* preheader=header->pred[0];
+
+        // The blocks of the loop are created between its header and exit, those
+        // dominating the latch run on every iteration
+        n=0;
+        for(IRBlock* b=exit->pred[0];b!=header;b=b->idom) chain[n++]=b;
+        chain[n++]=header;
+
+        while(n>0)
+        {
+            IRInstr* next;
+            for(IRInstr* x=chain[--n]->first;x;x=next)
+            {
+                next=x->next;
+                if(x->op!=IR_OPER || IRHasEffect(x)) continue;
+
+                bool invariant=true;
+                for(k=0;k<2;k++) invariant=invariant && (x->arg[k]->op==IR_CONST || x->arg[k]->block->id<header->id);
+                if(!invariant) continue;
+
+                for(k=0;k<2;k++)
+                    if(x->arg[k]->block->id>=header->id)
+                    {
+                        prog->Unlink(x->arg[k]);
+                        prog->InsertAfter(preheader, preheader->last, x->arg[k]);
+                    }
+
+                // An oper assigned to a variable becomes a copy of the hoisted value
+                IRInstr* v=x;
+                if(x->var)
+                {
+                    v=prog->NewInstr(IR_OPER, x->type, 0, x->line);
+                    v->oper=x->oper;
+                    v->arg[0]=x->arg[0];
+                    v->arg[1]=x->arg[1];
+                    x->op=IR_COPY;
+                    x->arg[0]=v;
+                    x->arg[1]=0;
+                }
+                else prog->Unlink(x);
+                prog->InsertAfter(preheader, preheader->last, v);
+                hoisted++;
+            }
+        }
+    }
+
+    delete[] chain;
+    return hoisted;
+}
+
+// Induction variables of a loop: a basic one is a header phi that a constant is
+// added to on every iteration, a derived one is a new header phi that follows a
+// basic one multiplied by a constant (or squared) and is updated by additions
+struct IRInduction
+{
+    IRInstr* phi;
+    IRInstr* next;              // value after the update, on the path to the latch
+    int base;                   // basic induction variable it follows, -1 if basic
+    bool square;
+    int factor;
+    int step;                   // basic ones: added on every iteration
+};
+
+VariableInfo* IRNewTemp(IRProgram* prog, ExprDataType type, int line);
+void IRCountUses(IRProgram* prog);
+
+// Int arithmetic wraps around as it does at runtime
+int IRWrapAdd(int a, int b) {return (int)((unsigned)a+(unsigned)b);}
+int IRWrapMul(int a, int b) {return (int)((unsigned)a*(unsigned)b);}
+
+bool IRIntConst(IRInstr* i, int* value)
+{
+    if(i->op!=IR_CONST || i->type!=INTEGER) return false;
+    *value=i->value.int_val;
+    return true;
+}
+
+// Creates an int value in block b after *pos and moves *pos to it
+IRInstr* IRInsertIntConst(IRProgram* prog, int value, IRBlock* b, IRInstr** pos, int line)
+{
+    IRInstr* c=prog->NewInstr(IR_CONST, INTEGER, 0, line);
+    c->value=TypedValue(value);
+    prog->InsertAfter(b, *pos, c);
+    return *pos=c;
+}
+
+IRInstr* IRInsertIntOper(IRProgram* prog, TokenType oper, IRInstr* a, IRInstr* c, IRBlock* b, IRInstr** pos, int line)
+{
+    IRInstr* x=prog->NewInstr(IR_OPER, INTEGER, 0, line);
+    x->oper=oper;
+    x->arg[0]=a;
+    x->arg[1]=c;
+    prog->InsertAfter(b, *pos, x);
+    return *pos=x;
+}
+
+// The value of init*factor (or init^2) computed at the end of the preheader
+IRInstr* IRScaledInit(IRProgram* prog, IRInstr* init, bool square, int factor, IRBlock* preheader, int line)
+{
+    int v;
+    IRInstr* pos=preheader->last;
+    if(IRIntConst(init, &v)) return IRInsertIntConst(prog, IRWrapMul(v, square ? v : factor), preheader, &pos, line);
+    IRInstr* c=square ? init : IRInsertIntConst(prog, factor, preheader, &pos, line);
+    return IRInsertIntOper(prog, TIMES, init, c, preheader, &pos, line);
+}
+
+// Returns the derived induction variable following basic one base times factor, or
+// squared, created if the loop does not have it yet
+int IRDeriveInduction(IRProgram* prog, IRInduction*& ivs, int& num_ivs, int& ivs_cap, int base, bool square, int factor,
+                      IRBlock* header, IRBlock* preheader)
+{
+    int i;
+    for(i=0;i<num_ivs;i++)
+        if(ivs[i].base==base && ivs[i].square==square && (square || ivs[i].factor==factor)) return i;
+
+    // (p+c)^2 = p^2 + (2c*p + c*c), 2c*p is derived first
+    int scaled=square ? IRDeriveInduction(prog, ivs, num_ivs, ivs_cap, base, false, IRWrapMul(2, ivs[base].step), header, preheader) : -1;
+
+    IRInstr* p=ivs[base].phi;
+    int step=ivs[base].step, line=p->line;
+
+    IRInstr* pos=0;
+    for(IRInstr* x=header->first;x && x->op==IR_PHI;x=x->next) pos=x;
+    IRInstr* phi=prog->NewInstr(IR_PHI, INTEGER, 0, line);
+    prog->InsertAfter(header, pos, phi);
+    phi->arg[0]=IRScaledInit(prog, p->arg[0], square, factor, preheader, line);
+
+    IRInstr* inc;
+    pos=ivs[base].next;
+    if(square)
+    {
+        IRInstr* c=IRInsertIntConst(prog, IRWrapMul(step, step), pos->block, &pos, line);
+        inc=IRInsertIntOper(prog, PLUS, ivs[scaled].phi, c, pos->block, &pos, line);
+    }
+    else inc=IRInsertIntConst(prog, IRWrapMul(step, factor), pos->block, &pos, line);
+    IRInstr* next=IRInsertIntOper(prog, PLUS, phi, inc, pos->block, &pos, line);
+    phi->arg[1]=next;
+
+    // Both values live in one temporary so the phi needs no copy
+    phi->var=next->var=IRNewTemp(prog, INTEGER, line);
+
+    Reserve(ivs, ivs_cap, num_ivs+1);
+    IRInduction* iv=&ivs[num_ivs];
+    iv->phi=phi;
+    iv->next=next;
+    iv->base=base;
+    iv->square=square;
+    iv->factor=factor;
+    iv->step=0;
+    return num_ivs++;
+}
+
+// Induction-variable strength reduction: in a repeat loop, i * k and i ^ 2 of a
+// counter i stepped by a constant become new variables updated by additions (exact,
+// as int arithmetic wraps around). The exit test i = n then becomes a test of i * k
+// against n * k for an odd k (for which i * k = n * k only if i = n), so a counter
+// used for nothing else dies
+// Returns the number of operations replaced and exit tests rewritten
+int IRReduceInductions(IRProgram* prog)
+{
+    int i, j, k, v, reduced=0;
+    IRInduction* ivs=0;
+    int num_ivs, ivs_cap=0;
+
+    for(i=0;i<prog->num_regions;i++)
+    {
+        IRRegion* r=prog->regions[i];
+        if(r->kind!=IR_REGION_REPEAT) continue;
+        IRBlock* header=r->body[0]->block;
+        IRBlock* exit=r->next->block;
+        IRBlock* latch=exit->pred[0];
+        IRBlock* preheader=header->pred[0];
+
+        num_ivs=0;
+        for(IRInstr* p=header->first;p && p->op==IR_PHI;p=p->next)
+        {
+            IRInstr* n=IRLeader(p->arg[1]);
+            if(p->type!=INTEGER || n->op!=IR_OPER || n->type!=INTEGER) continue;
+            IRInstr* c=0;
+            int step;
+            if((n->oper==PLUS || n->oper==MINUS) && IRLeader(n->arg[0])==p) c=n->arg[1];
+            else if(n->oper==PLUS && IRLeader(n->arg[1])==p) c=n->arg[0];
+            if(!c || !IRIntConst(c, &step)) continue;
+            if(n->oper==MINUS) step=IRWrapMul(step, -1);
+
+            Reserve(ivs, ivs_cap, num_ivs+1);
+            ivs[num_ivs].phi=p;
+            ivs[num_ivs].next=n;
+            ivs[num_ivs].base=-1;
+            ivs[num_ivs].square=false;
+            ivs[num_ivs].factor=1;
+            ivs[num_ivs].step=step;
+            num_ivs++;
+        }
+        int num_basic=num_ivs;
+        if(!num_basic) continue;
+
+        // The blocks of the loop are created between its header and exit
+        for(j=0;j<prog->num_blocks;j++)
+        {
+            IRBlock* b=prog->blocks[j];
+            if(b->id<header->id || b->id>=exit->id) continue;
+            for(IRInstr* x=b->first;x;x=x->next)
+            {
+                if(x->op!=IR_OPER || x->type!=INTEGER || x->repl) continue;
+                int operand=0, factor=0;
+                bool square=false;
+                if(x->oper==TIMES && IRIntConst(x->arg[1], &factor)) operand=0;
+                else if(x->oper==TIMES && IRIntConst(x->arg[0], &factor)) operand=1;
+                else if(x->oper==POWER && IRIntConst(x->arg[1], &v) && v==2) square=true;
+                else continue;
+                if(!square && (factor==0 || factor==1)) continue;
+
+                IRInstr* a=IRLeader(x->arg[operand]);
+                for(k=0;k<num_basic;k++) if(a==ivs[k].phi || a==ivs[k].next) break;
+                if(k==num_basic) continue;
+
+                int d=IRDeriveInduction(prog, ivs, num_ivs, ivs_cap, k, square, factor, header, preheader);
+                IRInstr* value=a==ivs[k].phi ? ivs[d].phi : ivs[d].next;
+                reduced++;
+                if(!x->var) {x->repl=value; continue;}
+                x->op=IR_COPY;
+                x->arg[0]=value;
+                x->arg[1]=0;
+            }
+        }
+        IRApplyReplacements(prog);
+
+        // Exit test on a counter used for nothing else
+        IRInstr* cond=latch->cond;
+        if(!cond || cond->op!=IR_OPER || cond->oper!=EQUAL) continue;
+        IRCountUses(prog);
+        for(k=0;k<num_basic;k++)
+        {
+            IRInstr* p=ivs[k].phi;
+            IRInstr* m=p->arg[1];
+            bool only=p->uses==1 && m->uses==2;
+            for(IRInstr* c=m;c!=ivs[k].next;c=c->arg[0]) only=only && c->arg[0]->uses==1;
+            if(!only) continue;
+            int side=cond->arg[0]==m ? 0 : cond->arg[1]==m ? 1 : -1;
+            if(side<0) continue;
+            IRInstr* limit=cond->arg[1-side];
+            if(limit->type!=INTEGER || (limit->op!=IR_CONST && limit->block->id>=header->id)) continue;
+
+            for(j=num_basic;j<num_ivs;j++) if(ivs[j].base==k && !ivs[j].square && (ivs[j].factor&1)) break;
+            if(j==num_ivs) continue;
+
+            cond->arg[side]=ivs[j].next;
+            cond->arg[1-side]=IRScaledInit(prog, limit, false, ivs[j].factor, preheader, cond->line);
+            reduced++;
+            break;
+        }
+    }
+
+    if(ivs) delete[] ivs;
+    return reduced;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Leaving SSA Form ////////////////////////////////////////////////////////////////
+
+// Every value that is not computed inside the expression of its user is stored in
+// a variable, its home: the variable it was assigned to, or a new temporary. Values
+// with the same home must never be live at the same time (which optimizations can
+// cause, e.g. by reusing the value a variable had before it was reassigned), so
+// such pairs are separated by giving one a temporary until none is left. A phi
+// becomes copies to its home at the end of the predecessors.
+
+// Counts the uses of every value
+void IRCountUses(IRProgram* prog)
+{
+    int i, k;
+    for(i=0;i<prog->num_blocks;i++)
+        for(IRInstr* x=prog->blocks[i]->first;x;x=x->next) {x->uses=0; x->user=0;}
+
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        for(IRInstr* x=b->first;x;x=x->next)
+            for(k=0;k<2;k++)
+                if(x->arg[k]) {x->arg[k]->uses++; x->arg[k]->user=x;}
+        if(b->cond) {b->cond->uses++; b->cond->user=0;}
+    }
+}
+
+// Values that can be computed inside the expression of their only user
+bool IRInlinable(IRInstr* i)
+{
+    if((i->op!=IR_OPER && i->op!=IR_COPY) || i->var || i->uses!=1) return false;
+    if(!i->user) return i->block->cond==i;
+    return i->user->block==i->block && i->user->op!=IR_PHI;
+}
+
+// Inlines a value into its user only if nothing is computed in between but the
+// other operands of the user, in operand order, as evaluating the tree would
+void IRChooseInlined(IRBlock* b, IRInstr** stack)
+{
+    int k, n=0;
+
+    for(IRInstr* x=b->first;x;x=x->next) x->pending=x->inlined=false;
+
+    for(IRInstr* x=b->first;x;x=x->next)
+    {
+        if(x->op==IR_PHI || x->op==IR_CONST) continue;
+
+        IRInstr* want[2];
+        int num_want=0;
+        for(k=0;k<2;k++) if(x->arg[k] && x->arg[k]->pending) want[num_want++]=x->arg[k];
+
+        bool ok=num_want<=n;
+        for(k=0;k<num_want && ok;k++) ok=stack[n-num_want+k]==want[k];
+
+        if(ok) {for(k=0;k<num_want;k++) {want[k]->inlined=true; want[k]->pending=false;} n-=num_want;}
+
+        // Anything still pending is computed before this instruction, so it is stored
+        if(!ok || !IRInlinable(x)) {while(n>0) stack[--n]->pending=false;}
+        if(IRInlinable(x)) {x->pending=true; stack[n++]=x;}
+    }
+
+    if(b->cond && b->cond->pending && stack[n-1]==b->cond) {b->cond->inlined=true; n--;}
+    while(n>0) stack[--n]->pending=false;
+}
+
+bool IRStored(IRInstr* i) {return i->op!=IR_CONST && i->op!=IR_WRITE && !i->inlined;}
+
+VariableInfo* IRNewTemp(IRProgram* prog, ExprDataType type, int line)
+{
+    char name[32];
+    do sprintf(name, "_t%d", prog->num_temps++); while(prog->symbol_table->Find(name));
+    prog->symbol_table->Insert(name, line, type);
+    return prog->symbol_table->Find(name);
+}
+
+inline bool IRTestBit(unsigned* set, int i) {return (set[i>>5]>>(i&31))&1;}
+inline void IRSetBit(unsigned* set, int i) {set[i>>5]|=1u<<(i&31);}
+inline void IRClearBit(unsigned* set, int i) {set[i>>5]&=~(1u<<(i&31));}
+
+// Adds the stored values the expression of i reads
+void IRAddOperands(IRInstr* i, unsigned* live)
+{
+    int k;
+    for(k=0;k<2;k++)
+    {
+        IRInstr* a=i->arg[k];
+        if(!a || a->op==IR_CONST) continue;
+        if(a->inlined) IRAddOperands(a, live);
+        else IRSetBit(live, a->id);
+    }
+}
+
+// Values live at the end of b once its phi copies are done: what the successors
+// need besides their phis, and what the condition reads
+void IRLiveAfterCopies(IRBlock* b, unsigned* live, unsigned* tmp, int words)
+{
+    int k, w;
+    for(w=0;w<words;w++) live[w]=0;
+
+    for(k=0;k<b->num_succs;k++)
+    {
+        IRBlock* s=b->succ[k];
+        for(w=0;w<words;w++) tmp[w]=s->live_in[w];
+        for(IRInstr* x=s->first;x && x->op==IR_PHI;x=x->next) IRClearBit(tmp, x->id);
+        for(w=0;w<words;w++) live[w]|=tmp[w];
+    }
+
+    IRInstr* c=b->cond;
+    if(c && c->op!=IR_CONST)
+    {
+        if(c->inlined) IRAddOperands(c, live);
+        else IRSetBit(live, c->id);
+    }
+}
+
+// Adds the phi arguments b passes to its successors
+void IRAddPhiArgs(IRBlock* b, unsigned* live)
+{
+    int k, j;
+    for(k=0;k<b->num_succs;k++)
+    {
+        IRBlock* s=b->succ[k];
+        for(j=0;j<s->num_preds;j++)
+        {
+            if(s->pred[j]!=b) continue;
+            for(IRInstr* x=s->first;x && x->op==IR_PHI;x=x->next)
+                if(x->arg[j]->op!=IR_CONST) IRSetBit(live, x->arg[j]->id);
+        }
+    }
+}
+
+void IRComputeLiveness(IRProgram* prog, int words)
+{
+    int i, w;
+    unsigned* live=new unsigned[words];
+    unsigned* tmp=new unsigned[words];
+
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        if(b->live_in) delete[] b->live_in;
+        b->live_in=new unsigned[words];
+        for(w=0;w<words;w++) b->live_in[w]=0;
+    }
+
+    bool changed=true;
+    while(changed)
+    {
+        changed=false;
+        for(i=prog->num_blocks-1;i>=0;i--)
+        {
+            IRBlock* b=prog->blocks[i];
+            IRLiveAfterCopies(b, live, tmp, words);
+            IRAddPhiArgs(b, live);
+            for(IRInstr* x=b->last;x && x->op!=IR_PHI;x=x->prev)
+            {
+                if(!IRStored(x) && x->op!=IR_WRITE) continue;
+                if(x->op!=IR_WRITE) IRClearBit(live, x->id);
+                IRAddOperands(x, live);
+            }
+            for(w=0;w<words;w++)
+                if(live[w]!=b->live_in[w]) {b->live_in[w]=live[w]; changed=true;}
+        }
+    }
+
+    delete[] live;
+    delete[] tmp;
+}
+
+// A live value other than except whose home is var
+IRInstr* IRFindLiveHome(IRProgram* prog, unsigned* live, int words, VariableInfo* var, IRInstr* except)
+{
+    int w, k;
+    for(w=0;w<words;w++)
+        for(k=0;k<32 && live[w]>>k;k++)
+            if((live[w]>>k)&1)
+            {
+                IRInstr* x=prog->instrs[w*32+k];
+                if(x!=except && x->var==var) return x;
+            }
+    return 0;
+}
+
+// Inserts a copy of v after pos (at the start of v's block if pos is 0) and makes
+// every other use of v use the copy, which gets a temporary as its home
+void IRSplitValue(IRProgram* prog, IRInstr* v, IRInstr* pos)
+{
+    int i, k;
+    IRInstr* copy=prog->NewInstr(IR_COPY, v->type, 0, v->line);
+    prog->InsertAfter(v->block, pos, copy);
+    copy->arg[0]=v;
+    copy->var=IRNewTemp(prog, v->type, v->line);
+
+    for(i=0;i<prog->num_blocks;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        for(IRInstr* x=b->first;x;x=x->next)
+            if(x!=copy) for(k=0;k<2;k++) if(x->arg[k]==v) x->arg[k]=copy;
+        if(b->cond==v) b->cond=copy;
+    }
+}
+
+// Separates values with the same home live at the same time, returns false if there
+// are none. Renaming leaves the liveness valid, so every such conflict is fixed in one
+// sweep, but a split adds a value and ends it
+bool IRSeparateInterference(IRProgram* prog, int words)
+{
+    int i, k, j;
+    unsigned* live=new unsigned[words];
+    unsigned* tmp=new unsigned[words];
+    bool found=false, split=false;
+
+    for(i=0;i<prog->num_blocks && !split;i++)
+    {
+        IRBlock* b=prog->blocks[i];
+        IRLiveAfterCopies(b, live, tmp, words);
+
+        // The copies for the successors' phis write their homes at the end of b
+        for(k=0;k<b->num_succs && !split;k++)
+        {
+            IRBlock* s=b->succ[k];
+            for(j=0;j<s->num_preds && !split;j++)
+            {
+                if(s->pred[j]!=b) continue;
+                for(IRInstr* phi=s->first;phi && phi->op==IR_PHI && !split;phi=phi->next)
+                {
+                    IRInstr* a=phi->arg[j];
+                    if(a->op!=IR_CONST && a->var==phi->var) continue;
+                    IRInstr* v=IRFindLiveHome(prog, live, words, phi->var, 0);
+                    if(!v) continue;
+
+                    // A phi still needed after its loop has its old value copied first
+                    if(v==phi)
+                    {
+                        IRInstr* pos=phi;
+                        while(pos->next && pos->next->op==IR_PHI) pos=pos->next;
+                        IRSplitValue(prog, phi, pos);
+                        split=true;
+                    }
+                    else phi->var=IRNewTemp(prog, phi->type, phi->line);
+                    found=true;
+                }
+            }
+        }
+        if(split) break;
+        IRAddPhiArgs(b, live);
+
+        IRInstr* x;
+        for(x=b->last;x && x->op!=IR_PHI;x=x->prev)
+        {
+            if(!IRStored(x) && x->op!=IR_WRITE) continue;
+            if(x->op!=IR_WRITE)
+            {
+                IRClearBit(live, x->id);
+                IRInstr* v=IRFindLiveHome(prog, live, words, x->var, x);
+                if(v)
+                {
+                    found=true;
+                    // Reads keep their variable, it is the one named in the prompt
+                    if(x->op!=IR_READ) x->var=IRNewTemp(prog, x->type, x->line);
+                    else if(v->op!=IR_READ) v->var=IRNewTemp(prog, v->type, v->line);
+                    else {IRSplitValue(prog, v, v); split=true; break;}
+                }
+            }
+            IRAddOperands(x, live);
+        }
+        if(split) break;
+
+        for(x=b->first;x && x->op==IR_PHI;x=x->next)
+            if(IRFindLiveHome(prog, live, words, x->var, x)) {x->var=IRNewTemp(prog, x->type, x->line); found=true;}
+    }
+
+    delete[] live;
+    delete[] tmp;
+    return found;
+}
+
+TreeNode* IRIdNode(VariableInfo* var, int line)
+{
+    TreeNode* node=new TreeNode;
+    node->node_kind=ID_NODE;
+    AllocateAndCopy(&node->id, var->name);
+    node->expr_data_type=node->var_type=var->var_type;
+    node->line_num=line;
+    return node;
+}
+
+TreeNode* IRValueTree(IRInstr* i, int line);
+
+// The expression reading value i
+TreeNode* IRExprTree(IRInstr* i, int line)
+{
+    if(i->op==IR_CONST)
+    {
+        TreeNode* node=new TreeNode;
+        node->line_num=line;
+        MakeConst(node, i->value);
+        return node;
+    }
+    if(!i->inlined) return IRIdNode(i->var, line);
+    return IRValueTree(i, line);
+}
+
+// The expression computing value i
+TreeNode* IRValueTree(IRInstr* i, int line)
+{
+    if(i->op!=IR_OPER) return IRExprTree(i->arg[0], line);
+
+    TreeNode* node=new TreeNode;
+    node->node_kind=OPER_NODE;
+    node->oper=i->oper;
+    node->expr_data_type=i->type;
+    node->line_num=line;
+    node->child[0]=IRExprTree(i->arg[0], line);
+    node->child[1]=IRExprTree(i->arg[1], line);
+    return node;
+}
+
+void IRAppendStmt(TreeNode*** tail, TreeNode* node)
+{
+    **tail=node;
+    *tail=&node->sibling;
+}
+
+TreeNode* IRAssignNode(VariableInfo* var, TreeNode* value, int line)
+{
+    TreeNode* node=new TreeNode;
+    node->node_kind=ASSIGN_NODE;
+    AllocateAndCopy(&node->id, var->name);
+    node->var_type=var->var_type;
+    node->line_num=line;
+    node->child[0]=value;
+    return node;
+}
+
+// Emits the copies for the phis of b's successors, ordered so that no copy
+// overwrites a home another one still reads (a cycle goes through a temporary)
+void IREmitPhiCopies(IRProgram* prog, IRBlock* b, TreeNode*** tail, int* num_copies)
+{
+    int k, j, m, c;
+
+    for(k=0;k<b->num_succs;k++)
+    {
+        IRBlock* s=b->succ[k];
+        for(j=0;j<s->num_preds;j++)
+        {
+            if(s->pred[j]!=b) continue;
+
+            int n=0;
+            for(IRInstr* phi=s->first;phi && phi->op==IR_PHI;phi=phi->next) n++;
+            VariableInfo** dest=new VariableInfo*[n+1];
+            VariableInfo** src=new VariableInfo*[n+1];     // 0 for a constant
+            IRInstr** value=new IRInstr*[n+1];
+            int line=0;
+
+            n=0;
+            for(IRInstr* phi=s->first;phi && phi->op==IR_PHI;phi=phi->next)
+            {
+                IRInstr* a=phi->arg[j];
+                if(a->op!=IR_CONST && a->var==phi->var) continue;
+                dest[n]=phi->var;
+                src[n]=a->op==IR_CONST ? 0 : a->var;
+                value[n]=a;
+                line=phi->line;
+                n++;
+            }
+
+            while(n>0)
+            {
+                // A copy whose destination no other copy reads
+                for(m=0;m<n;m++)
+                {
+                    for(c=0;c<n;c++) if(c!=m && src[c]==dest[m]) break;
+                    if(c==n) break;
+                }
+
+                if(m==n)
+                {
+                    VariableInfo* temp=IRNewTemp(prog, src[0]->var_type, line);
+                    IRAppendStmt(tail, IRAssignNode(temp, IRIdNode(src[0], line), line));
+                    (*num_copies)++;
+                    for(c=0;c<n;c++) if(src[c]==src[0] && c!=0) src[c]=temp;
+                    src[0]=temp;
+                    continue;
+                }
+
+                TreeNode* v=src[m] ? IRIdNode(src[m], line) : IRExprTree(value[m], line);
+                IRAppendStmt(tail, IRAssignNode(dest[m], v, line));
+                (*num_copies)++;
+                dest[m]=dest[n-1]; src[m]=src[n-1]; value[m]=value[n-1];
+                n--;
+            }
+
+            delete[] dest;
+            delete[] src;
+            delete[] value;
+        }
+    }
+}
+
+IRBlock* IRLastBlock(IRRegion* r)
+{
+    while(r->next) r=r->next;
+    return r->block;
+}
+
+TreeNode* IREmitRegions(IRProgram* prog, IRRegion* r, int* num_copies)
+{
+    TreeNode* head=0;
+    TreeNode** tail=&head;
+    IRBlock* last=0;
+
+    for(;r;r=r->next)
+    {
+        if(r->kind==IR_REGION_BLOCK)
+        {
+            for(IRInstr* x=r->block->first;x;x=x->next)
+            {
+                if(x->op==IR_PHI || (!IRStored(x) && x->op!=IR_WRITE)) continue;
+
+                TreeNode* node;
+                if(x->op==IR_WRITE)
+                {
+                    node=new TreeNode;
+                    node->node_kind=WRITE_NODE;
+                    node->line_num=x->line;
+                    node->child[0]=IRExprTree(x->arg[0], x->line);
+                }
+                else if(x->op==IR_READ)
+                {
+                    node=new TreeNode;
+                    node->node_kind=READ_NODE;
+                    node->line_num=x->line;
+                    AllocateAndCopy(&node->id, x->var->name);
+                }
+                else node=IRAssignNode(x->var, IRValueTree(x, x->line), x->line);
+                IRAppendStmt(&tail, node);
+            }
+            IREmitPhiCopies(prog, r->block, &tail, num_copies);
+            last=r->block;
+        }
+        else
+        {
+            TreeNode* node=new TreeNode;
+            node->line_num=r->line;
+            if(r->kind==IR_REGION_IF)
+            {
+                node->node_kind=IF_NODE;
+                node->child[0]=IRExprTree(last->cond, r->line);
+                node->child[1]=IREmitRegions(prog, r->body[0], num_copies);
+                node->child[2]=IREmitRegions(prog, r->body[1], num_copies);
+            }
+            else
+            {
+                node->node_kind=REPEAT_NODE;
+                node->child[0]=IREmitRegions(prog, r->body[0], num_copies);
+                node->child[1]=IRExprTree(IRLastBlock(r->body[0])->cond, r->line);
+            }
+            IRAppendStmt(&tail, node);
+        }
+    }
+    return head;
+}
+
+// Translates the IR back into a tree, returns it
+TreeNode* LeaveSSA(IRProgram* prog, int* num_copies)
+{
+    int i;
+    IRInstr** stack=0;
+    int stack_cap=0;
+
+    while(true)
+    {
+        IRCountUses(prog);
+        Reserve(stack, stack_cap, prog->num_instrs+1);
+        for(i=0;i<prog->num_blocks;i++) IRChooseInlined(prog->blocks[i], stack);
+
+        // A stored value without a variable gets a temporary, kept from then on
+        for(i=0;i<prog->num_blocks;i++)
+            for(IRInstr* x=prog->blocks[i]->first;x;x=x->next)
+                if(IRStored(x) && !x->var) x->var=IRNewTemp(prog, x->type, x->line);
+
+        int words=(prog->num_instrs+31)/32;
+        IRComputeLiveness(prog, words);
+        if(!IRSeparateInterference(prog, words)) break;
+    }
+    if(stack) delete[] stack;
+
+    *num_copies=0;
+    return IREmitRegions(prog, prog->body, num_copies);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Pass Manager ////////////////////////////////////////////////////////////////////
+
+// The optimizer is a list of passes run in order, over the tree or, for SSA passes,
+// over the IR. The IR is built from the tree before the first SSA pass and the tree
+// is rebuilt from it before the next tree pass (or at the end). Each pass reports
+// one statistic.
+// Some passes trade operations for statements, which only pays off when the program
+// runs as machine code: they are skipped unless it does.
+// -O<level> runs the passes of that level and below, --enable-pass and --disable-pass
+// override it for one pass. At level 2 consecutive passes of one kind marked
+// fixed_point form a group that runs again while any of them changed something,
+// since one pass can give the others more to do (a folded branch condition leaves
+// dead writes, a propagated constant makes two operations equal)
+#define MAX_OPT_ROUNDS 4
+
+struct OptContext
+{
+    TreeNode* syntax_tree;      // 0 while the program is in SSA form
+    SymbolTable* symbol_table;
+    IRProgram* ir;
+    bool native;                // the program is run or translated as machine code
+    int unroll_factor;          // 1: loops are not unrolled
+};
+
+enum PassKind {PASS_TREE, PASS_SSA};
+
+struct OptPass
+{
+    const char* name;
+    const char* stat;           // what the number returned by run counts
+    PassKind kind;
+    bool native;                // only run if the program becomes machine code
+    int level;                  // lowest -O level that runs the pass
+    bool fixed_point;           // repeated with its neighbours at level 2
+    int (*run)(OptContext* ctx);
+};
+
+int RunConstantFolding(OptContext* ctx) {return ctx->syntax_tree ? FoldConstants(ctx->syntax_tree) : 0;}
+int RunAlgebraicSimplification(OptContext* ctx)
+{
+    return ctx->syntax_tree ? SimplifyAlgebra(ctx->syntax_tree, ctx->symbol_table, IsStaticallyTyped(ctx->syntax_tree, ctx->symbol_table)) : 0;
+}
+int RunRangeAnalysis(OptContext* ctx) {return ctx->syntax_tree ? AnalyzeRanges(ctx->syntax_tree, ctx->symbol_table) : 0;}
+int RunDeadBranchElimination(OptContext* ctx) {return EliminateDeadBranches(&ctx->syntax_tree);}
+int RunDeadWriteElimination(OptContext* ctx) {return EliminateDeadWrites(&ctx->syntax_tree, ctx->symbol_table);}
+int RunDeadStoreElimination(OptContext* ctx) {return EliminateDeadStores(&ctx->syntax_tree, ctx->symbol_table);}
+int RunVariablePruning(OptContext* ctx) {return PruneVariables(ctx->syntax_tree, ctx->symbol_table);}
+int RunLoopUnrolling(OptContext* ctx)
+{
+    return ctx->unroll_factor>1 ? UnrollLoops(&ctx->syntax_tree, ctx->symbol_table, ctx->unroll_factor) : 0;
+}
+int RunSSADeadCode(OptContext* ctx) {return IRDeadCodeElimination(ctx->ir);}
+int RunConstantPropagation(OptContext* ctx) {return IRPropagateConstants(ctx->ir);}
+int RunValueNumbering(OptContext* ctx) {return IRValueNumbering(ctx->ir);}
+int RunLoopInvariantCodeMotion(OptContext* ctx) {return IRHoistLoopInvariants(ctx->ir);}
+int RunStrengthReduction(OptContext* ctx) {return IRReduceInductions(ctx->ir);}
+
+const OptPass opt_passes[]=
+{
+    {"ConstantFolding", "NodesEliminated", PASS_TREE, false, 1, true, RunConstantFolding},
+    {"AlgebraicSimplification", "RulesApplied", PASS_TREE, false, 1, true, RunAlgebraicSimplification},
+    {"RangeAnalysis", "ChecksRemoved", PASS_TREE, false, 1, true, RunRangeAnalysis},
+    {"DeadBranchElimination", "NodesEliminated", PASS_TREE, false, 1, true, RunDeadBranchElimination},
+    {"DeadWriteElimination", "NodesEliminated", PASS_TREE, false, 1, true, RunDeadWriteElimination},
+    {"DeadStoreElimination", "NodesEliminated", PASS_TREE, false, 1, true, RunDeadStoreElimination},
+    {"LoopUnrolling", "LoopsUnrolled", PASS_TREE, false, 2, false, RunLoopUnrolling},
+    {"ConstantPropagation", "ValuesFolded", PASS_SSA, false, 2, true, RunConstantPropagation},
+    {"GlobalValueNumbering", "ValuesEliminated", PASS_SSA, false, 2, true, RunValueNumbering},
+    {"LoopInvariantCodeMotion", "ValuesHoisted", PASS_SSA, false, 2, true, RunLoopInvariantCodeMotion},
+    {"StrengthReduction", "OperationsReduced", PASS_SSA, true, 2, false, RunStrengthReduction},
+    {"SSADeadCodeElimination", "ValuesEliminated", PASS_SSA, false, 2, false, RunSSADeadCode},
+    {"DeadBranchElimination", "NodesEliminated", PASS_TREE, false, 2, false, RunDeadBranchElimination},
+    {"VariablePruning", "VariablesRemoved", PASS_TREE, false, 1, false, RunVariablePruning},
+    {"RangeAnalysis", "ChecksRemoved", PASS_TREE, false, 2, false, RunRangeAnalysis},
+};
+
+const int NUM_OPT_PASSES=sizeof(opt_passes)/sizeof(opt_passes[0]);
+
+void EnterSSA(OptContext* ctx)
+{
+    IRProgram* ir=BuildIR(ctx->syntax_tree, ctx->symbol_table);
+    if(!ir) return;
+    if(ctx->syntax_tree) DestroyTree(ctx->syntax_tree);
+    ctx->syntax_tree=0;
+    ctx->ir=ir;
+    int phis=ir->NumLinkedInstrs(IR_PHI);
+    int values=phis+ir->NumLinkedInstrs(IR_OPER)+ir->NumLinkedInstrs(IR_COPY)+ir->NumLinkedInstrs(IR_READ);
+    printf("[Pass=SSAConstruction][Blocks=%d][Values=%d][Phis=%d]\n", ir->num_blocks, values, phis);
+}
+
+void ExitSSA(OptContext* ctx, bool print_ir)
+{
+    if(print_ir)
+    {
+        printf("SSA Form:\n");
+        PrintIR(ctx->ir);
+    }
+    int temps=ctx->ir->num_temps, copies;
+    ctx->syntax_tree=LeaveSSA(ctx->ir, &copies);
+    printf("[Pass=OutOfSSA][Temporaries=%d][Copies=%d]\n", ctx->ir->num_temps-temps, copies);
+    delete ctx->ir;
+    ctx->ir=0;
+}
+
+// The size of the program: tree nodes, or IR instructions in SSA form
+int OptProgramSize(OptContext* ctx)
+{
+    int i, n=0;
+    if(ctx->ir)
+    {
+        for(i=0;i<ctx->ir->num_blocks;i++)
+            for(IRInstr* x=ctx->ir->blocks[i]->first;x;x=x->next) n++;
+        return n;
+    }
+    for(TreeNode* node=ctx->syntax_tree;node;node=node->sibling) n+=CountNodes(node);
+    return n;
+}
+
+double ElapsedMs(clock_t start) {return 1000.0*(double)(clock()-start)/CLOCKS_PER_SEC;}
+
+// True if the level runs the pass, unless a switch names it
+bool PassEnabled(const OptPass* pass, CompilerOptions* options, bool* switched_off)
+{
+    int i;
+    bool enabled=pass->level<=options->opt_level;
+    *switched_off=false;
+    for(i=0;i<options->num_pass_switches;i++)
+        if(Equals(options->pass_switch[i], pass->name)) {*switched_off=enabled && !options->pass_enabled[i]; enabled=options->pass_enabled[i];}
+    return enabled;
+}
+
+// Runs one pass, returns what it changed (0 if it did not run)
+int RunPass(OptContext* ctx, const OptPass* pass, CompilerOptions* options, int round, bool* ssa_failed)
+{
+    bool switched_off;
+    if(!PassEnabled(pass, options, &switched_off))
+    {
+        if(switched_off && round==1) printf("[Pass=%s][Skipped=Disabled]\n", pass->name);
+        return 0;
+    }
+    if(pass->native && !ctx->native)
+    {
+        if(round==1) printf("[Pass=%s][Skipped=Interpreted]\n", pass->name);
+        return 0;
+    }
+    if(pass->kind==PASS_SSA && !ctx->ir)
+    {
+        if(!*ssa_failed && IsStaticallyTyped(ctx->syntax_tree, ctx->symbol_table)) EnterSSA(ctx);
+        if(!ctx->ir)
+        {
+            if(!*ssa_failed) printf("[Pass=%s][Skipped=NotStaticallyTyped]\n", pass->name);
+            *ssa_failed=true;
+            return 0;
+        }
+    }
+    if(pass->kind==PASS_TREE && ctx->ir) ExitSSA(ctx, options->print_ir);
+
+    clock_t start=clock();
+    int changed=pass->run(ctx);
+    double ms=ElapsedMs(start);
+
+    printf("[Pass=%s]", pass->name);
+    if(round>1) printf("[Round=%d]", round);
+    printf("[%s=%d]", pass->stat, changed);
+    if(options->opt_report) printf("[Time=%.3fms][Size=%d]", ms, OptProgramSize(ctx));
+    printf("\n");
+    return changed;
+}
+
+// Runs the passes of options->opt_level on *syntax_tree, which it may replace
+void RunOptimizer(TreeNode** syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    int i, j, round;
+    OptContext ctx;
+    ctx.syntax_tree=*syntax_tree;
+    ctx.symbol_table=symbol_table;
+    ctx.ir=0;
+    ctx.unroll_factor=options->unroll_factor;
+    ctx.native=options->engine==ENGINE_JIT || options->engine==ENGINE_TIERED || options->engine==ENGINE_TRACE ||
+               options->emit==EMIT_C || options->emit==EMIT_ELF;
+    bool ssa_failed=false;
+    clock_t start=clock();
+    int size=OptProgramSize(&ctx);
+
+    for(i=0;i<NUM_OPT_PASSES;i=j)
+    {
+        bool repeat=options->opt_level>=2 && opt_passes[i].fixed_point;
+        for(j=i+1;repeat && j<NUM_OPT_PASSES && opt_passes[j].fixed_point && opt_passes[j].kind==opt_passes[i].kind;j++);
+
+        for(round=1;;round++)
+        {
+            int changed=0;
+            int k;
+            for(k=i;k<j;k++) changed+=RunPass(&ctx, &opt_passes[k], options, round, &ssa_failed);
+            if(!repeat || changed==0 || round==MAX_OPT_ROUNDS) break;
+        }
+    }
+    if(ctx.ir) ExitSSA(&ctx, options->print_ir);
+
+    if(options->opt_report)
+        printf("[Optimizer][Level=%d][Time=%.3fms][Size=%d->%d]\n", options->opt_level, ElapsedMs(start), size, OptProgramSize(&ctx));
+    *syntax_tree=ctx.syntax_tree;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Partial Evaluation //////////////////////////////////////////////////////////////
+
+// Specializes the program for known values of its first read statements (see
+// --specialize=FILE). Everything that only depends on those values runs at compile
+// time, what is left is the residual program, which reads the remaining input.
+// The store is tracked per variable: a known value, or VOID if the value is only
+// known at runtime. A known value is not stored by the residual program until a
+// variable has to hold it at runtime:
+// - before a loop that may assign it, whose trip count depends on runtime values
+// - at the end of a branch whose condition depends on runtime values, when the other
+//   branch leaves another value in it
+// Reads are known while they run in a fixed order: the first read in a branch or loop
+// that depends on runtime values, or after the known values ran out, ends them.
+// A loop whose condition becomes known is unrolled as it runs, as long as its residual
+// statements fit in MAX_UNROLL_NODES, otherwise it stays a loop. Operations that fail
+// at runtime are left in place (see CanFold()), so the error happens at the same point.
+// The residual program does not prompt for the known inputs.
+
+// Statements (and loop iterations) run by the specializer, bounds loops that never end
+#define MAX_SPECIALIZE_STEPS 1000000
+
+struct SpecState
+{
+    SymbolTable* symbol_table;
+    int num_vars;
+    VariableInfo** vars;    // by memloc
+    FILE* inputs;           // known input values
+    bool inputs_open;       // the next read may take a known value
+    int inputs_used;
+    int dynamic;            // depth of branches and loops that depend on runtime values
+    int steps;              // statements the specializer may still run
+    TreeNode** tail;        // where the next residual statement is linked
+};
+
+// What UnrollKnownLoop() restores when the loop has to stay a loop
+struct SpecSnapshot
+{
+    TypedValue* env;
+    long pos;
+    bool inputs_open;
+    int inputs_used;
+    TreeNode** tail;
+};
+
+TreeNode* ValueNode(TypedValue v, int line)
+{
+    TreeNode* node=new TreeNode;
+    node->line_num=line;
+    MakeConst(node, v);
+    return node;
+}
+
+// A copy of node alone with the given children
+TreeNode* ResidualStmt(TreeNode* node, TreeNode* c0, TreeNode* c1, TreeNode* c2)
+{
+    TreeNode* copy=new TreeNode;
+    *copy=*node;
+    if(node->node_kind==READ_NODE || node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+        AllocateAndCopy(&copy->id, node->id);
+    copy->child[0]=c0;
+    copy->child[1]=c1;
+    copy->child[2]=c2;
+    copy->sibling=0;
+    return copy;
+}
+
+void AppendResidual(SpecState* ss, TreeNode* node)
+{
+    *ss->tail=node;
+    ss->tail=&node->sibling;
+}
+
+// Stores the known value of variable i in the residual program, from then on it is
+// only known at runtime
+void Materialize(SpecState* ss, int i, TypedValue* env, int line)
+{
+    AppendResidual(ss, IRAssignNode(ss->vars[i], ValueNode(env[i], line), line));
+    env[i]=TypedValue();
+}
+
+void CopyEnv(TypedValue* dest, TypedValue* src, int n)
+{
+    int i;
+    for(i=0;i<n;i++) dest[i]=src[i];
+}
+
+// Returns 0 and sets *value if the expression is known, otherwise its residual
+TreeNode* SpecializeExpr(SpecState* ss, TreeNode* node, TypedValue* env, TypedValue* value)
+{
+    if(node->node_kind==NUM_NODE) {*value=ConstValue(node); return 0;}
+
+    if(node->node_kind==ID_NODE)
+    {
+        VariableInfo* var=ss->symbol_table->Find(node->id);
+        if(var && env[var->memloc].type!=VOID) {*value=env[var->memloc]; return 0;}
+        return CopyTree(node);
+    }
+
+    TypedValue a, b;
+    TreeNode* ra=SpecializeExpr(ss, node->child[0], env, &a);
+    TreeNode* rb=SpecializeExpr(ss, node->child[1], env, &b);
+    if(!ra && !rb && CanFold(node->oper, a, b)) {*value=EvaluateOper(node->oper, a, b); return 0;}
+
+    if(!ra) ra=ValueNode(a, node->line_num);
+    if(!rb) rb=ValueNode(b, node->line_num);
+    return NewOperNode(node->oper, node->expr_data_type, ra, rb, node->line_num);
+}
+
+// The residual of an expression, known or not
+TreeNode* ResidualExpr(SpecState* ss, TreeNode* node, TypedValue* env)
+{
+    TypedValue v;
+    TreeNode* r=SpecializeExpr(ss, node, env, &v);
+    return r ? r : ValueNode(v, node->line_num);
+}
+
+void SpecializeStmtSeq(SpecState* ss, TreeNode* node, TypedValue* env);
+
+// Runs a statement list whose execution depends on runtime values into *list,
+// returns where the next statement of that list is linked
+TreeNode** SpecializeBranch(SpecState* ss, TreeNode* node, TypedValue* env, TreeNode** list)
+{
+    TreeNode** saved=ss->tail;
+    *list=0;
+    ss->tail=list;
+    ss->dynamic++;
+    SpecializeStmtSeq(ss, node, env);
+    ss->dynamic--;
+    TreeNode** tail=ss->tail;
+    ss->tail=saved;
+    return tail;
+}
+
+void SpecializeIf(SpecState* ss, TreeNode* node, TypedValue* env)
+{
+    int i;
+    TypedValue v;
+    TreeNode* cond=SpecializeExpr(ss, node->child[0], env, &v);
+    if(!cond)
+    {
+        SpecializeStmtSeq(ss, v.bool_val ? node->child[1] : node->child[2], env);
+        return;
+    }
+
+    TypedValue* else_env=new TypedValue[ss->num_vars+1];
+    CopyEnv(else_env, env, ss->num_vars);
+    TreeNode* then_part;
+    TreeNode* else_part;
+    TreeNode** then_tail=SpecializeBranch(ss, node->child[1], env, &then_part);
+    TreeNode** else_tail=SpecializeBranch(ss, node->child[2], else_env, &else_part);
+
+    // A value stays known if both branches leave it, otherwise each branch stores its own
+    TreeNode** saved=ss->tail;
+    for(i=0;i<ss->num_vars;i++)
+    {
+        if(env[i].type!=VOID && else_env[i].type!=VOID && IRSameConst(env[i], else_env[i])) continue;
+        if(env[i].type!=VOID) {ss->tail=then_tail; Materialize(ss, i, env, node->line_num); then_tail=ss->tail;}
+        if(else_env[i].type!=VOID) {ss->tail=else_tail; Materialize(ss, i, else_env, node->line_num); else_tail=ss->tail;}
+        env[i]=TypedValue();
+    }
+    ss->tail=saved;
+    delete[] else_env;
+
+    AppendResidual(ss, ResidualStmt(node, cond, then_part, else_part));
+}
+
+void SaveSpecState(SpecState* ss, TypedValue* env, SpecSnapshot* snap)
+{
+    snap->env=new TypedValue[ss->num_vars+1];
+    CopyEnv(snap->env, env, ss->num_vars);
+    snap->pos=ftell(ss->inputs);
+    snap->inputs_open=ss->inputs_open;
+    snap->inputs_used=ss->inputs_used;
+    snap->tail=ss->tail;
+}
+
+void RestoreSpecState(SpecState* ss, TypedValue* env, SpecSnapshot* snap)
+{
+    CopyEnv(env, snap->env, ss->num_vars);
+    fseek(ss->inputs, snap->pos, SEEK_SET);
+    ss->inputs_open=snap->inputs_open;
+    ss->inputs_used=snap->inputs_used;
+    if(*snap->tail) DestroyTree(*snap->tail);
+    *snap->tail=0;
+    ss->tail=snap->tail;
+}
+
+// Runs the loop at compile time while its condition is known, returns false (with the
+// state restored) if it has to stay a loop
+bool UnrollKnownLoop(SpecState* ss, TreeNode* node, TypedValue* env)
+{
+    SpecSnapshot snap;
+    SaveSpecState(ss, env, &snap);
+
+    bool done=false;
+    while(ss->steps-->0)
+    {
+        SpecializeStmtSeq(ss, node->child[0], env);
+
+        TypedValue v;
+        TreeNode* cond=SpecializeExpr(ss, node->child[1], env, &v);
+        if(cond) {DestroyTree(cond); break;}
+        if(CountListNodes(*snap.tail)>MAX_UNROLL_NODES) break;
+        if(v.bool_val) {done=true; break;}
+    }
+
+    if(!done) RestoreSpecState(ss, env, &snap);
+    delete[] snap.env;
+    return done;
+}
+
+void SpecializeRepeat(SpecState* ss, TreeNode* node, TypedValue* env)
+{
+    int i;
+    if(UnrollKnownLoop(ss, node, env)) return;
+
+    // Values the loop may change are stored before it and at the end of every iteration
+    bool* assigned=new bool[ss->num_vars+1];
+    for(i=0;i<ss->num_vars;i++) assigned[i]=false;
+    IRMarkAssigned(node->child[0], ss->symbol_table, assigned);
+    for(i=0;i<ss->num_vars;i++)
+        if(assigned[i] && env[i].type!=VOID) Materialize(ss, i, env, node->line_num);
+
+    TreeNode* body;
+    TreeNode** body_tail=SpecializeBranch(ss, node->child[0], env, &body);
+    TreeNode* cond=ResidualExpr(ss, node->child[1], env);
+
+    TreeNode** saved=ss->tail;
+    ss->tail=body_tail;
+    for(i=0;i<ss->num_vars;i++)
+        if(assigned[i] && env[i].type!=VOID) Materialize(ss, i, env, node->line_num);
+    ss->tail=saved;
+    delete[] assigned;
+
+    AppendResidual(ss, ResidualStmt(node, body, cond, 0));
+}
+
+// Takes the next known input for var, mirroring the reads of RunProgram()
+bool ReadKnownInput(SpecState* ss, VariableInfo* var, TypedValue* v)
+{
+    if(!ss->inputs_open || ss->dynamic>0) return false;
+
+    if(var->var_type==REAL)
+    {
+        double input_val;
+        if(fscanf(ss->inputs, "%lf", &input_val)==1) {*v=TypedValue(input_val); ss->inputs_used++; return true;}
+    }
+    else
+    {
+        int input_val;
+        if(fscanf(ss->inputs, "%d", &input_val)==1)
+        {
+            *v=var->var_type==BOOLEAN ? TypedValue(input_val, true) : TypedValue(input_val);
+            ss->inputs_used++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SpecializeStmtSeq(SpecState* ss, TreeNode* node, TypedValue* env)
+{
+    for(;node;node=node->sibling)
+    {
+        ss->steps--;
+        if(node->node_kind==IF_NODE) {SpecializeIf(ss, node, env); continue;}
+        if(node->node_kind==REPEAT_NODE) {SpecializeRepeat(ss, node, env); continue;}
+
+        if(node->node_kind==WRITE_NODE)
+        {
+            AppendResidual(ss, ResidualStmt(node, ResidualExpr(ss, node->child[0], env), 0, 0));
+            continue;
+        }
+
+        VariableInfo* var=ss->symbol_table->Find(node->id);
+        TypedValue v;
+        TreeNode* r=0;
+        if(!var)
+        {
+            // A variable never declared has no value to track, a read of it stays in
+            // the residual program and consumes input at runtime
+            if(node->node_kind==READ_NODE) ss->inputs_open=false;
+            else if(node->child[0]) r=ResidualExpr(ss, node->child[0], env);
+            AppendResidual(ss, ResidualStmt(node, r, 0, 0));
+            continue;
+        }
+        if(node->node_kind==READ_NODE)
+        {
+            if(ReadKnownInput(ss, var, &v)) {env[var->memloc]=v; continue;}
+            // Later reads take their values in an order only known at runtime
+            ss->inputs_open=false;
+        }
+        else if(node->child[0])
+        {
+            r=SpecializeExpr(ss, node->child[0], env, &v);
+            // A declaration converts an int to real, other conversions are left to runtime
+            if(!r && node->node_kind==DECL_NODE && v.type!=var->var_type)
+            {
+                if(var->var_type==REAL && v.type==INTEGER) v=TypedValue((double)v.int_val);
+                else r=ValueNode(v, node->line_num);
+            }
+        }
+        else if(var->var_type==REAL) v=TypedValue(0.0);
+        else if(var->var_type==BOOLEAN) v=TypedValue(0, true);
+        else v=TypedValue(0);
+
+        if(node->node_kind!=READ_NODE && !r) {env[var->memloc]=v; continue;}
+        AppendResidual(ss, ResidualStmt(node, r, 0, 0));
+        env[var->memloc]=TypedValue();
+    }
+}
+
+// Replaces the program by its residual for the known inputs
+// Returns the number of known inputs used
+int Specialize(TreeNode** syntax_tree, SymbolTable* symbol_table, FILE* inputs)
+{
+    int i;
+    SpecState ss;
+    ss.symbol_table=symbol_table;
+    ss.num_vars=symbol_table->num_vars;
+    ss.vars=new VariableInfo*[ss.num_vars+1];
+    for(i=0;i<SYMBOL_HASH_SIZE;i++)
+    {
+        VariableInfo* var;
+        for(var=symbol_table->var_info[i];var;var=var->next_var) ss.vars[var->memloc]=var;
+    }
+    ss.inputs=inputs;
+    ss.inputs_open=true;
+    ss.inputs_used=0;
+    ss.dynamic=0;
+    ss.steps=MAX_SPECIALIZE_STEPS;
+
+    // Every variable starts unassigned, which the residual program knows as well
+    TypedValue* env=new TypedValue[ss.num_vars+1];
+    TreeNode* residual=0;
+    ss.tail=&residual;
+    SpecializeStmtSeq(&ss, *syntax_tree, env);
+
+    if(*syntax_tree) DestroyTree(*syntax_tree);
+    *syntax_tree=residual;
+    delete[] env;
+    delete[] ss.vars;
+    return ss.inputs_used;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Virtual Machine /////////////////////////////////////////////////////////////////
+
+// Runtime support shared by the compiled engines, output matches RunProgram() exactly
+
+// Set while benchmarking, the program's output is discarded
+bool discard_output=false;
+
+void WriteInt(int v) {if(!discard_output) printf("Val: %d\n", v);}
+void WriteReal(double v) {if(!discard_output) printf("Val: %lf\n", v);}
+void WriteBool(int v) {if(!discard_output) printf("Val: %s\n", v ? "true" : "false");}
+
+void ReadValue(const char* name, ExprDataType type, VMValue* dest)
+{
+    printf("Enter %s (%s): ", name, ExprDataTypeStr[type]);
+    if(type==REAL) {double input_val=0.0; scanf("%lf", &input_val); dest->r=input_val;}
+    else {int input_val=0; scanf("%d", &input_val); dest->i=input_val;}
+}
+
+void DivisionByZero()
+{
+    printf("ERROR Division by zero\n");
+    throw 0;
+}
+
+// Number of operand words following each stack machine opcode
+int OpCodeOperands(int op)
+{
+    return (op==OP_PUSHI || op==OP_PUSHR || op==OP_LOAD || op==OP_STORE || op==OP_JMP || op==OP_JF ||
+            op==OP_READI || op==OP_READR || op==OP_READB) ? 1 : 0;
+}
+
+// Instruction semantics of the stack machine, shared by both dispatch loops
+// OPERAND fetches the operand of the instruction, NEXT continues with the next
+// instruction, JUMP(t) with instruction t and HALT stops the program
+#define STACK_BINARY(member, expr) {sp--; VMValue& a=sp[-1]; VMValue& b=sp[0]; a.member=(expr); NEXT}
+#define STACK_COMPARE(member, cmp) {sp--; sp[-1].i=(sp[-1].member cmp sp[0].member); NEXT}
+#define STACK_HANDLERS(HANDLER) \
+    HANDLER(OP_PUSHI, sp->i=OPERAND; sp++; NEXT) \
+    HANDLER(OP_PUSHR, sp->r=reals[OPERAND]; sp++; NEXT) \
+    HANDLER(OP_LOAD, *sp++=variables[OPERAND]; NEXT) \
+    HANDLER(OP_STORE, variables[OPERAND]=*--sp; NEXT) \
+    HANDLER(OP_I2R, sp[-1].r=(double)sp[-1].i; NEXT) \
+    HANDLER(OP_R2I, sp[-1].i=(int)sp[-1].r; NEXT) \
+    HANDLER(OP_ADDI, STACK_BINARY(i, a.i+b.i)) \
+    HANDLER(OP_ADDR, STACK_BINARY(r, a.r+b.r)) \
+    HANDLER(OP_SUBI, STACK_BINARY(i, a.i-b.i)) \
+    HANDLER(OP_SUBR, STACK_BINARY(r, a.r-b.r)) \
+    HANDLER(OP_MULI, STACK_BINARY(i, a.i*b.i)) \
+    HANDLER(OP_MULR, STACK_BINARY(r, a.r*b.r)) \
+    HANDLER(OP_DIVI, if(sp[-1].i==0) DivisionByZero(); STACK_BINARY(i, a.i/b.i)) \
+    HANDLER(OP_DIVR, if(sp[-1].r==0.0) DivisionByZero(); STACK_BINARY(r, a.r/b.r)) \
+    HANDLER(OP_POWI, STACK_BINARY(i, Power(a.i, b.i))) \
+    HANDLER(OP_POWR, STACK_BINARY(r, RealPower(a.r, b.i))) \
+    HANDLER(OP_ANDI, STACK_BINARY(i, a.i*a.i-b.i*b.i)) \
+    HANDLER(OP_ANDR, STACK_BINARY(r, a.r*a.r-b.r*b.r)) \
+    HANDLER(OP_EQI, STACK_COMPARE(i, ==)) \
+    HANDLER(OP_EQR, STACK_COMPARE(r, ==)) \
+    HANDLER(OP_LTI, STACK_COMPARE(i, <)) \
+    HANDLER(OP_LTR, STACK_COMPARE(r, <)) \
+    HANDLER(OP_GTI, STACK_COMPARE(i, >)) \
+    HANDLER(OP_GTR, STACK_COMPARE(r, >)) \
+    HANDLER(OP_GEI, STACK_COMPARE(i, >=)) \
+    HANDLER(OP_GER, STACK_COMPARE(r, >=)) \
+    HANDLER(OP_LEI, STACK_COMPARE(i, <=)) \
+    HANDLER(OP_LER, STACK_COMPARE(r, <=)) \
+    HANDLER(OP_JMP, {int target=OPERAND; JUMP(target)}) \
+    HANDLER(OP_JF, {int target=OPERAND; if(!(--sp)->i) JUMP(target) NEXT}) \
+    HANDLER(OP_WRITEI, WriteInt((--sp)->i); NEXT) \
+    HANDLER(OP_WRITER, WriteReal((--sp)->r); NEXT) \
+    HANDLER(OP_WRITEB, WriteBool((--sp)->i); NEXT) \
+    HANDLER(OP_READI, {int v=OPERAND; ReadValue(prog->vars.names[v], INTEGER, &variables[v]); NEXT}) \
+    HANDLER(OP_READR, {int v=OPERAND; ReadValue(prog->vars.names[v], REAL, &variables[v]); NEXT}) \
+    HANDLER(OP_READB, {int v=OPERAND; ReadValue(prog->vars.names[v], BOOLEAN, &variables[v]); NEXT}) \
+    HANDLER(OP_HALT, HALT)
+
+// Switch dispatch: one central switch decodes every instruction
+long long RunBytecodeSwitch(BytecodeProgram* prog, VMValue* variables, VMValue* stack)
+{
+    VMValue* sp=stack;      // points above the top of the stack
+    int* code=prog->code;
+    double* reals=prog->reals;
+    int pc=0;
+    long long count=0;
+
+    #define OPERAND code[pc++]
+    #define NEXT break;
+    #define JUMP(t) {pc=(t); break;}
+    #define HALT return count;
+    #define HANDLER(op, body) case op: {body}
+
+    while(true)
+    {
+        count++;
+        switch(code[pc++])
+        {
+            STACK_HANDLERS(HANDLER)
+            default: throw 0;
+        }
+    }
+
+    #undef OPERAND
+    #undef NEXT
+    #undef JUMP
+    #undef HALT
+    #undef HANDLER
+}
+
+#ifdef TINY_THREADED_DISPATCH
+
+// A predecoded stack machine instruction: the address of its handler and its operand
+// (jump targets are instruction indices)
+struct StackThreadedInstr
+{
+    const void* handler;
+    int operand;
+};
+
+// Direct threaded dispatch: the code is first predecoded into handler addresses, then
+// every handler jumps straight to the handler of the next instruction, so each one
+// ends with its own indirect branch instead of sharing the switch's
+long long RunBytecodeThreaded(BytecodeProgram* prog, VMValue* variables, VMValue* stack)
+{
+    const void* handlers[OP_HALT+1];
+    #define HANDLER(op, body) handlers[op]=&&L_##op;
+    STACK_HANDLERS(HANDLER)
+    #undef HANDLER
+
+    // Predecode, mapping word indices to instruction indices for jump targets
+    int pc, n=0;
+    int* instr_index=new int[prog->code_size+1];
+    for(pc=0;pc<prog->code_size;pc+=1+OpCodeOperands(prog->code[pc])) instr_index[pc]=n++;
+
+    StackThreadedInstr* code=new StackThreadedInstr[n];
+    for(pc=0, n=0;pc<prog->code_size;pc+=1+OpCodeOperands(prog->code[pc]), n++)
+    {
+        int op=prog->code[pc];
+        code[n].handler=handlers[op];
+        code[n].operand=OpCodeOperands(op) ? prog->code[pc+1] : 0;
+        if(op==OP_JMP || op==OP_JF) code[n].operand=instr_index[code[n].operand];
+    }
+    delete[] instr_index;
+
+    VMValue* sp=stack;
+    double* reals=prog->reals;
+    StackThreadedInstr* ip=code;
+    long long count=1;
+
+    #define OPERAND ip->operand
+    #define NEXT {ip++; count++; goto *ip->handler;}
+    #define JUMP(t) {ip=code+(t); count++; goto *ip->handler;}
+    #define HALT {delete[] code; return count;}
+    #define HANDLER(op, body) L_##op: {body}
+
+    goto *ip->handler;
+    STACK_HANDLERS(HANDLER)
+
+    #undef OPERAND
+    #undef NEXT
+    #undef JUMP
+    #undef HALT
+    #undef HANDLER
+}
+
+#endif
+
+// Runs a bytecode program on the given variable slots
+// Returns the number of instructions executed
+long long RunBytecode(BytecodeProgram* prog, VMValue* variables, Dispatch dispatch)
+{
+    VMValue* stack=new VMValue[prog->max_stack+1];
+    long long count;
+
+#ifdef TINY_THREADED_DISPATCH
+    if(dispatch==DISPATCH_THREADED) count=RunBytecodeThreaded(prog, variables, stack);
+    else
+#else
+    (void)dispatch;
+#endif
+    count=RunBytecodeSwitch(prog, variables, stack);
+
+    delete[] stack;
+    return count;
+}
+
+// Compiles and runs the program on the stack virtual machine
+void RunVM(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    int i;
+    BytecodeProgram prog;
+    GenerateBytecode(&prog, syntax_tree, symbol_table);
+
+    VMValue* variables=new VMValue[prog.vars.num_vars+1];
+    for(i=0;i<prog.vars.num_vars;i++) variables[i].r=0.0;
+
+    long long count=RunBytecode(&prog, variables, options->dispatch);
+    if(options->stats)
+        fprintf(stderr, "[Engine=vm][CodeWords=%d][Instructions=%lld]\n", prog.code_size, count);
+
+    delete[] variables;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Register Machine ////////////////////////////////////////////////////////////////
+
+// Three-operand instructions over typed virtual registers
+// The register file holds, in order: the variables (register v is memloc v), the
+// temporaries, then the constants (loaded once before the program starts)
+// Typed forms are paired like the stack machine's: int op, then real op
+// Compare-and-branch instructions test a comparison and jump without producing a
+// bool, B<cmp> jumps if it holds and BN<cmp> if it does not (for reals "not less"
+// differs from "greater or equal" when a NaN is involved)
+enum RegOpCode{
+                RG_MOV, RG_I2R, RG_R2I,
+                RG_ADDI, RG_ADDR, RG_SUBI, RG_SUBR, RG_MULI, RG_MULR, RG_DIVI, RG_DIVR,
+                RG_POWI, RG_POWR, RG_ANDI, RG_ANDR,
+                RG_EQI, RG_EQR, RG_LTI, RG_LTR, RG_GTI, RG_GTR, RG_GEI, RG_GER, RG_LEI, RG_LER,
+                RG_BEQI, RG_BEQR, RG_BLTI, RG_BLTR, RG_BGTI, RG_BGTR, RG_BGEI, RG_BGER, RG_BLEI, RG_BLER,
+                RG_BNEQI, RG_BNEQR, RG_BNLTI, RG_BNLTR, RG_BNGTI, RG_BNGTR, RG_BNGEI, RG_BNGER, RG_BNLEI, RG_BNLER,
+                RG_JMP, RG_JT, RG_JF,
+                RG_WRI, RG_WRR, RG_WRB,
+                RG_RDI, RG_RDR, RG_RDB,
+                RG_HALT
+              };
+
+// Mnemonic and operand kinds of each instruction, used by the generator and the
+// disassembler: d = destination register, s = source register, t = jump target
+struct RegOpInfo
+{
+    const char* name;
+    const char* operands;
+};
+
+const RegOpInfo reg_op_info[]=
+{
+    {"MOV", "ds"}, {"I2R", "ds"}, {"R2I", "ds"},
+    {"ADDI", "dss"}, {"ADDR", "dss"}, {"SUBI", "dss"}, {"SUBR", "dss"},
+    {"MULI", "dss"}, {"MULR", "dss"}, {"DIVI", "dss"}, {"DIVR", "dss"},
+    {"POWI", "dss"}, {"POWR", "dss"}, {"ANDI", "dss"}, {"ANDR", "dss"},
+    {"EQI", "dss"}, {"EQR", "dss"}, {"LTI", "dss"}, {"LTR", "dss"}, {"GTI", "dss"},
+    {"GTR", "dss"}, {"GEI", "dss"}, {"GER", "dss"}, {"LEI", "dss"}, {"LER", "dss"},
+    {"BEQI", "sst"}, {"BEQR", "sst"}, {"BLTI", "sst"}, {"BLTR", "sst"}, {"BGTI", "sst"},
+    {"BGTR", "sst"}, {"BGEI", "sst"}, {"BGER", "sst"}, {"BLEI", "sst"}, {"BLER", "sst"},
+    {"BNEQI", "sst"}, {"BNEQR", "sst"}, {"BNLTI", "sst"}, {"BNLTR", "sst"}, {"BNGTI", "sst"},
+    {"BNGTR", "sst"}, {"BNGEI", "sst"}, {"BNGER", "sst"}, {"BNLEI", "sst"}, {"BNLER", "sst"},
+    {"JMP", "t"}, {"JT", "st"}, {"JF", "st"},
+    {"WRI", "s"}, {"WRR", "s"}, {"WRB", "s"},
+    {"RDI", "d"}, {"RDR", "d"}, {"RDB", "d"},
+    {"HALT", ""}
+};
+
+// Operands are stored in the order they are listed in reg_op_info
+struct RegInstr
+{
+    RegOpCode op;
+    int a, b, c;
+};
+
+// Line table entry: the code of source line starts at instruction instr
+struct RegLine
+{
+    int instr;
+    int line;
+};
+
+// While generating, constants get registers numbered from CONST_REG_BASE since the
+// number of temporaries is not known yet, they are renumbered once it is
+#define CONST_REG_BASE (1<<28)
+
+struct RegProgram
+{
+    RegInstr* code;
+    int code_size, code_cap;
+
+    VMValue* consts;            // constant pool, constant k is register const_base+k
+    ExprDataType* const_types;  // for the disassembler
+    int num_consts, consts_cap, const_types_cap;
+
+    VariableLayout vars;        // register v is variable v
+    int num_temps, next_temp;   // temporaries are registers vars.num_vars ...
+    int const_base, num_regs;   // set once generation is done
+
+    RegLine* lines;             // line table, in instruction order
+    int num_lines, lines_cap;
+
+    RegProgram() {code=0; code_size=code_cap=0; consts=0; const_types=0; num_consts=consts_cap=const_types_cap=0;
+                  num_temps=next_temp=0; const_base=num_regs=0; lines=0; num_lines=lines_cap=0;}
+    ~RegProgram()
+    {
+        if(lines) delete[] lines;
+        if(code) delete[] code;
+        if(consts) delete[] consts;
+        if(const_types) delete[] const_types;
+    }
+
+    int Emit(RegOpCode op, int a=0, int b=0, int c=0)
+    {
+        Reserve(code, code_cap, code_size+1);
+        code[code_size].op=op; code[code_size].a=a; code[code_size].b=b; code[code_size].c=c;
+        return code_size++;
+    }
+
+    int NewTemp()
+    {
+        int t=next_temp++;
+        if(next_temp>num_temps) num_temps=next_temp;
+        return vars.num_vars+t;
+    }
+
+    bool IsTemp(int reg) {return reg>=vars.num_vars && reg<CONST_REG_BASE;}
+
+    // Register of a constant, equal constants share one register
+    int Const(VMValue v, ExprDataType type)
+    {
+        int i;
+        for(i=0;i<num_consts;i++)
+            if(const_types[i]==type && memcmp(&consts[i], &v, sizeof(v))==0) return CONST_REG_BASE+i;
+        Reserve(consts, consts_cap, num_consts+1);
+        Reserve(const_types, const_types_cap, num_consts+1);
+        consts[num_consts]=v;
+        const_types[num_consts]=type;
+        return CONST_REG_BASE+num_consts++;
+    }
+
+    int IntConst(int v) {VMValue x; x.r=0.0; x.i=v; return Const(x, INTEGER);}
+    int RealConst(double v) {VMValue x; x.r=v; return Const(x, REAL);}
+
+    // Notes that the code of a source line starts at the next instruction
+    void Line(int line)
+    {
+        if(num_lines>0 && lines[num_lines-1].line==line) return;
+        if(num_lines>0 && lines[num_lines-1].instr==code_size) {lines[num_lines-1].line=line; return;}
+        Reserve(lines, lines_cap, num_lines+1);
+        lines[num_lines].instr=code_size;
+        lines[num_lines].line=line;
+        num_lines++;
+    }
+};
+
+// Operator token to int-typed register opcode (the real form follows it)
+RegOpCode RegOperOpCode(TokenType oper)
+{
+    switch(oper)
+    {
+        case PLUS: return RG_ADDI;
+        case MINUS: return RG_SUBI;
+        case TIMES: return RG_MULI;
+        case DIVIDE: return RG_DIVI;
+        case POWER: return RG_POWI;
+        case AND_OP: return RG_ANDI;
+        case EQUAL: return RG_EQI;
+        case LESS_THAN: return RG_LTI;
+        case GREATER_THAN: return RG_GTI;
+        case GREATER_EQUAL: return RG_GEI;
+        case LESS_EQUAL: return RG_LEI;
+        default: throw 0;
+    }
+}
+
+// Type an operator is computed in (see GenerateExpr())
+inline ExprDataType OperType(TreeNode* node)
+{
+    return (node->child[0]->expr_data_type==REAL || node->child[1]->expr_data_type==REAL) ? REAL : INTEGER;
+}
+
+int GenerateRegExpr(RegProgram* prog, TreeNode* node, SymbolTable* symbol_table, int dest);
+
+// Computes both operands of an OPER_NODE into registers, converted to the type the
+// operator is computed in, and frees the temporaries used on the way
+// The registers returned stay valid until the next instruction is emitted
+void GenerateRegOperands(RegProgram* prog, TreeNode* node, SymbolTable* symbol_table, int* left, int* right)
+{
+    int saved_temp=prog->next_temp;
+    ExprDataType op_type=OperType(node);
+
+    *left=GenerateRegExpr(prog, node->child[0], symbol_table, -1);
+    if(op_type==REAL && node->child[0]->expr_data_type!=REAL)
+    {
+        int t=prog->IsTemp(*left) ? *left : prog->NewTemp();
+        prog->Emit(RG_I2R, t, *left);
+        *left=t;
+    }
+
+    *right=GenerateRegExpr(prog, node->child[1], symbol_table, -1);
+    bool convert=(node->oper==POWER) ? node->child[1]->expr_data_type==REAL :
+                                       (op_type==REAL && node->child[1]->expr_data_type!=REAL);
+    if(convert)
+    {
+        int t=prog->IsTemp(*right) ? *right : prog->NewTemp();
+        prog->Emit(node->oper==POWER ? RG_R2I : RG_I2R, t, *right);
+        *right=t;
+    }
+
+    prog->next_temp=saved_temp;
+}
+
+// Emits code computing the expression and returns the register holding its value
+// Variables and constants need no code, their own register is returned
+// dest (if not -1) is the register the caller wants the value in, it is only written
+// by the last instruction so it may also be one of the operands
+int GenerateRegExpr(RegProgram* prog, TreeNode* node, SymbolTable* symbol_table, int dest)
+{
+    if(node->node_kind==NUM_NODE)
+        return node->expr_data_type==REAL ? prog->RealConst(node->real_num) : prog->IntConst(node->num);
+
+    if(node->node_kind==ID_NODE)
+        return symbol_table->Find(node->id)->memloc;
+
+    int left, right;
+    GenerateRegOperands(prog, node, symbol_table, &left, &right);
+    if(dest<0) dest=prog->NewTemp();
+    prog->Emit((RegOpCode)(RegOperOpCode(node->oper)+(OperType(node)==REAL)), dest, left, right);
+    return dest;
+}
+
+// Emits a jump to target taken when the condition is (when_true) true or false
+// Returns the index of the jump instruction
+int GenerateRegBranch(RegProgram* prog, TreeNode* cond, SymbolTable* symbol_table, bool when_true, int target)
+{
+    if(cond->node_kind==OPER_NODE && IsComparison(cond->oper))
+    {
+        int left, right;
+        GenerateRegOperands(prog, cond, symbol_table, &left, &right);
+        int op=RegOperOpCode(cond->oper)-RG_EQI+(OperType(cond)==REAL);
+        return prog->Emit((RegOpCode)(op+(when_true ? RG_BEQI : RG_BNEQI)), left, right, target);
+    }
+
+    int saved_temp=prog->next_temp;
+    int reg=GenerateRegExpr(prog, cond, symbol_table, -1);
+    prog->next_temp=saved_temp;
+    return prog->Emit(when_true ? RG_JT : RG_JF, reg, target);
+}
+
+// Index of the jump target operand of a branch instruction, -1 if it has none
+int RegTargetOperand(RegOpCode op)
+{
+    const char* k=reg_op_info[op].operands;
+    int i;
+    for(i=0;k[i];i++) if(k[i]=='t') return i;
+    return -1;
+}
+
+void SetRegTarget(RegProgram* prog, int instr, int target)
+{
+    RegInstr* in=&prog->code[instr];
+    int i=RegTargetOperand(in->op);
+    if(i==0) in->a=target; else if(i==1) in->b=target; else in->c=target;
+}
+
+void GenerateRegStmtSeq(RegProgram* prog, TreeNode* node, SymbolTable* symbol_table);
+
+void GenerateRegStmt(RegProgram* prog, TreeNode* node, SymbolTable* symbol_table)
+{
+    prog->Line(node->line_num);
+    if(node->node_kind==IF_NODE)
+    {
+        int jump_else=GenerateRegBranch(prog, node->child[0], symbol_table, false, 0);
+        GenerateRegStmtSeq(prog, node->child[1], symbol_table);
+        if(node->child[2])
+        {
+            int jump_end=prog->Emit(RG_JMP, 0);
+            SetRegTarget(prog, jump_else, prog->code_size);
+            GenerateRegStmtSeq(prog, node->child[2], symbol_table);
+            SetRegTarget(prog, jump_end, prog->code_size);
+        }
+        else SetRegTarget(prog, jump_else, prog->code_size);
+    }
+    else if(node->node_kind==REPEAT_NODE)
+    {
+        int loop_start=prog->code_size;
+        GenerateRegStmtSeq(prog, node->child[0], symbol_table);
+        GenerateRegBranch(prog, node->child[1], symbol_table, false, loop_start);
+    }
+    else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+    {
+        VariableInfo* var=symbol_table->Find(node->id);
+        int reg;
+        if(node->child[0]) reg=GenerateRegExpr(prog, node->child[0], symbol_table, var->memloc);
+        else reg=(var->var_type==REAL) ? prog->RealConst(0.0) : prog->IntConst(0);
+        if(reg!=var->memloc) prog->Emit(RG_MOV, var->memloc, reg);
+    }
+    else if(node->node_kind==READ_NODE)
+    {
+        VariableInfo* var=symbol_table->Find(node->id);
+        prog->Emit(var->var_type==REAL ? RG_RDR : var->var_type==BOOLEAN ? RG_RDB : RG_RDI, var->memloc);
+    }
+    else if(node->node_kind==WRITE_NODE)
+    {
+        ExprDataType type=node->child[0]->expr_data_type;
+        int saved_temp=prog->next_temp;
+        int reg=GenerateRegExpr(prog, node->child[0], symbol_table, -1);
+        prog->next_temp=saved_temp;
+        prog->Emit(type==REAL ? RG_WRR : type==BOOLEAN ? RG_WRB : RG_WRI, reg);
+    }
+}
+
+void GenerateRegStmtSeq(RegProgram* prog, TreeNode* node, SymbolTable* symbol_table)
+{
+    for(;node;node=node->sibling) GenerateRegStmt(prog, node, symbol_table);
+}
+
+// Places the constants after the temporaries once all code is generated
+void FinishRegCode(RegProgram* prog)
+{
+    int i, j;
+    prog->const_base=prog->vars.num_vars+prog->num_temps;
+    prog->num_regs=prog->const_base+prog->num_consts;
+    for(i=0;i<prog->code_size;i++)
+    {
+        RegInstr* in=&prog->code[i];
+        int* operand[3]={&in->a, &in->b, &in->c};
+        const char* kinds=reg_op_info[in->op].operands;
+        for(j=0;kinds[j];j++)
+            if(kinds[j]!='t' && *operand[j]>=CONST_REG_BASE) *operand[j]=*operand[j]-CONST_REG_BASE+prog->const_base;
+    }
+}
+
+// Compiles the analyzed tree (which must be statically typed) into register code
+void GenerateRegCode(RegProgram* prog, TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    prog->vars.Set(symbol_table);
+    GenerateRegStmtSeq(prog, syntax_tree, symbol_table);
+    prog->Emit(RG_HALT);
+    FinishRegCode(prog);
+}
+
+void PrintRegOperand(RegProgram* prog, char kind, int v)
+{
+    if(kind=='t') {printf("@%d", v); return;}
+    if(v>=prog->const_base)
+    {
+        int k=v-prog->const_base;
+        if(prog->const_types[k]==REAL) printf("#%lf", prog->consts[k].r);
+        else printf("#%d", prog->consts[k].i);
+        return;
+    }
+    printf("r%d", v);
+}
+
+// Disassembler: one instruction per line, variables are named in a trailing comment
+// and the line table is shown as "; line N" before the code of each source line
+void PrintRegCode(RegProgram* prog)
+{
+    int i, j, k=0;
+    for(i=0;i<prog->vars.num_vars;i++)
+        printf("; r%d = %s (%s)\n", i, prog->vars.names[i], ExprDataTypeStr[prog->vars.types[i]]);
+    if(prog->num_temps>0)
+        printf("; r%d..r%d = temporaries\n", prog->vars.num_vars, prog->const_base-1);
+
+    for(i=0;i<prog->code_size;i++)
+    {
+        RegInstr* in=&prog->code[i];
+        int operand[3]={in->a, in->b, in->c};
+        const char* kinds=reg_op_info[in->op].operands;
+
+        for(;k<prog->num_lines && prog->lines[k].instr==i;k++) printf("; line %d\n", prog->lines[k].line);
+        printf("%4d: %-6s", i, reg_op_info[in->op].name);
+        for(j=0;kinds[j];j++)
+        {
+            printf(j ? ", " : " ");
+            PrintRegOperand(prog, kinds[j], operand[j]);
+        }
+        printf("\n");
+    }
+}
+
+// Instruction semantics of the register machine, shared by both dispatch loops
+// NEXT continues with the next instruction, JUMP(t) with instruction t and HALT stops
+// the program
+#define REG_BINARY(member, expr) {VMValue& a=regs[ip->b]; VMValue& b=regs[ip->c]; regs[ip->a].member=(expr); NEXT}
+#define REG_COMPARE(member, cmp) {regs[ip->a].i=(regs[ip->b].member cmp regs[ip->c].member); NEXT}
+#define REG_BRANCH(member, cond) {VMValue& a=regs[ip->a]; VMValue& b=regs[ip->b]; if(cond) JUMP(ip->c) NEXT}
+#define REG_HANDLERS(HANDLER) \
+    HANDLER(RG_MOV, regs[ip->a]=regs[ip->b]; NEXT) \
+    HANDLER(RG_I2R, regs[ip->a].r=(double)regs[ip->b].i; NEXT) \
+    HANDLER(RG_R2I, regs[ip->a].i=(int)regs[ip->b].r; NEXT) \
+    HANDLER(RG_ADDI, REG_BINARY(i, a.i+b.i)) \
+    HANDLER(RG_ADDR, REG_BINARY(r, a.r+b.r)) \
+    HANDLER(RG_SUBI, REG_BINARY(i, a.i-b.i)) \
+    HANDLER(RG_SUBR, REG_BINARY(r, a.r-b.r)) \
+    HANDLER(RG_MULI, REG_BINARY(i, a.i*b.i)) \
+    HANDLER(RG_MULR, REG_BINARY(r, a.r*b.r)) \
+    HANDLER(RG_DIVI, if(regs[ip->c].i==0) DivisionByZero(); REG_BINARY(i, a.i/b.i)) \
+    HANDLER(RG_DIVR, if(regs[ip->c].r==0.0) DivisionByZero(); REG_BINARY(r, a.r/b.r)) \
+    HANDLER(RG_POWI, REG_BINARY(i, Power(a.i, b.i))) \
+    HANDLER(RG_POWR, REG_BINARY(r, RealPower(a.r, b.i))) \
+    HANDLER(RG_ANDI, REG_BINARY(i, a.i*a.i-b.i*b.i)) \
+    HANDLER(RG_ANDR, REG_BINARY(r, a.r*a.r-b.r*b.r)) \
+    HANDLER(RG_EQI, REG_COMPARE(i, ==)) \
+    HANDLER(RG_EQR, REG_COMPARE(r, ==)) \
+    HANDLER(RG_LTI, REG_COMPARE(i, <)) \
+    HANDLER(RG_LTR, REG_COMPARE(r, <)) \
+    HANDLER(RG_GTI, REG_COMPARE(i, >)) \
+    HANDLER(RG_GTR, REG_COMPARE(r, >)) \
+    HANDLER(RG_GEI, REG_COMPARE(i, >=)) \
+    HANDLER(RG_GER, REG_COMPARE(r, >=)) \
+    HANDLER(RG_LEI, REG_COMPARE(i, <=)) \
+    HANDLER(RG_LER, REG_COMPARE(r, <=)) \
+    HANDLER(RG_BEQI, REG_BRANCH(i, a.i==b.i)) \
+    HANDLER(RG_BEQR, REG_BRANCH(r, a.r==b.r)) \
+    HANDLER(RG_BLTI, REG_BRANCH(i, a.i<b.i)) \
+    HANDLER(RG_BLTR, REG_BRANCH(r, a.r<b.r)) \
+    HANDLER(RG_BGTI, REG_BRANCH(i, a.i>b.i)) \
+    HANDLER(RG_BGTR, REG_BRANCH(r, a.r>b.r)) \
+    HANDLER(RG_BGEI, REG_BRANCH(i, a.i>=b.i)) \
+    HANDLER(RG_BGER, REG_BRANCH(r, a.r>=b.r)) \
+    HANDLER(RG_BLEI, REG_BRANCH(i, a.i<=b.i)) \
+    HANDLER(RG_BLER, REG_BRANCH(r, a.r<=b.r)) \
+    HANDLER(RG_BNEQI, REG_BRANCH(i, !(a.i==b.i))) \
+    HANDLER(RG_BNEQR, REG_BRANCH(r, !(a.r==b.r))) \
+    HANDLER(RG_BNLTI, REG_BRANCH(i, !(a.i<b.i))) \
+    HANDLER(RG_BNLTR, REG_BRANCH(r, !(a.r<b.r))) \
+    HANDLER(RG_BNGTI, REG_BRANCH(i, !(a.i>b.i))) \
+    HANDLER(RG_BNGTR, REG_BRANCH(r, !(a.r>b.r))) \
+    HANDLER(RG_BNGEI, REG_BRANCH(i, !(a.i>=b.i))) \
+    HANDLER(RG_BNGER, REG_BRANCH(r, !(a.r>=b.r))) \
+    HANDLER(RG_BNLEI, REG_BRANCH(i, !(a.i<=b.i))) \
+    HANDLER(RG_BNLER, REG_BRANCH(r, !(a.r<=b.r))) \
+    HANDLER(RG_JMP, JUMP(ip->a)) \
+    HANDLER(RG_JT, if(regs[ip->a].i) JUMP(ip->b) NEXT) \
+    HANDLER(RG_JF, if(!regs[ip->a].i) JUMP(ip->b) NEXT) \
+    HANDLER(RG_WRI, WriteInt(regs[ip->a].i); NEXT) \
+    HANDLER(RG_WRR, WriteReal(regs[ip->a].r); NEXT) \
+    HANDLER(RG_WRB, WriteBool(regs[ip->a].i); NEXT) \
+    HANDLER(RG_RDI, ReadValue(prog->vars.names[ip->a], INTEGER, &regs[ip->a]); NEXT) \
+    HANDLER(RG_RDR, ReadValue(prog->vars.names[ip->a], REAL, &regs[ip->a]); NEXT) \
+    HANDLER(RG_RDB, ReadValue(prog->vars.names[ip->a], BOOLEAN, &regs[ip->a]); NEXT) \
+    HANDLER(RG_HALT, HALT)
+
+// Switch dispatch: one central switch decodes every instruction
+long long RunRegCodeSwitch(RegProgram* prog, VMValue* regs)
+{
+    RegInstr* code=prog->code;
+    RegInstr* ip=code;
+    long long count=0;
+
+    #define NEXT {ip++; break;}
+    #define JUMP(t) {ip=code+(t); break;}
+    #define HALT return count;
+    #define HANDLER(op, body) case op: {body}
+
+    while(true)
+    {
+        count++;
+        switch(ip->op)
+        {
+            REG_HANDLERS(HANDLER)
+            default: throw 0;
+        }
+    }
+
+    #undef NEXT
+    #undef JUMP
+    #undef HALT
+    #undef HANDLER
+}
+
+#ifdef TINY_THREADED_DISPATCH
+
+// A predecoded register machine instruction: the address of its handler replaces the
+// opcode, the operands are unchanged
+struct RegThreadedInstr
+{
+    const void* handler;
+    int a, b, c;
+};
+
+// Direct threaded dispatch over the predecoded code, see RunBytecodeThreaded()
+long long RunRegCodeThreaded(RegProgram* prog, VMValue* regs)
+{
+    int i;
+    const void* handlers[RG_HALT+1];
+    #define HANDLER(op, body) handlers[op]=&&L_##op;
+    REG_HANDLERS(HANDLER)
+    #undef HANDLER
+
+    RegThreadedInstr* code=new RegThreadedInstr[prog->code_size];
+    for(i=0;i<prog->code_size;i++)
+    {
+        code[i].handler=handlers[prog->code[i].op];
+        code[i].a=prog->code[i].a; code[i].b=prog->code[i].b; code[i].c=prog->code[i].c;
+    }
+
+    RegThreadedInstr* ip=code;
+    long long count=1;
+
+    #define NEXT {ip++; count++; goto *ip->handler;}
+    #define JUMP(t) {ip=code+(t); count++; goto *ip->handler;}
+    #define HALT {delete[] code; return count;}
+    #define HANDLER(op, body) L_##op: {body}
+
+    goto *ip->handler;
+    REG_HANDLERS(HANDLER)
+
+    #undef NEXT
+    #undef JUMP
+    #undef HALT
+    #undef HANDLER
+}
+
+#endif
+
+// Runs register code, regs must hold the variables followed by room for the
+// temporaries and constants
+// Returns the number of instructions executed
+long long RunRegCode(RegProgram* prog, VMValue* regs, Dispatch dispatch)
+{
+    int i;
+    for(i=0;i<prog->num_consts;i++) regs[prog->const_base+i]=prog->consts[i];
+
+#ifdef TINY_THREADED_DISPATCH
+    if(dispatch==DISPATCH_THREADED) return RunRegCodeThreaded(prog, regs);
+#else
+    (void)dispatch;
+#endif
+    return RunRegCodeSwitch(prog, regs);
+}
+
+// Compiles and runs the program on the register machine
+void RunRegVM(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    int i;
+    RegProgram prog;
+    GenerateRegCode(&prog, syntax_tree, symbol_table);
+
+    VMValue* regs=new VMValue[prog.num_regs+1];
+    for(i=0;i<prog.num_regs;i++) regs[i].r=0.0;
+
+    long long count=RunRegCode(&prog, regs, options->dispatch);
+    if(options->stats)
+        fprintf(stderr, "[Engine=reg][Instructions=%d][Registers=%d][Executed=%lld]\n", prog.code_size, prog.num_regs, count);
+
+    delete[] regs;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Closure Compiler ////////////////////////////////////////////////////////////////
+
+// Every node is compiled once into a closure: a function specialized for the node's
+// kind, operator and operand types, bound to its compiled children, variable slot or
+// constant. Running a closure does no node_kind/oper switching and no symbol lookups.
+// Int and bool expressions return int, real expressions return double.
+
+struct Closure;
+typedef int (*IntClosureFn)(Closure* c, VMValue* vars);
+typedef double (*RealClosureFn)(Closure* c, VMValue* vars);
+typedef void (*StmtClosureFn)(Closure* c, VMValue* vars);
+
+struct Closure
+{
+    union{IntClosureFn int_fn; RealClosureFn real_fn; StmtClosureFn stmt_fn;};
+    Closure* a;             // operands, condition or loop body
+    Closure* b;             // second operand or then branch
+    Closure* c;             // else branch
+    Closure* next;          // next statement of a statement list
+    int slot;               // variable memloc
+    int int_const;          // int constant (also the right operand of the ...K forms)
+    double real_const;      // real constant
+    const char* name;       // variable name for read prompts
+
+    Closure() {int_fn=0; a=b=c=next=0; slot=0; int_const=0; real_const=0.0; name=0;}
+};
+
+inline int RunInt(Closure* c, VMValue* vars) {return c->int_fn(c, vars);}
+inline double RunReal(Closure* c, VMValue* vars) {return c->real_fn(c, vars);}
+
+void RunStmtClosures(Closure* c, VMValue* vars)
+{
+    for(;c;c=c->next) c->stmt_fn(c, vars);
+}
+
+// Leaves
+int IntConstClosure(Closure* c, VMValue*) {return c->int_const;}
+double RealConstClosure(Closure* c, VMValue*) {return c->real_const;}
+int IntVarClosure(Closure* c, VMValue* vars) {return vars[c->slot].i;}
+double RealVarClosure(Closure* c, VMValue* vars) {return vars[c->slot].r;}
+double I2RClosure(Closure* c, VMValue* vars) {return (double)RunInt(c->a, vars);}
+int R2IClosure(Closure* c, VMValue* vars) {return (int)RunReal(c->a, vars);}
+
+// Each operator gets a general form and a form whose right operand is a constant
+// (int_const or real_const), which covers x + 1 and i < 10 without a call
+#define INT_OPER_CLOSURES(name, expr) \
+    int name##Closure(Closure* c, VMValue* vars) {int a=RunInt(c->a, vars); int b=RunInt(c->b, vars); return (expr);} \
+    int name##KClosure(Closure* c, VMValue* vars) {int a=RunInt(c->a, vars); int b=c->int_const; return (expr);}
+#define REAL_OPER_CLOSURES(name, type, expr) \
+    type name##Closure(Closure* c, VMValue* vars) {double a=RunReal(c->a, vars); double b=RunReal(c->b, vars); return (expr);} \
+    type name##KClosure(Closure* c, VMValue* vars) {double a=RunReal(c->a, vars); double b=c->real_const; return (expr);}
+
+inline int CheckedDivide(int a, int b) {if(b==0) DivisionByZero(); return a/b;}
+inline double CheckedDivide(double a, double b) {if(b==0.0) DivisionByZero(); return a/b;}
+
+INT_OPER_CLOSURES(AddI, a+b)
+INT_OPER_CLOSURES(SubI, a-b)
+INT_OPER_CLOSURES(MulI, a*b)
+INT_OPER_CLOSURES(DivI, CheckedDivide(a, b))
+INT_OPER_CLOSURES(DivIU, a/b)
+INT_OPER_CLOSURES(PowI, Power(a, b))
+INT_OPER_CLOSURES(AndI, a*a-b*b)
+INT_OPER_CLOSURES(EqI, a==b)
+INT_OPER_CLOSURES(LtI, a<b)
+INT_OPER_CLOSURES(GtI, a>b)
+INT_OPER_CLOSURES(GeI, a>=b)
+INT_OPER_CLOSURES(LeI, a<=b)
+REAL_OPER_CLOSURES(AddR, double, a+b)
+REAL_OPER_CLOSURES(SubR, double, a-b)
+REAL_OPER_CLOSURES(MulR, double, a*b)
+REAL_OPER_CLOSURES(DivR, double, CheckedDivide(a, b))
+REAL_OPER_CLOSURES(DivRU, double, a/b)
+REAL_OPER_CLOSURES(AndR, double, a*a-b*b)
+REAL_OPER_CLOSURES(EqR, int, a==b)
+REAL_OPER_CLOSURES(LtR, int, a<b)
+REAL_OPER_CLOSURES(GtR, int, a>b)
+REAL_OPER_CLOSURES(GeR, int, a>=b)
+REAL_OPER_CLOSURES(LeR, int, a<=b)
+
+// Real base, int exponent
+double PowRClosure(Closure* c, VMValue* vars) {double a=RunReal(c->a, vars); return RealPower(a, RunInt(c->b, vars));}
+double PowRKClosure(Closure* c, VMValue* vars) {return RealPower(RunReal(c->a, vars), c->int_const);}
+
+#undef INT_OPER_CLOSURES
+#undef REAL_OPER_CLOSURES
+
+// Statements
+void AssignIntClosure(Closure* c, VMValue* vars) {vars[c->slot].i=RunInt(c->a, vars);}
+void AssignRealClosure(Closure* c, VMValue* vars) {vars[c->slot].r=RunReal(c->a, vars);}
+void WriteIntClosure(Closure* c, VMValue* vars) {WriteInt(RunInt(c->a, vars));}
+void WriteRealClosure(Closure* c, VMValue* vars) {WriteReal(RunReal(c->a, vars));}
+void WriteBoolClosure(Closure* c, VMValue* vars) {WriteBool(RunInt(c->a, vars));}
+void ReadIntClosure(Closure* c, VMValue* vars) {ReadValue(c->name, INTEGER, &vars[c->slot]);}
+void ReadRealClosure(Closure* c, VMValue* vars) {ReadValue(c->name, REAL, &vars[c->slot]);}
+void ReadBoolClosure(Closure* c, VMValue* vars) {ReadValue(c->name, BOOLEAN, &vars[c->slot]);}
+
+void IfClosure(Closure* c, VMValue* vars)
+{
+    if(RunInt(c->a, vars)) RunStmtClosures(c->b, vars);
+    else RunStmtClosures(c->c, vars);
+}
+
+void RepeatClosure(Closure* c, VMValue* vars)
+{
+    do RunStmtClosures(c->b, vars);
+    while(!RunInt(c->a, vars));
+}
+
+// Owns every closure of a compiled program
+struct ClosureProgram
+{
+    Closure** closures;
+    int num_closures, closures_cap;
+    Closure* first;         // first statement
+
+    ClosureProgram() {closures=0; num_closures=closures_cap=0; first=0;}
+    ~ClosureProgram()
+    {
+        int i;
+        for(i=0;i<num_closures;i++) delete closures[i];
+        if(closures) delete[] closures;
+    }
+
+    Closure* New()
+    {
+        Reserve(closures, closures_cap, num_closures+1);
+        return closures[num_closures++]=new Closure;
+    }
+};
+
+// Operator closures by operator and type: general and constant right operand forms
+struct OperClosureFns
+{
+    TokenType oper;
+    IntClosureFn int_fn, int_k_fn;
+    void* real_fn;          // RealClosureFn, or IntClosureFn for comparisons
+    void* real_k_fn;
+};
+
+const OperClosureFns oper_closure_fns[]=
+{
+    {PLUS, AddIClosure, AddIKClosure, (void*)AddRClosure, (void*)AddRKClosure},
+    {MINUS, SubIClosure, SubIKClosure, (void*)SubRClosure, (void*)SubRKClosure},
+    {TIMES, MulIClosure, MulIKClosure, (void*)MulRClosure, (void*)MulRKClosure},
+    {DIVIDE, DivIClosure, DivIKClosure, (void*)DivRClosure, (void*)DivRKClosure},
+    {POWER, PowIClosure, PowIKClosure, (void*)PowRClosure, (void*)PowRKClosure},
+    {AND_OP, AndIClosure, AndIKClosure, (void*)AndRClosure, (void*)AndRKClosure},
+    {EQUAL, EqIClosure, EqIKClosure, (void*)EqRClosure, (void*)EqRKClosure},
+    {LESS_THAN, LtIClosure, LtIKClosure, (void*)LtRClosure, (void*)LtRKClosure},
+    {GREATER_THAN, GtIClosure, GtIKClosure, (void*)GtRClosure, (void*)GtRKClosure},
+    {GREATER_EQUAL, GeIClosure, GeIKClosure, (void*)GeRClosure, (void*)GeRKClosure},
+    {LESS_EQUAL, LeIClosure, LeIKClosure, (void*)LeRClosure, (void*)LeRKClosure}
+};
+
+// A division whose divisor cannot be 0 (see AnalyzeRanges())
+const OperClosureFns unchecked_divide_fns={DIVIDE, DivIUClosure, DivIUKClosure, (void*)DivRUClosure, (void*)DivRUKClosure};
+
+// Compiles an expression into a closure computing it as type
+Closure* CompileExprClosure(ClosureProgram* prog, TreeNode* node, SymbolTable* symbol_table, ExprDataType type)
+{
+    ExprDataType own=node->expr_data_type;
+    Closure* c=prog->New();
+
+    if(node->node_kind==NUM_NODE)
+    {
+        if(own==REAL) {c->real_fn=RealConstClosure; c->real_const=node->real_num;}
+        else {c->int_fn=IntConstClosure; c->int_const=node->num;}
+    }
+    else if(node->node_kind==ID_NODE)
+    {
+        c->slot=symbol_table->Find(node->id)->memloc;
+        if(own==REAL) c->real_fn=RealVarClosure; else c->int_fn=IntVarClosure;
+    }
+    else
+    {
+        int i=0;
+        while(oper_closure_fns[i].oper!=node->oper) i++;
+        const OperClosureFns* fns=node->oper==DIVIDE && node->unchecked ? &unchecked_divide_fns : &oper_closure_fns[i];
+
+        ExprDataType op_type=OperType(node);
+        ExprDataType right_type=(node->oper==POWER) ? INTEGER : op_type;
+        TreeNode* right=node->child[1];
+        bool right_const=(right->node_kind==NUM_NODE);
+
+        c->a=CompileExprClosure(prog, node->child[0], symbol_table, op_type);
+        if(right_const)
+        {
+            if(right_type==REAL) c->real_const=(right->expr_data_type==REAL) ? right->real_num : (double)right->num;
+            else c->int_const=(right->expr_data_type==REAL) ? (int)right->real_num : right->num;
+        }
+        else c->b=CompileExprClosure(prog, right, symbol_table, right_type);
+
+        if(op_type==REAL) c->real_fn=(RealClosureFn)(right_const ? fns->real_k_fn : fns->real_fn);
+        else c->int_fn=right_const ? fns->int_k_fn : fns->int_fn;
+
+        // Comparisons return an int (bool) whatever their operands are
+        own=IsComparison(node->oper) ? BOOLEAN : op_type;
+    }
+
+    if(own==REAL && type!=REAL) {Closure* conv=prog->New(); conv->int_fn=R2IClosure; conv->a=c; return conv;}
+    if(own!=REAL && type==REAL) {Closure* conv=prog->New(); conv->real_fn=I2RClosure; conv->a=c; return conv;}
+    return c;
+}
+
+// Compiles a statement list, returns its first statement
+Closure* CompileStmtClosures(ClosureProgram* prog, TreeNode* node, SymbolTable* symbol_table)
+{
+    Closure* first=0;
+    Closure* last=0;
+
+    for(;node;node=node->sibling)
+    {
+        Closure* c=prog->New();
+
+        if(node->node_kind==IF_NODE)
+        {
+            c->stmt_fn=IfClosure;
+            c->a=CompileExprClosure(prog, node->child[0], symbol_table, BOOLEAN);
+            c->b=CompileStmtClosures(prog, node->child[1], symbol_table);
+            c->c=CompileStmtClosures(prog, node->child[2], symbol_table);
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            c->stmt_fn=RepeatClosure;
+            c->b=CompileStmtClosures(prog, node->child[0], symbol_table);
+            c->a=CompileExprClosure(prog, node->child[1], symbol_table, BOOLEAN);
+        }
+        else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+        {
+            VariableInfo* var=symbol_table->Find(node->id);
+            c->slot=var->memloc;
+            c->stmt_fn=(var->var_type==REAL) ? AssignRealClosure : AssignIntClosure;
+            if(node->child[0]) c->a=CompileExprClosure(prog, node->child[0], symbol_table, var->var_type);
+            else
+            {
+                c->a=prog->New();
+                if(var->var_type==REAL) c->a->real_fn=RealConstClosure; else c->a->int_fn=IntConstClosure;
+            }
+        }
+        else if(node->node_kind==READ_NODE)
+        {
+            VariableInfo* var=symbol_table->Find(node->id);
+            c->slot=var->memloc;
+            c->name=var->name;
+            c->stmt_fn=(var->var_type==REAL) ? ReadRealClosure : (var->var_type==BOOLEAN) ? ReadBoolClosure : ReadIntClosure;
+        }
+        else if(node->node_kind==WRITE_NODE)
+        {
+            ExprDataType type=node->child[0]->expr_data_type;
+            c->a=CompileExprClosure(prog, node->child[0], symbol_table, type);
+            c->stmt_fn=(type==REAL) ? WriteRealClosure : (type==BOOLEAN) ? WriteBoolClosure : WriteIntClosure;
+        }
+
+        if(!first) first=c; else last->next=c;
+        last=c;
+    }
+    return first;
+}
+
+// Compiles the program into closures and runs them
+void RunClosures(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    int i;
+    ClosureProgram prog;
+    prog.first=CompileStmtClosures(&prog, syntax_tree, symbol_table);
+
+    VMValue* vars=new VMValue[symbol_table->num_vars+1];
+    for(i=0;i<symbol_table->num_vars;i++) vars[i].r=0.0;
+
+    RunStmtClosures(prog.first, vars);
+    if(options->stats) fprintf(stderr, "[Engine=closure][Closures=%d]\n", prog.num_closures);
+
+    delete[] vars;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// x86-64 JIT //////////////////////////////////////////////////////////////////////
+
+// Machine code buffer with labels for forward and backward jumps
+// Jumps always use 32-bit displacements, they are patched when the code is finished
+struct X86Emitter
+{
+    unsigned char* buf;
+    int size, cap;
+
+    int* label_pos;             // code offset of each label, -1 until bound
+    int num_labels, labels_cap;
+
+    int* fixup_at;              // offset of a rel32 field ...
+    int* fixup_label;           // ... and the label it refers to
+    int num_fixups, fixup_at_cap, fixup_label_cap;
+
+    X86Emitter() {buf=0; size=cap=0; label_pos=0; num_labels=labels_cap=0;
+                  fixup_at=fixup_label=0; num_fixups=fixup_at_cap=fixup_label_cap=0;}
+    ~X86Emitter()
+    {
+        if(buf) delete[] buf;
+        if(label_pos) delete[] label_pos;
+        if(fixup_at) delete[] fixup_at;
+        if(fixup_label) delete[] fixup_label;
+    }
+
+    void Byte(int b) {Reserve(buf, cap, size+1); buf[size++]=(unsigned char)b;}
+    void Bytes(const char* s, int n) {int i; for(i=0;i<n;i++) Byte((unsigned char)s[i]);}
+    void Int32(int v) {int i; for(i=0;i<4;i++) Byte((v>>(8*i))&0xFF);}
+    void Int64(long long v) {int i; for(i=0;i<8;i++) Byte((int)((v>>(8*i))&0xFF));}
+
+    int NewLabel()
+    {
+        Reserve(label_pos, labels_cap, num_labels+1);
+        label_pos[num_labels]=-1;
+        return num_labels++;
+    }
+    void Bind(int label) {label_pos[label]=size;}
+
+    // A rel32 field referring to label
+    void Rel32(int label)
+    {
+        Reserve(fixup_at, fixup_at_cap, num_fixups+1);
+        Reserve(fixup_label, fixup_label_cap, num_fixups+1);
+        fixup_at[num_fixups]=size;
+        fixup_label[num_fixups]=label;
+        num_fixups++;
+        Int32(0);
+    }
+
+    void Jmp(int label) {Byte(0xE9); Rel32(label);}
+    void Call(int label) {Byte(0xE8); Rel32(label);}
+    void Jcc(int cc, int label) {Byte(0x0F); Byte(0x80|cc); Rel32(label);}
+
+    void PatchJumps()
+    {
+        int i, j;
+        for(i=0;i<num_fixups;i++)
+        {
+            int rel=label_pos[fixup_label[i]]-(fixup_at[i]+4);
+            for(j=0;j<4;j++) buf[fixup_at[i]+j]=(unsigned char)((rel>>(8*j))&0xFF);
+        }
+    }
+};
+
+// Condition codes (low nibble of Jcc and SETcc)
+enum X86Cond {CC_B=0x2, CC_AE=0x3, CC_E=0x4, CC_NE=0x5, CC_BE=0x6, CC_A=0x7,
+              CC_P=0xA, CC_NP=0xB, CC_L=0xC, CC_GE=0xD, CC_LE=0xE, CC_G=0xF};
+
+#define JIT_FRAME_DISP(memloc) ((int)((memloc)*sizeof(VMValue)))
+
+// Labels and addresses of the runtime linked into an executable (see ELF Executable)
+// The routines keep the calling convention of WriteInt(), WriteReal(), WriteBool()
+// and ReadValue(), they preserve rbx, rbp and r12-r15
+struct ElfRuntime
+{
+    int write_int, write_real, write_bool, read;    // called by the program
+    int put, flush, peek, div_zero;                 // internal
+    int* prompts;           // address of the length-prefixed "Enter x (Type): " of each memloc
+    int true_line, false_line, error_line, pow10;   // addresses of constant data
+};
+
+// Register allocation: variables live in registers over their live range, a run of
+// statements from one statement list (the smallest covering every use), widened to
+// the outermost repeat it is in so that loop variables stay in registers for the
+// whole loop. A variable is loaded from the frame before its range and stored back
+// after it, so the frame is up to date wherever the code leaves the range.
+// Ranges are given registers by linear scan, when there are too few the variables
+// used least (uses weighted by loop depth) stay in the frame.
+// Caller-saved registers are stored to the frame around calls to the runtime.
+#define JIT_NO_REG -1
+#define JIT_MAX_LOOP_WEIGHT 5
+
+const int jit_int_regs[]={12, 13, 14, 15, 8, 9, 10, 11};   // callee-saved first
+const int jit_real_regs[]={3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+const int NUM_JIT_INT_REGS=sizeof(jit_int_regs)/sizeof(jit_int_regs[0]);
+const int NUM_JIT_REAL_REGS=sizeof(jit_real_regs)/sizeof(jit_real_regs[0]);
+
+// A statement in pre-order, the order code is generated in
+struct JitStmtInfo
+{
+    int parent;             // enclosing if or repeat, -1 at the top level
+    int branch;             // 0: then part or repeat body, 1: else part
+    int last;               // last statement nested in it
+    int depth;              // number of enclosing statements
+    bool repeat;
+};
+
+struct JitRegAlloc
+{
+    int num_vars;
+    int* reg;               // register of each memloc, JIT_NO_REG if it stays in the frame
+    ExprDataType* types;
+    int* first_load;        // per statement: variables loaded before it (linked by next_load) ...
+    int* next_load;
+    int* first_store;       // ... and stored after it
+    int* next_store;
+    int* loaded;            // variables in their registers at this point of code generation
+    int num_loaded;
+    int cur_stmt;           // statement being generated
+    int saved_regs[4];      // callee-saved registers in use, pushed by the prologue
+    int num_saved;
+    int num_reg_vars;
+
+    JitRegAlloc() {reg=next_load=next_store=first_load=first_store=loaded=0; types=0;}
+    ~JitRegAlloc()
+    {
+        if(reg) delete[] reg;
+        if(types) delete[] types;
+        if(first_load) delete[] first_load;
+        if(next_load) delete[] next_load;
+        if(first_store) delete[] first_store;
+        if(next_store) delete[] next_store;
+        if(loaded) delete[] loaded;
+    }
+};
+
+// Code generation state for one program
+// Register use: rbx points to the variable frame (one VMValue per memloc), an int
+// result is computed in eax and a real in xmm0, the second operand of a binary
+// operator goes in ecx or xmm1, operands that need evaluating are saved on the stack
+// Allocated variables use r8-r15 and xmm3-xmm15
+struct JitCompiler
+{
+    X86Emitter x;
+    SymbolTable* symbol_table;
+    int exit_label;         // epilogue, eax holds the status
+    int div_zero_label;     // returns status 1
+    ElfRuntime* runtime;    // if set, read and write call this runtime instead of the compiler's
+    JitRegAlloc* alloc;     // if set, variables live in registers, see AllocateJitRegs()
+
+    JitCompiler() {runtime=0; alloc=0;}
+};
+
+int JitMemloc(JitCompiler* jc, TreeNode* node) {return jc->symbol_table->Find(node->id)->memloc;}
+
+// Numbers the statements of a list in pre-order, returns the number after the last
+int JitNumberStmts(TreeNode* node, int parent, int branch, int depth, JitStmtInfo* info, TreeNode** stmts, int n)
+{
+    for(;node;node=node->sibling)
+    {
+        int id=n++;
+        info[id].parent=parent;
+        info[id].branch=branch;
+        info[id].depth=depth;
+        info[id].repeat=node->node_kind==REPEAT_NODE;
+        stmts[id]=node;
+        if(node->node_kind==IF_NODE)
+        {
+            n=JitNumberStmts(node->child[1], id, 0, depth+1, info, stmts, n);
+            n=JitNumberStmts(node->child[2], id, 1, depth+1, info, stmts, n);
+        }
+        else if(node->node_kind==REPEAT_NODE) n=JitNumberStmts(node->child[0], id, 0, depth+1, info, stmts, n);
+        info[id].last=n-1;
+    }
+    return n;
+}
+
+int JitCountStmts(TreeNode* node)
+{
+    int n=0;
+    for(;node;node=node->sibling)
+    {
+        n++;
+        if(node->node_kind==IF_NODE) n+=JitCountStmts(node->child[1])+JitCountStmts(node->child[2]);
+        else if(node->node_kind==REPEAT_NODE) n+=JitCountStmts(node->child[0]);
+    }
+    return n;
+}
+
+// Widens the range lo..hi (statements of one list) so that it also covers statement s
+void JitCoverStmt(JitStmtInfo* info, int* lo, int* hi, int s)
+{
+    if(*lo<0) {*lo=*hi=s; return;}
+
+    int a=*lo, b=*hi;
+    while(info[s].depth>info[a].depth) s=info[s].parent;
+    while(info[a].depth>info[s].depth) a=b=info[a].parent;
+    while(info[a].parent!=info[s].parent || info[a].branch!=info[s].branch) {a=b=info[a].parent; s=info[s].parent;}
+
+    *lo=a<s ? a : s;
+    *hi=b>s ? b : s;
+}
+
+// Records the variables an expression uses at statement s
+void JitUseExpr(TreeNode* node, JitCompiler* jc, JitStmtInfo* info, int s, int weight, int* lo, int* hi, int* uses)
+{
+    int i;
+    if(node->node_kind==ID_NODE)
+    {
+        int v=JitMemloc(jc, node);
+        JitCoverStmt(info, &lo[v], &hi[v], s);
+        uses[v]+=weight;
+    }
+    for(i=0;i<MAX_CHILDREN;i++) if(node->child[i]) JitUseExpr(node->child[i], jc, info, s, weight, lo, hi, uses);
+}
+
+// Computes the live range of every variable and assigns registers by linear scan
+void AllocateJitRegs(JitCompiler* jc, TreeNode* syntax_tree)
+{
+    int i, j, k, v;
+    JitRegAlloc* ra=jc->alloc;
+    int n=ra->num_vars=jc->symbol_table->num_vars;
+    int num_stmts=JitCountStmts(syntax_tree);
+
+    JitStmtInfo* info=new JitStmtInfo[num_stmts+1];
+    TreeNode** stmts=new TreeNode*[num_stmts+1];
+    JitNumberStmts(syntax_tree, -1, 0, 0, info, stmts, 0);
+
+    VariableLayout vars;
+    vars.Set(jc->symbol_table);
+    ra->types=new ExprDataType[n+1];
+    for(v=0;v<n;v++) ra->types[v]=vars.types[v];
+
+    int* lo=new int[n+1];
+    int* hi=new int[n+1];
+    int* uses=new int[n+1];
+    for(v=0;v<n;v++) {lo[v]=hi[v]=-1; uses[v]=0;}
+
+    for(i=0;i<num_stmts;i++)
+    {
+        TreeNode* node=stmts[i];
+        int loops=0;
+        for(j=i;j>=0;j=info[j].parent) if(info[j].repeat) loops++;
+        int weight=1;
+        for(j=0;j<loops && j<JIT_MAX_LOOP_WEIGHT;j++) weight*=8;
+
+        if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE || node->node_kind==READ_NODE)
+        {
+            v=jc->symbol_table->Find(node->id)->memloc;
+            JitCoverStmt(info, &lo[v], &hi[v], i);
+            uses[v]+=weight;
+        }
+        TreeNode* expr=node->node_kind==IF_NODE || node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE ||
+                       node->node_kind==WRITE_NODE ? node->child[0] : node->node_kind==REPEAT_NODE ? node->child[1] : 0;
+        if(expr) JitUseExpr(expr, jc, info, i, weight, lo, hi, uses);
+    }
+
+    // A range inside a loop covers the outermost one
+    for(v=0;v<n;v++)
+    {
+        if(lo[v]<0) continue;
+        for(j=info[lo[v]].parent;j>=0;j=info[j].parent) if(info[j].repeat) lo[v]=hi[v]=j;
+    }
+
+    // Linear scan, in order of range start
+    int* order=new int[n+1];
+    int num_order=0;
+    for(v=0;v<n;v++)
+    {
+        if(lo[v]<0) continue;
+        for(j=num_order;j>0 && lo[order[j-1]]>lo[v];j--) order[j]=order[j-1];
+        order[j]=v;
+        num_order++;
+    }
+
+    ra->reg=new int[n+1];
+    for(v=0;v<n;v++) ra->reg[v]=JIT_NO_REG;
+    int* active=new int[n+1];
+    int num_active=0;
+    bool used_callee[16];
+    for(k=0;k<16;k++) used_callee[k]=false;
+
+    for(i=0;i<num_order;i++)
+    {
+        v=order[i];
+        bool real=ra->types[v]==REAL;
+        const int* pool=real ? jit_real_regs : jit_int_regs;
+        int pool_size=real ? NUM_JIT_REAL_REGS : NUM_JIT_INT_REGS;
+
+        // Ranges that ended free their registers
+        for(j=0;j<num_active;)
+            if(info[hi[active[j]]].last<lo[v]) active[j]=active[--num_active];
+            else j++;
+
+        int r=JIT_NO_REG;
+        for(k=0;k<pool_size && r==JIT_NO_REG;k++)
+        {
+            r=pool[k];
+            for(j=0;j<num_active;j++)
+                if((ra->types[active[j]]==REAL)==real && ra->reg[active[j]]==r) {r=JIT_NO_REG; break;}
+        }
+
+        // Out of registers: the least used of the overlapping ranges stays in the frame
+        if(r==JIT_NO_REG)
+        {
+            int spill=-1;
+            for(j=0;j<num_active;j++)
+                if((ra->types[active[j]]==REAL)==real && (spill<0 || uses[active[j]]<uses[active[spill]])) spill=j;
+            if(spill<0 || uses[active[spill]]>=uses[v]) continue;
+            r=ra->reg[active[spill]];
+            ra->reg[active[spill]]=JIT_NO_REG;
+            active[spill]=active[--num_active];
+        }
+
+        ra->reg[v]=r;
+        active[num_active++]=v;
+    }
+
+    // Loads and stores at the ends of the ranges
+    ra->first_load=new int[num_stmts+1];
+    ra->first_store=new int[num_stmts+1];
+    ra->next_load=new int[n+1];
+    ra->next_store=new int[n+1];
+    ra->loaded=new int[n+1];
+    ra->num_loaded=0;
+    ra->cur_stmt=0;
+    ra->num_reg_vars=0;
+    for(i=0;i<num_stmts;i++) ra->first_load[i]=ra->first_store[i]=-1;
+    for(v=0;v<n;v++)
+    {
+        if(ra->reg[v]==JIT_NO_REG) continue;
+        ra->num_reg_vars++;
+        if(ra->types[v]!=REAL && ra->reg[v]>=12) used_callee[ra->reg[v]]=true;
+        ra->next_load[v]=ra->first_load[lo[v]];
+        ra->first_load[lo[v]]=v;
+        ra->next_store[v]=ra->first_store[hi[v]];
+        ra->first_store[hi[v]]=v;
+    }
+    ra->num_saved=0;
+    for(k=12;k<16;k++) if(used_callee[k]) ra->saved_regs[ra->num_saved++]=k;
+
+    delete[] info;
+    delete[] stmts;
+    delete[] lo;
+    delete[] hi;
+    delete[] uses;
+    delete[] order;
+    delete[] active;
+}
+
+// Register of the variable an ID_NODE refers to, JIT_NO_REG if it is in the frame
+int JitVarReg(JitCompiler* jc, TreeNode* node)
+{
+    if(!jc->alloc || node->node_kind!=ID_NODE) return JIT_NO_REG;
+    return jc->alloc->reg[JitMemloc(jc, node)];
+}
+
+// REX prefix for registers r (ModRM.reg) and b (ModRM.rm), omitted if not needed
+void JitRex(X86Emitter* x, int r, int b)
+{
+    int rex=0x40|((r&8) ? 4 : 0)|((b&8) ? 1 : 0);
+    if(rex!=0x40) x->Byte(rex);
+}
+
+void JitModRM(X86Emitter* x, int mod, int r, int b) {x->Byte((mod<<6)|((r&7)<<3)|(b&7));}
+
+// mov dst, src (32-bit)
+void JitMovReg(X86Emitter* x, int dst, int src) {JitRex(x, src, dst); x->Byte(0x89); JitModRM(x, 3, src, dst);}
+
+// movapd xmm_dst, xmm_src
+void JitMovXmm(X86Emitter* x, int dst, int src) {x->Byte(0x66); JitRex(x, dst, src); x->Bytes("\x0F\x28", 2); JitModRM(x, 3, dst, src);}
+
+// Moves variable memloc between its register and the frame
+void JitFrameVar(JitCompiler* jc, int memloc, bool store)
+{
+    X86Emitter* x=&jc->x;
+    int r=jc->alloc->reg[memloc];
+    if(jc->alloc->types[memloc]==REAL)
+    {
+        x->Byte(0xF2); JitRex(x, r, 0); x->Byte(0x0F); x->Byte(store ? 0x11 : 0x10);    // movsd
+    }
+    else {JitRex(x, r, 0); x->Byte(store ? 0x89 : 0x8B);}                               // mov
+    JitModRM(x, 2, r, 3);                                                               // [rbx+d]
+    x->Int32(JIT_FRAME_DISP(memloc));
+}
+
+bool JitCallerSaved(JitRegAlloc* ra, int memloc) {return ra->types[memloc]==REAL || ra->reg[memloc]<12;}
+
+// Stores (or reloads after the call) the variables held in caller-saved registers
+void JitAroundCall(JitCompiler* jc, bool after)
+{
+    int i;
+    JitRegAlloc* ra=jc->alloc;
+    if(!ra) return;
+    for(i=0;i<ra->num_loaded;i++)
+        if(JitCallerSaved(ra, ra->loaded[i])) JitFrameVar(jc, ra->loaded[i], !after);
+}
+
+// Loads the variables whose range starts at the next statement, returns its number
+int JitEnterStmt(JitCompiler* jc)
+{
+    JitRegAlloc* ra=jc->alloc;
+    int id=ra->cur_stmt++, v;
+    for(v=ra->first_load[id];v>=0;v=ra->next_load[v])
+    {
+        JitFrameVar(jc, v, false);
+        ra->loaded[ra->num_loaded++]=v;
+    }
+    return id;
+}
+
+// Stores the variables whose range ends with statement id
+void JitLeaveStmt(JitCompiler* jc, int id)
+{
+    int i, v;
+    JitRegAlloc* ra=jc->alloc;
+    for(v=ra->first_store[id];v>=0;v=ra->next_store[v])
+    {
+        JitFrameVar(jc, v, true);
+        for(i=0;i<ra->num_loaded;i++) if(ra->loaded[i]==v) {ra->loaded[i]=ra->loaded[--ra->num_loaded]; break;}
+    }
+}
+
+void JitLoadRealConst(X86Emitter* x, double v, int xmm)
+{
+    long long bits;
+    memcpy(&bits, &v, sizeof(bits));
+    x->Bytes("\x48\xB8", 2); x->Int64(bits);                // mov rax, imm64
+    x->Bytes("\x66\x48\x0F\x6E", 4); x->Byte(0xC0|(xmm<<3)); // movq xmmN, rax
+}
+
+// Converts the accumulator from type from to type to (int and bool share eax)
+void JitConvert(X86Emitter* x, ExprDataType from, ExprDataType to)
+{
+    if(from==REAL && to!=REAL) x->Bytes("\xF2\x0F\x2C\xC0", 4);     // cvttsd2si eax, xmm0
+    else if(from!=REAL && to==REAL) x->Bytes("\xF2\x0F\x2A\xC0", 4);// cvtsi2sd xmm0, eax
+}
+
+void JitExpr(JitCompiler* jc, TreeNode* node, ExprDataType type);
+
+// Loads a constant or variable as type into the second operand register (ecx or xmm1)
+void JitLeafOperand(JitCompiler* jc, TreeNode* node, ExprDataType type)
+{
+    X86Emitter* x=&jc->x;
+    ExprDataType own=node->expr_data_type;
+    int r=JitVarReg(jc, node);
+
+    if(own==REAL && type==REAL)
+    {
+        if(node->node_kind==NUM_NODE) JitLoadRealConst(x, node->real_num, 1);
+        else if(r!=JIT_NO_REG) JitMovXmm(x, 1, r);
+        else {x->Bytes("\xF2\x0F\x10\x8B", 4); x->Int32(JIT_FRAME_DISP(JitMemloc(jc, node)));}   // movsd xmm1, [rbx+d]
+        return;
+    }
+    if(own==REAL)
+    {
+        // real exponent of ^, truncated to an int
+        if(node->node_kind==NUM_NODE) {x->Byte(0xB9); x->Int32((int)node->real_num);}         // mov ecx, imm32
+        else if(r!=JIT_NO_REG) {x->Byte(0xF2); JitRex(x, 1, r); x->Bytes("\x0F\x2C", 2); JitModRM(x, 3, 1, r);} // cvttsd2si ecx, xmmN
+        else
+        {
+            x->Bytes("\xF2\x0F\x10\x8B", 4); x->Int32(JIT_FRAME_DISP(JitMemloc(jc, node))); // movsd xmm1, [rbx+d]
+            x->Bytes("\xF2\x0F\x2C\xC9", 4);                                                 // cvttsd2si ecx, xmm1
+        }
+        return;
+    }
+
+    if(node->node_kind==NUM_NODE) {x->Byte(0xB9); x->Int32(node->num);}                       // mov ecx, imm32
+    else if(r!=JIT_NO_REG) JitMovReg(x, 1, r);
+    else {x->Bytes("\x8B\x8B", 2); x->Int32(JIT_FRAME_DISP(JitMemloc(jc, node)));}             // mov ecx, [rbx+d]
+    if(type==REAL) x->Bytes("\xF2\x0F\x2A\xC9", 4);                                            // cvtsi2sd xmm1, ecx
+}
+
+// Leaves the left operand in eax/xmm0 and the right one in ecx/xmm1, each converted
+// to the type the operator works on (the exponent of ^ is always an int)
+// The right operand is computed first, operands have no side effects other than
+// stopping on a division by zero, which reports the same error either way
+void JitOperands(JitCompiler* jc, TreeNode* node)
+{
+    X86Emitter* x=&jc->x;
+    ExprDataType left_type=OperType(node);
+    ExprDataType right_type=(node->oper==POWER) ? INTEGER : left_type;
+    TreeNode* right=node->child[1];
+
+    if(right->node_kind==NUM_NODE || right->node_kind==ID_NODE)
+    {
+        JitExpr(jc, node->child[0], left_type);
+        JitLeafOperand(jc, right, right_type);
+        return;
+    }
+
+    JitExpr(jc, right, right_type);
+    if(right_type==REAL) x->Bytes("\x48\x83\xEC\x08\xF2\x0F\x11\x04\x24", 9);    // sub rsp, 8; movsd [rsp], xmm0
+    else x->Byte(0x50);                                                           // push rax
+    JitExpr(jc, node->child[0], left_type);
+    if(right_type==REAL) x->Bytes("\xF2\x0F\x10\x0C\x24\x48\x83\xC4\x08", 9);    // movsd xmm1, [rsp]; add rsp, 8
+    else x->Byte(0x59);                                                           // pop rcx
+}
+
+// Integer ^ with the semantics of Power(): eax = eax ^ ecx
+// unchecked: the exponent is known not to be negative
+void JitPowerInt(X86Emitter* x, bool unchecked)
+{
+    int done=x->NewLabel(), negative=x->NewLabel(), loop=x->NewLabel();
+    x->Bytes("\x85\xC0", 2); x->Jcc(CC_E, done);           // test eax, eax; 0 ^ b = 0
+    x->Bytes("\x89\xC2", 2);                                // mov edx, eax
+    x->Byte(0xB8); x->Int32(1);                             // mov eax, 1
+    if(!unchecked) {x->Bytes("\x85\xC9", 2); x->Jcc(CC_L, negative);}       // test ecx, ecx
+    x->Bind(loop);
+    x->Bytes("\x85\xC9", 2); x->Jcc(CC_E, done);           // test ecx, ecx
+    x->Bytes("\x0F\xAF\xC2", 3);                            // imul eax, edx
+    x->Bytes("\xFF\xC9", 2);                                // dec ecx
+    x->Jmp(loop);
+    x->Bind(negative);
+    x->Bytes("\x31\xC0", 2);                                // xor eax, eax
+    x->Bind(done);
+}
+
+// Real ^ with the semantics of RealPower(): xmm0 = xmm0 ^ ecx
+void JitPowerReal(X86Emitter* x, bool unchecked)
+{
+    int done=x->NewLabel(), zero=x->NewLabel(), one=x->NewLabel(), not_zero=x->NewLabel(), loop=x->NewLabel();
+    x->Bytes("\x66\x0F\x57\xD2", 4);                        // xorpd xmm2, xmm2
+    x->Bytes("\x66\x0F\x2E\xC2", 4);                        // ucomisd xmm0, xmm2
+    x->Jcc(CC_P, not_zero);
+    x->Jcc(CC_E, zero);                                     // 0.0 ^ b = 0.0
+    x->Bind(not_zero);
+    x->Bytes("\x85\xC9", 2);                                // test ecx, ecx
+    x->Jcc(CC_E, one);
+    if(!unchecked) x->Jcc(CC_L, zero);
+    x->Bytes("\x66\x0F\x28\xC8", 4);                        // movapd xmm1, xmm0
+    JitLoadRealConst(x, 1.0, 0);
+    x->Bind(loop);
+    x->Bytes("\xF2\x0F\x59\xC1", 4);                        // mulsd xmm0, xmm1
+    x->Bytes("\xFF\xC9", 2);                                // dec ecx
+    x->Jcc(CC_NE, loop);
+    x->Jmp(done);
+    x->Bind(one);
+    JitLoadRealConst(x, 1.0, 0);
+    x->Jmp(done);
+    x->Bind(zero);
+    x->Bytes("\x66\x0F\x57\xC0", 4);                        // xorpd xmm0, xmm0
+    x->Bind(done);
+}
+
+// Flags for comparing the operands: ints with cmp eax, ecx, reals with ucomisd so
+// that the unsigned condition codes apply (operands are swapped for < and <=, where
+// a < b is tested as b above a, which is false when either is a NaN)
+// Returns the condition code that holds when the comparison is true
+int JitCompare(X86Emitter* x, TokenType oper, ExprDataType type)
+{
+    if(type!=REAL)
+    {
+        x->Bytes("\x39\xC8", 2);                            // cmp eax, ecx
+        switch(oper)
+        {
+            case EQUAL: return CC_E;
+            case LESS_THAN: return CC_L;
+            case GREATER_THAN: return CC_G;
+            case GREATER_EQUAL: return CC_GE;
+            default: return CC_LE;
+        }
+    }
+    if(oper==LESS_THAN || oper==LESS_EQUAL) x->Bytes("\x66\x0F\x2E\xC8", 4);   // ucomisd xmm1, xmm0
+    else x->Bytes("\x66\x0F\x2E\xC1", 4);                                       // ucomisd xmm0, xmm1
+    switch(oper)
+    {
+        case EQUAL: return CC_E;                    // also needs PF clear (not unordered)
+        case LESS_THAN: case GREATER_THAN: return CC_A;
+        default: return CC_AE;
+    }
+}
+
+// Emits code leaving the value of the expression, converted to type, in eax or xmm0
+void JitExpr(JitCompiler* jc, TreeNode* node, ExprDataType type)
+{
+    X86Emitter* x=&jc->x;
+    ExprDataType own=node->expr_data_type;
+
+    if(node->node_kind==NUM_NODE)
+    {
+        if(own==REAL) JitLoadRealConst(x, node->real_num, 0);
+        else {x->Byte(0xB8); x->Int32(node->num);}                                       // mov eax, imm32
+        JitConvert(x, own, type);
+        return;
+    }
+
+    if(node->node_kind==ID_NODE)
+    {
+        int r=JitVarReg(jc, node);
+        if(r!=JIT_NO_REG)
+        {
+            if(own==REAL) JitMovXmm(x, 0, r);
+            else JitMovReg(x, 0, r);
+        }
+        else
+        {
+            if(own==REAL) x->Bytes("\xF2\x0F\x10\x83", 4);                                // movsd xmm0, [rbx+d]
+            else x->Bytes("\x8B\x83", 2);                                                 // mov eax, [rbx+d]
+            x->Int32(JIT_FRAME_DISP(JitMemloc(jc, node)));
+        }
+        JitConvert(x, own, type);
+        return;
+    }
+
+    ExprDataType op_type=OperType(node);
+    JitOperands(jc, node);
+
+    if(IsComparison(node->oper))
+    {
+        int cc=JitCompare(x, node->oper, op_type);
+        x->Bytes("\x0F", 1); x->Byte(0x90|cc); x->Byte(0xC0);                             // setcc al
+        if(op_type==REAL && node->oper==EQUAL) x->Bytes("\x0F\x9B\xC1\x20\xC8", 5);      // setnp cl; and al, cl
+        x->Bytes("\x0F\xB6\xC0", 3);                                                      // movzx eax, al
+        JitConvert(x, BOOLEAN, type);
+        return;
+    }
+
+    if(op_type==REAL)
+    {
+        switch(node->oper)
+        {
+            case PLUS: x->Bytes("\xF2\x0F\x58\xC1", 4); break;                             // addsd xmm0, xmm1
+            case MINUS: x->Bytes("\xF2\x0F\x5C\xC1", 4); break;                            // subsd xmm0, xmm1
+            case TIMES: x->Bytes("\xF2\x0F\x59\xC1", 4); break;                            // mulsd xmm0, xmm1
+            case DIVIDE:
+            {
+                int ok=x->NewLabel();
+                if(!node->unchecked)
+                {
+                    x->Bytes("\x66\x0F\x57\xD2\x66\x0F\x2E\xCA", 8);                       // xorpd xmm2, xmm2; ucomisd xmm1, xmm2
+                    x->Jcc(CC_P, ok);
+                    x->Jcc(CC_E, jc->div_zero_label);
+                }
+                x->Bind(ok);
+                x->Bytes("\xF2\x0F\x5E\xC1", 4);                                           // divsd xmm0, xmm1
+                break;
+            }
+            case POWER: JitPowerReal(x, node->unchecked); break;
+            case AND_OP: x->Bytes("\xF2\x0F\x59\xC0\xF2\x0F\x59\xC9\xF2\x0F\x5C\xC1", 12); break; // a*a - b*b
+            default: throw 0;
+        }
+    }
+    else
+    {
+        switch(node->oper)
+        {
+            case PLUS: x->Bytes("\x01\xC8", 2); break;                                     // add eax, ecx
+            case MINUS: x->Bytes("\x29\xC8", 2); break;                                    // sub eax, ecx
+            case TIMES: x->Bytes("\x0F\xAF\xC1", 3); break;                                // imul eax, ecx
+            case DIVIDE:
+                if(!node->unchecked) {x->Bytes("\x85\xC9", 2); x->Jcc(CC_E, jc->div_zero_label);} // test ecx, ecx
+                x->Bytes("\x99\xF7\xF9", 3);                                               // cdq; idiv ecx
+                break;
+            case POWER: JitPowerInt(x, node->unchecked); break;
+            case AND_OP: x->Bytes("\x0F\xAF\xC0\x0F\xAF\xC9\x29\xC8", 8); break;           // a*a - b*b
+            default: throw 0;
+        }
+    }
+    JitConvert(x, op_type, type);
+}
+
+// Emits a jump to label taken when the condition is false
+void JitJumpIfFalse(JitCompiler* jc, TreeNode* cond, int label)
+{
+    X86Emitter* x=&jc->x;
+
+    if(cond->node_kind==OPER_NODE && IsComparison(cond->oper))
+    {
+        ExprDataType op_type=OperType(cond);
+        JitOperands(jc, cond);
+        int cc=JitCompare(x, cond->oper, op_type);
+        if(op_type==REAL && cond->oper==EQUAL) x->Jcc(CC_P, label);   // unordered is not equal
+        x->Jcc(cc^1, label);                                            // cc^1 is the negated condition
+        return;
+    }
+
+    JitExpr(jc, cond, BOOLEAN);
+    x->Bytes("\x85\xC0", 2);                                            // test eax, eax
+    x->Jcc(CC_E, label);
+}
+
+// Calls a runtime function, the stack is 16-byte aligned between statements
+void JitCall(X86Emitter* x, void* fn)
+{
+    x->Bytes("\x48\xB8", 2); x->Int64((long long)fn);                  // mov rax, imm64
+    x->Bytes("\xFF\xD0", 2);                                            // call rax
+}
+
+void JitStmtSeq(JitCompiler* jc, TreeNode* node);
+
+void JitStmt(JitCompiler* jc, TreeNode* node)
+{
+    X86Emitter* x=&jc->x;
+    int id=jc->alloc ? JitEnterStmt(jc) : -1;
+
+    if(node->node_kind==IF_NODE)
+    {
+        int else_label=x->NewLabel(), end_label=x->NewLabel();
+        JitJumpIfFalse(jc, node->child[0], else_label);
+        JitStmtSeq(jc, node->child[1]);
+        if(node->child[2]) x->Jmp(end_label);
+        x->Bind(else_label);
+        JitStmtSeq(jc, node->child[2]);
+        x->Bind(end_label);
+    }
+    else if(node->node_kind==REPEAT_NODE)
+    {
+        int loop_label=x->NewLabel();
+        x->Bind(loop_label);
+        JitStmtSeq(jc, node->child[0]);
+        JitJumpIfFalse(jc, node->child[1], loop_label);
+    }
+    else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+    {
+        VariableInfo* var=jc->symbol_table->Find(node->id);
+        if(node->child[0]) JitExpr(jc, node->child[0], var->var_type);
+        else if(var->var_type==REAL) x->Bytes("\x66\x0F\x57\xC0", 4);              // xorpd xmm0, xmm0
+        else x->Bytes("\x31\xC0", 2);                                               // xor eax, eax
+        int r=jc->alloc ? jc->alloc->reg[var->memloc] : JIT_NO_REG;
+        if(r!=JIT_NO_REG)
+        {
+            if(var->var_type==REAL) JitMovXmm(x, r, 0);
+            else JitMovReg(x, r, 0);
+        }
+        else
+        {
+            if(var->var_type==REAL) x->Bytes("\xF2\x0F\x11\x83", 4);                // movsd [rbx+d], xmm0
+            else x->Bytes("\x89\x83", 2);                                           // mov [rbx+d], eax
+            x->Int32(JIT_FRAME_DISP(var->memloc));
+        }
+    }
+    else if(node->node_kind==READ_NODE)
+    {
+        VariableInfo* var=jc->symbol_table->Find(node->id);
+        JitAroundCall(jc, false);
+        if(jc->runtime) {x->Byte(0xBF); x->Int32(jc->runtime->prompts[var->memloc]);} // mov edi, prompt
+        else {x->Bytes("\x48\xBF", 2); x->Int64((long long)var->name);}              // mov rdi, name
+        x->Byte(0xBE); x->Int32(var->var_type);                                     // mov esi, type
+        x->Bytes("\x48\x8D\x93", 3); x->Int32(JIT_FRAME_DISP(var->memloc));        // lea rdx, [rbx+d]
+        if(jc->runtime) x->Call(jc->runtime->read);
+        else JitCall(x, (void*)ReadValue);
+        JitAroundCall(jc, true);
+        if(jc->alloc && jc->alloc->reg[var->memloc]!=JIT_NO_REG && !JitCallerSaved(jc->alloc, var->memloc))
+            JitFrameVar(jc, var->memloc, false);
+    }
+    else if(node->node_kind==WRITE_NODE)
+    {
+        ExprDataType type=node->child[0]->expr_data_type;
+        JitExpr(jc, node->child[0], type);
+        JitAroundCall(jc, false);
+        if(type!=REAL) x->Bytes("\x89\xC7", 2);                                     // mov edi, eax
+        if(jc->runtime) x->Call(type==REAL ? jc->runtime->write_real : type==BOOLEAN ? jc->runtime->write_bool : jc->runtime->write_int);
+        else JitCall(x, type==REAL ? (void*)WriteReal : type==BOOLEAN ? (void*)WriteBool : (void*)WriteInt);
+        JitAroundCall(jc, true);
+    }
+
+    if(jc->alloc) JitLeaveStmt(jc, id);
+}
+
+void JitStmtSeq(JitCompiler* jc, TreeNode* node)
+{
+    for(;node;node=node->sibling) JitStmt(jc, node);
+}
+
+// Starts a function int f(VMValue* frame), the frame is addressed through rbx
+void JitPrologue(JitCompiler* jc, SymbolTable* symbol_table)
+{
+    X86Emitter* x=&jc->x;
+    jc->symbol_table=symbol_table;
+    jc->exit_label=x->NewLabel();
+    jc->div_zero_label=x->NewLabel();
+
+    int i, saved=jc->alloc ? jc->alloc->num_saved : 0;
+    x->Bytes("\x55\x48\x89\xE5\x53", 5);                    // push rbp; mov rbp, rsp; push rbx
+    for(i=0;i<saved;i++) {x->Byte(0x41); x->Byte(0x50+(jc->alloc->saved_regs[i]&7));}  // push r12-r15
+    if(saved%2==0) x->Bytes("\x48\x83\xEC\x08", 4);          // sub rsp, 8 (keeps rsp 16-byte aligned)
+    x->Bytes("\x48\x89\xFB", 3);                            // mov rbx, rdi
+}
+
+// Ends the function, code jumps to exit_label with the result in eax
+void JitEpilogue(JitCompiler* jc)
+{
+    X86Emitter* x=&jc->x;
+    x->Bind(jc->div_zero_label);
+    x->Byte(0xB8); x->Int32(1);                             // mov eax, 1
+    x->Bind(jc->exit_label);
+    int i, saved=jc->alloc ? jc->alloc->num_saved : 0;
+    x->Bytes("\x48\x8D\x65", 3); x->Byte(-8*(saved+1)&0xFF);   // lea rsp, [rbp-8-8*saved]
+    for(i=saved-1;i>=0;i--) {x->Byte(0x41); x->Byte(0x58+(jc->alloc->saved_regs[i]&7));}  // pop r12-r15
+    x->Bytes("\x5B\x5D\xC3", 3);                            // pop rbx; pop rbp; ret
+
+    x->PatchJumps();
+}
+
+// Generates int program(VMValue* frame), returning 0 or 1 after a division by zero
+// Variables are allocated registers unless jc->alloc is 0
+void GenerateJit(JitCompiler* jc, TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    X86Emitter* x=&jc->x;
+    jc->symbol_table=symbol_table;
+    if(jc->alloc) AllocateJitRegs(jc, syntax_tree);
+    JitPrologue(jc, symbol_table);
+    JitStmtSeq(jc, syntax_tree);
+    x->Bytes("\x31\xC0", 2);                                // xor eax, eax
+    x->Jmp(jc->exit_label);
+    JitEpilogue(jc);
+}
+
+#ifdef TINY_JIT
+
+typedef int (*JitFunction)(VMValue* frame);
+
+// Copies code into a fresh mapping that is made executable (and no longer writable)
+// Returns 0 if the system refuses
+void* MapExecutable(unsigned char* code, int size)
+{
+    void* mem=mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(mem==MAP_FAILED) return 0;
+    memcpy(mem, code, size);
+    if(mprotect(mem, size, PROT_READ|PROT_EXEC)!=0) {munmap(mem, size); return 0;}
+    return mem;
+}
+
+#endif
+
+void RunRegVM(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options);
+
+// Compiles the program to machine code and runs it, falls back to the register
+// machine where the JIT is not available
+void RunJIT(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+#ifdef TINY_JIT
+    int i;
+    JitCompiler jc;
+    JitRegAlloc alloc;
+    jc.alloc=&alloc;
+    GenerateJit(&jc, syntax_tree, symbol_table);
+
+    void* code=MapExecutable(jc.x.buf, jc.x.size);
+    if(code)
+    {
+        VMValue* frame=new VMValue[symbol_table->num_vars+1];
+        for(i=0;i<symbol_table->num_vars;i++) frame[i].r=0.0;
+
+        int status=((JitFunction)code)(frame);
+
+        munmap(code, jc.x.size);
+        delete[] frame;
+        if(options->stats) fprintf(stderr, "[Engine=jit][CodeBytes=%d][RegisterVars=%d]\n", jc.x.size, alloc.num_reg_vars);
+        if(status) DivisionByZero();
+        return;
+    }
+#endif
+    fprintf(stderr, "Note: the JIT is not available, running the program on the register machine\n");
+    RunRegVM(syntax_tree, symbol_table, options);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Tiered Execution ////////////////////////////////////////////////////////////////
+
+// The program starts in the tree interpreter, which needs no compilation. Every
+// repeat loop counts its backedges, and once a loop has taken tier_threshold of them
+// it is compiled on its own (x86-64 code, or register code where the JIT is not
+// available). The run then continues in the compiled loop from the top of its next
+// iteration, with the interpreter's variables converted to the compiled frame and
+// back. Later runs of a promoted loop enter the compiled code directly.
+
+// A statement run by a trace, or the guard of an if (see Trace Recording)
+struct TraceStep
+{
+    TreeNode* node;
+    bool taken;             // for an if: the condition was true when recorded
+    TreeNode** path;        // for an if: the statements enclosing it from the loop body down,
+    int depth;              // ending with the if itself
+};
+
+struct TierLoop
+{
+    TreeNode* node;
+    int backedges;
+    RegProgram* reg_code;   // register code, when the JIT is not available
+    int exit_reg;           // register a trace stores its return code in
+    void* jit_code;
+    int jit_size;
+
+    bool traceable;         // innermost loop, its body has no repeat
+    TraceStep* steps;       // recorded trace
+    int num_steps, steps_cap;
+    int recordings;
+    int side_exits;         // since the trace was recorded
+
+    void Init(TreeNode* loop_node);
+
+    bool IsCompiled() {return reg_code || jit_code;}
+
+    void FreeCode()
+    {
+        if(reg_code) delete reg_code;
+#ifdef TINY_JIT
+        if(jit_code) munmap(jit_code, jit_size);
+#endif
+        reg_code=0; jit_code=0; jit_size=0;
+    }
+
+    void FreeTrace()
+    {
+        int i;
+        for(i=0;i<num_steps;i++) if(steps[i].path) delete[] steps[i].path;
+        if(steps) delete[] steps;
+        steps=0; num_steps=steps_cap=0;
+    }
+
+    TraceStep* AddStep(TreeNode* step_node)
+    {
+        Reserve(steps, steps_cap, num_steps+1);
+        TraceStep* step=&steps[num_steps++];
+        step->node=step_node; step->taken=false; step->path=0; step->depth=0;
+        return step;
+    }
+};
+
+struct TierState
+{
+    SymbolTable* symbol_table;
+    VariableLayout vars;
+    int threshold;
+    Dispatch dispatch;
+
+    TierLoop* loops;        // open addressing table of the loops run so far
+    int loops_cap, num_loops, num_promoted;
+    long long trace_entries, side_exits;
+
+    TierState(SymbolTable* st, int tier_threshold, Dispatch d)
+    {
+        int i;
+        symbol_table=st; vars.Set(st); threshold=tier_threshold; dispatch=d;
+        loops_cap=64; num_loops=num_promoted=0; trace_entries=side_exits=0;
+        loops=new TierLoop[loops_cap];
+        for(i=0;i<loops_cap;i++) loops[i].node=0;
+    }
+
+    ~TierState()
+    {
+        int i;
+        for(i=0;i<loops_cap;i++) if(loops[i].node) {loops[i].FreeCode(); loops[i].FreeTrace();}
+        delete[] loops;
+    }
+
+    TierLoop* Find(TreeNode* node)
+    {
+        unsigned int h=(unsigned int)(((unsigned long long)node>>4)*2654435761u)&(loops_cap-1);
+        while(loops[h].node && loops[h].node!=node) h=(h+1)&(loops_cap-1);
+        if(loops[h].node) return &loops[h];
+
+        if(2*(num_loops+1)>loops_cap) {Grow(); return Find(node);}
+        loops[h].Init(node);
+        num_loops++;
+        return &loops[h];
+    }
+
+    void Grow()
+    {
+        int i;
+        TierLoop* old=loops;
+        int old_cap=loops_cap;
+        loops_cap*=2; num_loops=0;
+        loops=new TierLoop[loops_cap];
+        for(i=0;i<loops_cap;i++) loops[i].node=0;
+        for(i=0;i<old_cap;i++) if(old[i].node) *Find(old[i].node)=old[i];
+        delete[] old;
+    }
+};
+
+// True if the statement list contains a repeat at any depth
+bool ContainsRepeat(TreeNode* node)
+{
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==REPEAT_NODE) return true;
+        if(node->node_kind==IF_NODE && (ContainsRepeat(node->child[1]) || ContainsRepeat(node->child[2]))) return true;
+    }
+    return false;
+}
+
+void TierLoop::Init(TreeNode* loop_node)
+{
+    node=loop_node; backedges=0;
+    reg_code=0; exit_reg=0; jit_code=0; jit_size=0;
+    traceable=!ContainsRepeat(loop_node->child[0]);
+    steps=0; num_steps=steps_cap=0; recordings=0; side_exits=0;
+}
+
+// Compiles a single loop statement, its siblings are detached meanwhile so the
+// generators stop after it
+void PromoteLoop(TierState* tier, TierLoop* loop)
+{
+    TreeNode* sibling=loop->node->sibling;
+    loop->node->sibling=0;
+
+#ifdef TINY_JIT
+    JitCompiler jc;
+    JitRegAlloc alloc;
+    jc.alloc=&alloc;
+    GenerateJit(&jc, loop->node, tier->symbol_table);
+    loop->jit_code=MapExecutable(jc.x.buf, jc.x.size);
+    loop->jit_size=jc.x.size;
+#endif
+    if(!loop->jit_code)
+    {
+        loop->reg_code=new RegProgram;
+        GenerateRegCode(loop->reg_code, loop->node, tier->symbol_table);
+    }
+
+    loop->node->sibling=sibling;
+    tier->num_promoted++;
+}
+
+// Converts the interpreter's variables to a compiled frame
+// A variable the interpreter has not assigned yet is VOID, which reads as 0
+void TypedToFrame(VariableLayout* vars, TypedValue* variables, VMValue* frame)
+{
+    int i;
+    for(i=0;i<vars->num_vars;i++)
+    {
+        if(vars->types[i]==REAL) frame[i].r=(variables[i].type==REAL) ? variables[i].real_val : 0.0;
+        else frame[i].i=variables[i].int_val;
+    }
+}
+
+void FrameToTyped(VariableLayout* vars, VMValue* frame, TypedValue* variables)
+{
+    int i;
+    for(i=0;i<vars->num_vars;i++)
+    {
+        if(vars->types[i]==REAL) variables[i]=TypedValue(frame[i].r);
+        else if(vars->types[i]==BOOLEAN) variables[i]=TypedValue(frame[i].i, true);
+        else variables[i]=TypedValue(frame[i].i);
+    }
+}
+
+// Runs a promoted loop from the top of an iteration on the interpreter's variables
+void RunPromotedLoop(TierState* tier, TierLoop* loop, TypedValue* variables)
+{
+    int num_slots=loop->reg_code ? loop->reg_code->num_regs : tier->vars.num_vars;
+    VMValue* slots=new VMValue[num_slots+1];
+    TypedToFrame(&tier->vars, variables, slots);
+
+    int status=0;
+    if(loop->reg_code) RunRegCode(loop->reg_code, slots, tier->dispatch);
+#ifdef TINY_JIT
+    else status=((JitFunction)loop->jit_code)(slots);
+#endif
+
+    FrameToTyped(&tier->vars, slots, variables);
+    delete[] slots;
+    if(status) DivisionByZero();
+}
+
+TierState* tiering=0;
+
+// Runs every repeat statement while tiering is set
+void RunTieredRepeat(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables)
+{
+    TierLoop* loop=tiering->Find(node);
+    if(loop->IsCompiled()) {RunPromotedLoop(tiering, loop, variables); return;}
+
+    while(true)
+    {
+        RunProgram(node->child[0], symbol_table, variables);
+        if(Evaluate(node->child[1], symbol_table, variables).bool_val) return;
+
+        // Looping back: the loop is hot once it has taken threshold backedges
+        // (found again, as the inner loops the body ran may have grown the table)
+        loop=tiering->Find(node);
+        if(++loop->backedges>=tiering->threshold) break;
+    }
+
+    // Finding the loop again as the inner loops it ran may have grown the table
+    PromoteLoop(tiering, tiering->Find(node));
+    RunPromotedLoop(tiering, tiering->Find(node), variables);
+}
+
+void RunTiered(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    TierState tier(symbol_table, options->tier_threshold, options->dispatch);
+    tiering=&tier;
+    repeat_hook=RunTieredRepeat;
+    RunProgram(syntax_tree, symbol_table);
+    repeat_hook=0;
+    tiering=0;
+
+    if(options->stats)
+    {
+#ifdef TINY_JIT
+        const char* tier_engine="jit";
+#else
+        const char* tier_engine="reg";
+#endif
+        fprintf(stderr, "[Engine=tiered][Threshold=%d][Loops=%d][Promoted=%d][Tier=%s]\n",
+                tier.threshold, tier.num_loops, tier.num_promoted, tier_engine);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Trace Recording /////////////////////////////////////////////////////////////////
+
+// With --engine=trace the interpreter records the path that one iteration of a hot
+// innermost repeat loop takes: the statements it runs and the direction of every if
+// on the way. The trace is compiled into straight-line code that loops over this
+// path only (x86-64, or register code where the JIT is not available). Every if on
+// it becomes a guard. When a guard fails, the trace side-exits: the interpreter takes
+// the other branch, finishes the iteration and enters the trace again at the next
+// one. A trace that has side-exited tier_threshold times is recorded again, as the
+// dominant path may have changed, up to MAX_TRACE_RECORDINGS times.
+
+#define MAX_TRACE_RECORDINGS 4
+
+// Values returned by a trace
+#define TRACE_DONE 0            // the loop condition became true
+#define TRACE_DIV_ZERO 1        // division by zero, only the JIT returns it
+#define TRACE_SIDE_EXIT 2       // the guard of step k failed: TRACE_SIDE_EXIT+k
+
+// Runs one statement in the interpreter without its siblings
+void RunSingleStatement(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables)
+{
+    TreeNode* sibling=node->sibling;
+    node->sibling=0;
+    RunProgram(node, symbol_table, variables);
+    node->sibling=sibling;
+}
+
+// Runs a statement list of the loop body in the interpreter and appends what runs to
+// the trace, path[0..depth-1] holds the statements enclosing the list
+void RecordStmtSeq(TierLoop* loop, TreeNode* node, SymbolTable* symbol_table, TypedValue* variables,
+                   TreeNode** path, int depth)
+{
+    int i;
+    for(;node;node=node->sibling)
+    {
+        path[depth]=node;
+        TraceStep* step=loop->AddStep(node);
+        if(node->node_kind==IF_NODE)
+        {
+            bool taken=Evaluate(node->child[0], symbol_table, variables).bool_val!=0;
+            step->taken=taken;
+            step->depth=depth+1;
+            step->path=new TreeNode*[depth+1];
+            for(i=0;i<=depth;i++) step->path[i]=path[i];
+            RecordStmtSeq(loop, taken ? node->child[1] : node->child[2], symbol_table, variables, path, depth+1);
+        }
+        else RunSingleStatement(node, symbol_table, variables);
+    }
+}
+
+// Finishes the iteration in the interpreter after the guard of step failed
+void ResumeSideExit(TraceStep* step, SymbolTable* symbol_table, TypedValue* variables)
+{
+    int i;
+    TreeNode* node=step->node;
+    RunProgram(step->taken ? node->child[2] : node->child[1], symbol_table, variables);
+    for(i=step->depth-1;i>=0;i--) RunProgram(step->path[i]->sibling, symbol_table, variables);
+}
+
+void CompileTraceJit(TierState* tier, TierLoop* loop)
+{
+#ifdef TINY_JIT
+    int i;
+    JitCompiler jc;
+    X86Emitter* x=&jc.x;
+    int* exit_labels=new int[loop->num_steps+1];
+
+    JitPrologue(&jc, tier->symbol_table);
+    int top_label=x->NewLabel();
+    x->Bind(top_label);
+    for(i=0;i<loop->num_steps;i++)
+    {
+        TraceStep* step=&loop->steps[i];
+        if(step->node->node_kind!=IF_NODE) {JitStmt(&jc, step->node); continue;}
+
+        exit_labels[i]=x->NewLabel();
+        if(step->taken) JitJumpIfFalse(&jc, step->node->child[0], exit_labels[i]);
+        else
+        {
+            int stay_label=x->NewLabel();
+            JitJumpIfFalse(&jc, step->node->child[0], stay_label);
+            x->Jmp(exit_labels[i]);
+            x->Bind(stay_label);
+        }
+    }
+    JitJumpIfFalse(&jc, loop->node->child[1], top_label);
+    x->Bytes("\x31\xC0", 2);                                // xor eax, eax (TRACE_DONE)
+    x->Jmp(jc.exit_label);
+
+    for(i=0;i<loop->num_steps;i++)
+    {
+        if(loop->steps[i].node->node_kind!=IF_NODE) continue;
+        x->Bind(exit_labels[i]);
+        x->Byte(0xB8); x->Int32(TRACE_SIDE_EXIT+i);         // mov eax, TRACE_SIDE_EXIT+i
+        x->Jmp(jc.exit_label);
+    }
+    JitEpilogue(&jc);
+    delete[] exit_labels;
+
+    loop->jit_code=MapExecutable(x->buf, x->size);
+    loop->jit_size=x->size;
+#else
+    (void)tier; (void)loop;
+#endif
+}
+
+void CompileTraceReg(TierState* tier, TierLoop* loop)
+{
+    int i;
+    RegProgram* prog=new RegProgram;
+    int* guards=new int[loop->num_steps+1];
+
+    prog->vars.Set(tier->symbol_table);
+    loop->exit_reg=prog->NewTemp();
+    for(i=0;i<loop->num_steps;i++)
+    {
+        TraceStep* step=&loop->steps[i];
+        if(step->node->node_kind==IF_NODE) guards[i]=GenerateRegBranch(prog, step->node->child[0], tier->symbol_table, !step->taken, 0);
+        else GenerateRegStmt(prog, step->node, tier->symbol_table);
+    }
+    GenerateRegBranch(prog, loop->node->child[1], tier->symbol_table, false, 0);
+    prog->Emit(RG_MOV, loop->exit_reg, prog->IntConst(TRACE_DONE));
+    prog->Emit(RG_HALT);
+
+    for(i=0;i<loop->num_steps;i++)
+    {
+        if(loop->steps[i].node->node_kind!=IF_NODE) continue;
+        SetRegTarget(prog, guards[i], prog->code_size);
+        prog->Emit(RG_MOV, loop->exit_reg, prog->IntConst(TRACE_SIDE_EXIT+i));
+        prog->Emit(RG_HALT);
+    }
+    FinishRegCode(prog);
+    delete[] guards;
+    loop->reg_code=prog;
+}
+
+// Runs one iteration in the interpreter while recording it, then compiles the trace
+void RecordTrace(TierState* tier, TierLoop* loop, TypedValue* variables)
+{
+    TreeNode** path=new TreeNode*[CountListNodes(loop->node->child[0])+1];
+    RecordStmtSeq(loop, loop->node->child[0], tier->symbol_table, variables, path, 0);
+    delete[] path;
+
+    CompileTraceJit(tier, loop);
+    if(!loop->jit_code) CompileTraceReg(tier, loop);
+    loop->recordings++;
+    loop->side_exits=0;
+    tier->num_promoted++;
+}
+
+// Runs the trace from the top of an iteration, returns TRACE_DONE or a side exit
+int RunTrace(TierState* tier, TierLoop* loop, TypedValue* variables)
+{
+    int num_slots=loop->reg_code ? loop->reg_code->num_regs : tier->vars.num_vars;
+    VMValue* slots=new VMValue[num_slots+1];
+    TypedToFrame(&tier->vars, variables, slots);
+
+    int result=TRACE_DONE;
+    if(loop->reg_code)
+    {
+        RunRegCode(loop->reg_code, slots, tier->dispatch);
+        result=slots[loop->exit_reg].i;
+    }
+#ifdef TINY_JIT
+    else result=((JitFunction)loop->jit_code)(slots);
+#endif
+
+    FrameToTyped(&tier->vars, slots, variables);
+    delete[] slots;
+    if(result==TRACE_DIV_ZERO) DivisionByZero();
+    tier->trace_entries++;
+    return result;
+}
+
+// Runs every repeat statement while tracing
+void RunTracedRepeat(TreeNode* node, SymbolTable* symbol_table, TypedValue* variables)
+{
+    TierLoop* loop=tiering->Find(node);
+
+    // Only innermost loops are traced, so running the body never adds loops to the
+    // table and loop stays valid
+    if(!loop->traceable)
+    {
+        do RunProgram(node->child[0], symbol_table, variables);
+        while(!Evaluate(node->child[1], symbol_table, variables).bool_val);
+        return;
+    }
+
+    while(true)
+    {
+        if(loop->IsCompiled())
+        {
+            int result=RunTrace(tiering, loop, variables);
+            if(result==TRACE_DONE) return;
+
+            ResumeSideExit(&loop->steps[result-TRACE_SIDE_EXIT], symbol_table, variables);
+            tiering->side_exits++;
+            if(++loop->side_exits>=tiering->threshold && loop->recordings<MAX_TRACE_RECORDINGS)
+            {
+                loop->FreeCode();
+                loop->FreeTrace();
+                loop->backedges=0;
+            }
+        }
+        else if(loop->backedges>=tiering->threshold && loop->recordings<MAX_TRACE_RECORDINGS)
+            RecordTrace(tiering, loop, variables);
+        else RunProgram(node->child[0], symbol_table, variables);
+
+        if(Evaluate(node->child[1], symbol_table, variables).bool_val) return;
+        loop->backedges++;
+    }
+}
+
+void RunTraced(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    TierState tier(symbol_table, options->tier_threshold, options->dispatch);
+    tiering=&tier;
+    repeat_hook=RunTracedRepeat;
+    RunProgram(syntax_tree, symbol_table);
+    repeat_hook=0;
+    tiering=0;
+
+    if(options->stats)
+        fprintf(stderr, "[Engine=trace][Threshold=%d][Loops=%d][Traces=%d][TraceEntries=%lld][SideExits=%lld]\n",
+                tier.threshold, tier.num_loops, tier.num_promoted, tier.trace_entries, tier.side_exits);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// C Transpiler ////////////////////////////////////////////////////////////////////
+
+// Translates the analyzed tree into a standalone C program whose output matches
+// RunProgram(): variables become typed locals, repeat becomes do { } while and the
+// TINY operators become inline helpers
+// Int arithmetic goes through unsigned so it wraps as in the interpreter instead of
+// being undefined behavior that the C compiler may optimize on
+
+const char* c_runtime=
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static inline void tiny_division_by_zero(void)\n"
+    "{\n"
+    "    printf(\"ERROR Division by zero\\n\");\n"
+    "    abort();\n"
+    "}\n"
+    "\n"
+    "static inline int tiny_add(int a, int b) {return (int)((unsigned)a+(unsigned)b);}\n"
+    "static inline int tiny_sub(int a, int b) {return (int)((unsigned)a-(unsigned)b);}\n"
+    "static inline int tiny_mul(int a, int b) {return (int)((unsigned)a*(unsigned)b);}\n"
+    "static inline int tiny_div(int a, int b) {if(b==0) tiny_division_by_zero(); return a/b;}\n"
+    "static inline double tiny_rdiv(double a, double b) {if(b==0.0) tiny_division_by_zero(); return a/b;}\n"
+    "static inline int tiny_and(int a, int b) {return tiny_sub(tiny_mul(a, a), tiny_mul(b, b));}\n"
+    "static inline double tiny_rand(double a, double b) {return a*a-b*b;}\n"
+    "\n"
+    "static inline int tiny_pow(int a, int b)\n"
+    "{\n"
+    "    int r=1;\n"
+    "    if(a==0) return 0;\n"
+    "    for(;b>0;b--) r=tiny_mul(r, a);\n"
+    "    return b==0 ? r : 0;\n"
+    "}\n"
+    "\n"
+    "static inline double tiny_rpow(double a, int b)\n"
+    "{\n"
+    "    double r=1.0;\n"
+    "    if(a==0.0) return 0.0;\n"
+    "    for(;b>0;b--) r=r*a;\n"
+    "    return b==0 ? r : 0.0;\n"
+    "}\n"
+    "\n"
+    "static inline double tiny_real_bits(unsigned long long bits) {double v; memcpy(&v, &bits, sizeof v); return v;}\n"
+    "\n"
+    "static inline void tiny_write_int(int v) {printf(\"Val: %d\\n\", v);}\n"
+    "static inline void tiny_write_real(double v) {printf(\"Val: %lf\\n\", v);}\n"
+    "static inline void tiny_write_bool(int v) {printf(\"Val: %s\\n\", v ? \"true\" : \"false\");}\n"
+    "\n"
+    "static inline int tiny_read_int(const char* name, const char* type)\n"
+    "{\n"
+    "    int v=0;\n"
+    "    printf(\"Enter %s (%s): \", name, type);\n"
+    "    if(scanf(\"%d\", &v)!=1) v=0;\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static inline double tiny_read_real(const char* name, const char* type)\n"
+    "{\n"
+    "    double v=0.0;\n"
+    "    printf(\"Enter %s (%s): \", name, type);\n"
+    "    if(scanf(\"%lf\", &v)!=1) v=0.0;\n"
+    "    return v;\n"
+    "}\n"
+    "\n";
+
+// Real constants are printed so they read back exactly, values that have no C
+// literal (inf, nan) are rebuilt from their bits
+void EmitCReal(FILE* file, double v)
+{
+    if(v!=v || v-v!=0.0)
+    {
+        unsigned long long bits;
+        memcpy(&bits, &v, sizeof(bits));
+        fprintf(file, "tiny_real_bits(0x%llxULL)", bits);
+        return;
+    }
+    char str[64];
+    snprintf(str, sizeof(str), "%.17g", v);
+    if(!strpbrk(str, ".e")) strcat(str, ".0");
+    fprintf(file, v<0.0 ? "(%s)" : "%s", str);
+}
+
+void EmitCInt(FILE* file, int v)
+{
+    if(v==-2147483647-1) fprintf(file, "(-2147483647-1)");
+    else fprintf(file, v<0 ? "(%d)" : "%d", v);
+}
+
+// Writes an expression computing node as type
+void EmitCExpr(FILE* file, TreeNode* node, ExprDataType type)
+{
+    ExprDataType own=node->expr_data_type;
+    if(node->node_kind==OPER_NODE) own=IsComparison(node->oper) ? BOOLEAN : OperType(node);
+
+    if(own==REAL && type!=REAL) fprintf(file, "(int)");
+    else if(own!=REAL && type==REAL) fprintf(file, "(double)");
+
+    if(node->node_kind==NUM_NODE)
+    {
+        if(node->expr_data_type==REAL) EmitCReal(file, node->real_num);
+        else EmitCInt(file, node->num);
+        return;
+    }
+    if(node->node_kind==ID_NODE)
+    {
+        fprintf(file, "v_%s", node->id);
+        return;
+    }
+
+    ExprDataType op_type=OperType(node);
+    ExprDataType right_type=(node->oper==POWER) ? INTEGER : op_type;
+    const char* infix=0;
+    const char* func=0;
+
+    if(node->oper==EQUAL) infix="==";
+    else if(node->oper==LESS_THAN) infix="<";
+    else if(node->oper==GREATER_THAN) infix=">";
+    else if(node->oper==GREATER_EQUAL) infix=">=";
+    else if(node->oper==LESS_EQUAL) infix="<=";
+    else if(op_type==REAL)
+    {
+        if(node->oper==PLUS) infix="+";
+        else if(node->oper==MINUS) infix="-";
+        else if(node->oper==TIMES) infix="*";
+        else if(node->oper==DIVIDE && node->unchecked) infix="/";
+        else if(node->oper==DIVIDE) func="tiny_rdiv";
+        else if(node->oper==POWER) func="tiny_rpow";
+        else func="tiny_rand";
+    }
+    else
+    {
+        if(node->oper==PLUS) func="tiny_add";
+        else if(node->oper==MINUS) func="tiny_sub";
+        else if(node->oper==TIMES) func="tiny_mul";
+        else if(node->oper==DIVIDE && node->unchecked) infix="/";
+        else if(node->oper==DIVIDE) func="tiny_div";
+        else if(node->oper==POWER) func="tiny_pow";
+        else func="tiny_and";
+    }
+
+    fprintf(file, "%s(", func ? func : "");
+    EmitCExpr(file, node->child[0], op_type);
+    fprintf(file, func ? ", " : " %s ", infix);
+    EmitCExpr(file, node->child[1], right_type);
+    fprintf(file, ")");
+}
+
+void EmitCStmtSeq(FILE* file, TreeNode* node, SymbolTable* symbol_table, int indent)
+{
+    for(;node;node=node->sibling)
+    {
+        fprintf(file, "%*s", 4*indent, "");
+
+        if(node->node_kind==IF_NODE)
+        {
+            fprintf(file, "if(");
+            EmitCExpr(file, node->child[0], BOOLEAN);
+            fprintf(file, ")\n%*s{\n", 4*indent, "");
+            EmitCStmtSeq(file, node->child[1], symbol_table, indent+1);
+            fprintf(file, "%*s}\n", 4*indent, "");
+            if(node->child[2])
+            {
+                fprintf(file, "%*selse\n%*s{\n", 4*indent, "", 4*indent, "");
+                EmitCStmtSeq(file, node->child[2], symbol_table, indent+1);
+                fprintf(file, "%*s}\n", 4*indent, "");
+            }
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            fprintf(file, "do\n%*s{\n", 4*indent, "");
+            EmitCStmtSeq(file, node->child[0], symbol_table, indent+1);
+            fprintf(file, "%*s}\n%*swhile(!(", 4*indent, "", 4*indent, "");
+            EmitCExpr(file, node->child[1], BOOLEAN);
+            fprintf(file, "));\n");
+        }
+        else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+        {
+            ExprDataType type=symbol_table->Find(node->id)->var_type;
+            fprintf(file, "v_%s = ", node->id);
+            if(node->child[0]) EmitCExpr(file, node->child[0], type);
+            else fprintf(file, type==REAL ? "0.0" : "0");
+            fprintf(file, ";\n");
+        }
+        else if(node->node_kind==READ_NODE)
+        {
+            ExprDataType type=symbol_table->Find(node->id)->var_type;
+            fprintf(file, "v_%s = %s(\"%s\", \"%s\");\n", node->id, type==REAL ? "tiny_read_real" : "tiny_read_int",
+                    node->id, ExprDataTypeStr[type]);
+        }
+        else if(node->node_kind==WRITE_NODE)
+        {
+            ExprDataType type=node->child[0]->expr_data_type;
+            fprintf(file, "%s(", type==REAL ? "tiny_write_real" : (type==BOOLEAN) ? "tiny_write_bool" : "tiny_write_int");
+            EmitCExpr(file, node->child[0], type);
+            fprintf(file, ");\n");
+        }
+    }
+}
+
+// Writes the program as C to file_name, returns false if the file cannot be created
+bool EmitC(TreeNode* syntax_tree, SymbolTable* symbol_table, const char* file_name)
+{
+    int i;
+    OutFile out(file_name);
+    if(!out.file) return false;
+
+    VariableLayout vars;
+    vars.Set(symbol_table);
+
+    fprintf(out.file, "/* Generated by the TINY compiler */\n");
+    fprintf(out.file, "%s", c_runtime);
+    fprintf(out.file, "int main(void)\n{\n");
+    for(i=0;i<vars.num_vars;i++)
+        fprintf(out.file, "    %s v_%s = %s;\n", vars.types[i]==REAL ? "double" : "int", vars.names[i], vars.types[i]==REAL ? "0.0" : "0");
+    if(vars.num_vars>0) fprintf(out.file, "\n");
+    EmitCStmtSeq(out.file, syntax_tree, symbol_table, 1);
+    fprintf(out.file, "    return 0;\n}\n");
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Tiny Machine ////////////////////////////////////////////////////////////////////
+
+// TM is the machine of Louden's TINY compiler: 8 registers, data memory and two
+// instruction formats
+//   RO: op r,s,t    reg[r] = reg[s] op reg[t]
+//   RM: op r,d(s)   a = d+reg[s], LD/ST access dMem[a], jumps load a into pc
+// It is extended with typed real instructions (..R), conversions, compare
+// instructions that leave 0/1 in a register (so comparisons do not rely on a
+// subtraction that may overflow) and read/write instructions for each type
+// Variables live at memloc(gp), expression temporaries are pushed below the top
+// of data memory through mp, jumps are pc relative as in Louden's code generator
+
+#define TM_AC 0             // accumulator
+#define TM_AC1 1            // second accumulator
+#define TM_GP 5             // global pointer, always 0
+#define TM_MP 6             // top of data memory, temporaries are pushed below it
+#define TM_PC 7             // program counter
+#define TM_NUM_REGS 8
+
+enum TMOpCode
+{
+    // RO instructions
+    TM_HALT, TM_OUT, TM_OUTR, TM_OUTB,
+    TM_ADD, TM_SUB, TM_MUL, TM_DIV, TM_POW,
+    TM_ADDR, TM_SUBR, TM_MULR, TM_DIVR, TM_POWR,
+    TM_ITOR, TM_RTOI,
+    TM_EQ, TM_LT, TM_GT, TM_GE, TM_LE,
+    TM_EQR, TM_LTR, TM_GTR, TM_GER, TM_LER,
+    // RM instructions
+    TM_IN, TM_INR, TM_INB,
+    TM_LD, TM_ST, TM_LDA, TM_LDC, TM_LDCR,
+    TM_JLT, TM_JLE, TM_JGT, TM_JGE, TM_JEQ, TM_JNE
+};
+
+#define TM_FIRST_RM TM_IN
+
+const char* TMOpCodeStr[]=
+{
+    "HALT", "OUT", "OUTR", "OUTB",
+    "ADD", "SUB", "MUL", "DIV", "POW",
+    "ADDR", "SUBR", "MULR", "DIVR", "POWR",
+    "ITOR", "RTOI",
+    "EQ", "LT", "GT", "GE", "LE",
+    "EQR", "LTR", "GTR", "GER", "LER",
+    "IN", "INR", "INB",
+    "LD", "ST", "LDA", "LDC", "LDCR",
+    "JLT", "JLE", "JGT", "JGE", "JEQ", "JNE"
+};
+
+struct TMInstr
+{
+    TMOpCode op;
+    int r, s, t;            // RO operands, RM uses r, s
+    int d;                  // RM displacement
+    double real_d;          // LDCR constant
+    int label;              // jump target label until resolved, else -1
+    const char* comment;
+};
+
+struct TMProgram
+{
+    TMInstr* code;
+    int code_size, code_cap;
+
+    int* labels;            // instruction each label is bound to
+    int num_labels, labels_cap;
+
+    VariableLayout vars;    // variable v is at dMem[v]
+    int tmp_offset;         // next temporary is at tmp_offset(mp)
+    int max_temps;
+    int mem_size;           // data memory needed, set once generation is done
+    int unoptimized_size;   // instructions before the peephole optimizer
+
+    TMProgram() {code=0; code_size=code_cap=0; labels=0; num_labels=labels_cap=0; tmp_offset=max_temps=mem_size=0;
+                 unoptimized_size=0;}
+    ~TMProgram()
+    {
+        if(code) delete[] code;
+        if(labels) delete[] labels;
+    }
+
+    int Emit(TMOpCode op, int r, int s, int t, int d, const char* comment)
+    {
+        Reserve(code, code_cap, code_size+1);
+        TMInstr* in=&code[code_size];
+        in->op=op; in->r=r; in->s=s; in->t=t; in->d=d; in->real_d=0.0; in->label=-1; in->comment=comment;
+        return code_size++;
+    }
+
+    int EmitRO(TMOpCode op, int r, int s, int t, const char* comment) {return Emit(op, r, s, t, 0, comment);}
+    int EmitRM(TMOpCode op, int r, int d, int s, const char* comment) {return Emit(op, r, s, 0, d, comment);}
+
+    int EmitLDCR(int r, double v, const char* comment)
+    {
+        int i=Emit(TM_LDCR, r, 0, 0, 0, comment);
+        code[i].real_d=v;
+        return i;
+    }
+
+    // Jumps to a label, LDA pc for an unconditional jump
+    int EmitJump(TMOpCode op, int r, int label, const char* comment)
+    {
+        int i=Emit(op, r, TM_PC, 0, 0, comment);
+        code[i].label=label;
+        return i;
+    }
+
+    int NewLabel()
+    {
+        Reserve(labels, labels_cap, num_labels+1);
+        labels[num_labels]=-1;
+        return num_labels++;
+    }
+
+    void Bind(int label) {labels[label]=code_size;}
+
+    // Turns label jumps into pc relative displacements
+    void ResolveLabels()
+    {
+        int i;
+        for(i=0;i<code_size;i++)
+            if(code[i].label>=0) {code[i].d=labels[code[i].label]-(i+1); code[i].label=-1;}
+    }
+
+    void Push(int r)
+    {
+        EmitRM(TM_ST, r, tmp_offset--, TM_MP, "push temp");
+        if(-tmp_offset>max_temps) max_temps=-tmp_offset;
+    }
+
+    void Pop(int r) {EmitRM(TM_LD, r, ++tmp_offset, TM_MP, "pop temp");}
+};
+
+inline bool IsTMLeaf(TreeNode* node) {return node->node_kind==NUM_NODE || node->node_kind==ID_NODE;}
+
+// Loads a constant or variable into register r as type
+void GenerateTMLeaf(TMProgram* prog, TreeNode* node, SymbolTable* symbol_table, int r, ExprDataType type)
+{
+    ExprDataType own=node->expr_data_type;
+    if(node->node_kind==NUM_NODE)
+    {
+        double real_val=(own==REAL) ? node->real_num : (double)node->num;
+        int int_val=(own==REAL) ? (int)node->real_num : node->num;
+        if(type==REAL) prog->EmitLDCR(r, real_val, "load const");
+        else prog->EmitRM(TM_LDC, r, int_val, 0, "load const");
+        return;
+    }
+
+    prog->EmitRM(TM_LD, r, symbol_table->Find(node->id)->memloc, TM_GP, node->id);
+    if(own==REAL && type!=REAL) prog->EmitRO(TM_RTOI, r, r, 0, "real to int");
+    else if(own!=REAL && type==REAL) prog->EmitRO(TM_ITOR, r, r, 0, "int to real");
+}
+
+TMOpCode TMOperOpCode(TokenType oper, ExprDataType type)
+{
+    bool real=(type==REAL);
+    if(oper==PLUS) return real ? TM_ADDR : TM_ADD;
+    if(oper==MINUS) return real ? TM_SUBR : TM_SUB;
+    if(oper==TIMES) return real ? TM_MULR : TM_MUL;
+    if(oper==DIVIDE) return real ? TM_DIVR : TM_DIV;
+    if(oper==POWER) return real ? TM_POWR : TM_POW;
+    if(oper==EQUAL) return real ? TM_EQR : TM_EQ;
+    if(oper==LESS_THAN) return real ? TM_LTR : TM_LT;
+    if(oper==GREATER_THAN) return real ? TM_GTR : TM_GT;
+    if(oper==GREATER_EQUAL) return real ? TM_GER : TM_GE;
+    return real ? TM_LER : TM_LE;
+}
+
+// Computes an expression into ac as type
+void GenerateTMExpr(TMProgram* prog, TreeNode* node, SymbolTable* symbol_table, ExprDataType type)
+{
+    if(IsTMLeaf(node)) {GenerateTMLeaf(prog, node, symbol_table, TM_AC, type); return;}
+
+    ExprDataType op_type=OperType(node);
+    ExprDataType right_type=(node->oper==POWER) ? INTEGER : op_type;
+    int s, t;
+
+    // Left operand ends up in s and right operand in t, a leaf right operand is
+    // loaded straight into ac1 instead of going through a temporary
+    GenerateTMExpr(prog, node->child[0], symbol_table, op_type);
+    if(IsTMLeaf(node->child[1]))
+    {
+        GenerateTMLeaf(prog, node->child[1], symbol_table, TM_AC1, right_type);
+        s=TM_AC; t=TM_AC1;
+    }
+    else
+    {
+        prog->Push(TM_AC);
+        GenerateTMExpr(prog, node->child[1], symbol_table, right_type);
+        prog->Pop(TM_AC1);
+        s=TM_AC1; t=TM_AC;
+    }
+
+    if(node->oper==AND_OP)
+    {
+        // a & b = a*a - b*b
+        TMOpCode mul=(op_type==REAL) ? TM_MULR : TM_MUL;
+        prog->EmitRO(mul, s, s, s, "a*a");
+        prog->EmitRO(mul, t, t, t, "b*b");
+        prog->EmitRO((op_type==REAL) ? TM_SUBR : TM_SUB, TM_AC, s, t, "&");
+    }
+    else prog->EmitRO(TMOperOpCode(node->oper, op_type), TM_AC, s, t, TokenTypeStr[node->oper]);
+
+    ExprDataType own=IsComparison(node->oper) ? BOOLEAN : op_type;
+    if(own==REAL && type!=REAL) prog->EmitRO(TM_RTOI, TM_AC, TM_AC, 0, "real to int");
+    else if(own!=REAL && type==REAL) prog->EmitRO(TM_ITOR, TM_AC, TM_AC, 0, "int to real");
+}
+
+void GenerateTMStmtSeq(TMProgram* prog, TreeNode* node, SymbolTable* symbol_table)
+{
+    for(;node;node=node->sibling)
+    {
+        if(node->node_kind==IF_NODE)
+        {
+            int else_label=prog->NewLabel();
+            GenerateTMExpr(prog, node->child[0], symbol_table, BOOLEAN);
+            prog->EmitJump(TM_JEQ, TM_AC, else_label, "if: jump to else");
+            GenerateTMStmtSeq(prog, node->child[1], symbol_table);
+            if(node->child[2])
+            {
+                int end_label=prog->NewLabel();
+                prog->EmitJump(TM_LDA, TM_PC, end_label, "jump to end");
+                prog->Bind(else_label);
+                GenerateTMStmtSeq(prog, node->child[2], symbol_table);
+                prog->Bind(end_label);
+            }
+            else prog->Bind(else_label);
+        }
+        else if(node->node_kind==REPEAT_NODE)
+        {
+            int top_label=prog->NewLabel();
+            prog->Bind(top_label);
+            GenerateTMStmtSeq(prog, node->child[0], symbol_table);
+            GenerateTMExpr(prog, node->child[1], symbol_table, BOOLEAN);
+            prog->EmitJump(TM_JEQ, TM_AC, top_label, "until: jump back");
+        }
+        else if(node->node_kind==ASSIGN_NODE || node->node_kind==DECL_NODE)
+        {
+            VariableInfo* var=symbol_table->Find(node->id);
+            if(node->child[0]) GenerateTMExpr(prog, node->child[0], symbol_table, var->var_type);
+            else if(var->var_type==REAL) prog->EmitLDCR(TM_AC, 0.0, "default value");
+            else prog->EmitRM(TM_LDC, TM_AC, 0, 0, "default value");
+            prog->EmitRM(TM_ST, TM_AC, var->memloc, TM_GP, var->name);
+        }
+        else if(node->node_kind==READ_NODE)
+        {
+            VariableInfo* var=symbol_table->Find(node->id);
+            TMOpCode op=(var->var_type==REAL) ? TM_INR : (var->var_type==BOOLEAN) ? TM_INB : TM_IN;
+            prog->EmitRM(op, TM_AC, var->memloc, TM_GP, "read");
+            prog->EmitRM(TM_ST, TM_AC, var->memloc, TM_GP, var->name);
+        }
+        else if(node->node_kind==WRITE_NODE)
+        {
+            ExprDataType type=node->child[0]->expr_data_type;
+            GenerateTMExpr(prog, node->child[0], symbol_table, type);
+            prog->EmitRO((type==REAL) ? TM_OUTR : (type==BOOLEAN) ? TM_OUTB : TM_OUT, TM_AC, 0, 0, "write");
+        }
+    }
+}
+
+// Peephole optimizer over the generated code, runs while jump targets are still
+// labels so instructions can be removed freely
+// It relies on two properties of the generator: ac and ac1 are dead at statement
+// boundaries (every statement and condition starts by setting ac), and ac1 is only
+// read by the instruction right after the one that sets it
+
+inline bool IsTMJump(TMInstr* in) {return in->label>=0;}
+inline bool IsTMGoto(TMInstr* in) {return in->op==TM_LDA && in->r==TM_PC && in->label>=0;}
+
+// Jump that is taken when a comparison of ac with 0 is false
+TMOpCode TMNegatedJump(TMOpCode compare)
+{
+    if(compare==TM_EQ) return TM_JNE;
+    if(compare==TM_LT) return TM_JGE;
+    if(compare==TM_GT) return TM_JLE;
+    if(compare==TM_GE) return TM_JLT;
+    return TM_JGT;
+}
+
+// Runs one round of rewrites, marks removed instructions, returns true on a change
+bool PeepholeTMRound(TMProgram* prog, bool* removed)
+{
+    int i, j;
+    int n=prog->code_size;
+    TMInstr* code=prog->code;
+    bool changed=false;
+
+    bool* target=new bool[n+1];
+    for(i=0;i<=n;i++) target[i]=false;
+    for(i=0;i<prog->num_labels;i++) if(prog->labels[i]>=0) target[prog->labels[i]]=true;
+
+    for(i=0;i<n;i++)
+    {
+        TMInstr* in=&code[i];
+        TMInstr* next=(i+1<n && !target[i+1]) ? &code[i+1] : 0;
+        TMInstr* next2=(next && i+2<n && !target[i+2]) ? &code[i+2] : 0;
+
+        // ST r,a followed by LD r,a: the value is still in r
+        // LD r,a followed by ST r,a: the value is already in memory
+        if(next && ((in->op==TM_ST && next->op==TM_LD) || (in->op==TM_LD && next->op==TM_ST)) &&
+           in->r==next->r && in->d==next->d && in->s==next->s && in->s!=TM_PC && next->r!=TM_PC)
+        {
+            removed[i+1]=true; changed=true; i++;
+            continue;
+        }
+
+        // LDC ac1,k followed by ADD/SUB ac,ac,ac1: add the immediate with LDA ac,k(ac)
+        if(next && in->op==TM_LDC && in->r==TM_AC1 && (next->op==TM_ADD || next->op==TM_SUB) &&
+           next->r==TM_AC && next->s==TM_AC && next->t==TM_AC1 && !(next->op==TM_SUB && in->d==-2147483647-1))
+        {
+            in->op=TM_LDA; in->r=TM_AC; in->s=TM_AC;
+            if(next->op==TM_SUB) in->d=-in->d;
+            in->comment=next->op==TM_ADD ? "add immediate" : "subtract immediate";
+            removed[i+1]=true; changed=true; i++;
+            continue;
+        }
+
+        // LDC ac1,0; <compare> ac,ac,ac1; JEQ ac,L: jump on ac itself
+        if(next2 && in->op==TM_LDC && in->r==TM_AC1 && in->d==0 && next->op>=TM_EQ && next->op<=TM_LE &&
+           next->r==TM_AC && next->s==TM_AC && next->t==TM_AC1 && next2->op==TM_JEQ && next2->r==TM_AC && IsTMJump(next2))
+        {
+            in->op=TMNegatedJump(next->op); in->r=TM_AC; in->s=TM_PC; in->d=0; in->label=next2->label;
+            in->comment=next2->comment;
+            removed[i+1]=removed[i+2]=true; changed=true; i+=2;
+            continue;
+        }
+
+        // LDC ac1,k; EQ ac,ac,ac1; JEQ ac,L: LDA ac,-k(ac); JNE ac,L, exact because a
+        // wrapping subtraction is 0 exactly when the operands are equal
+        if(next2 && in->op==TM_LDC && in->r==TM_AC1 && in->d!=-2147483647-1 && next->op==TM_EQ &&
+           next->r==TM_AC && next->s==TM_AC && next->t==TM_AC1 && next2->op==TM_JEQ && next2->r==TM_AC && IsTMJump(next2))
+        {
+            in->op=TM_LDA; in->r=TM_AC; in->s=TM_AC; in->d=-in->d; in->comment="subtract immediate";
+            next2->op=TM_JNE;
+            removed[i+1]=true; changed=true; i+=2;
+            continue;
+        }
+
+        if(IsTMJump(in))
+        {
+            // Thread jumps to unconditional jumps, the bound stops on cycles
+            for(j=0;j<n;j++)
+            {
+                int p=prog->labels[in->label];
+                while(p<n && removed[p]) p++;
+                if(p>=n || !IsTMGoto(&code[p]) || code[p].label==in->label) break;
+                in->label=code[p].label;
+                changed=true;
+            }
+
+            // A jump to the next instruction does nothing
+            int p=prog->labels[in->label];
+            while(p<n && removed[p]) p++;
+            bool skip=true;
+            for(j=i+1;j<p;j++) if(!removed[j]) skip=false;
+            if(p>i && skip) {removed[i]=true; changed=true; continue;}
+        }
+
+        // Nothing after an unconditional jump runs until the next jump target
+        if(IsTMGoto(in))
+            for(j=i+1;j<n && !target[j];j++)
+                if(!removed[j]) {removed[j]=true; changed=true;}
+    }
+
+    delete[] target;
+    return changed;
+}
+
+// Returns the number of instructions removed
+int PeepholeTM(TMProgram* prog)
+{
+    int i, n;
+    int removed_total=0;
+
+    while(true)
+    {
+        n=prog->code_size;
+        bool* removed=new bool[n+1];
+        for(i=0;i<=n;i++) removed[i]=false;
+
+        bool changed=PeepholeTMRound(prog, removed);
+
+        // Compact the code, a label moves to the first instruction kept after it
+        int* new_index=new int[n+1];
+        int kept=0;
+        for(i=0;i<n;i++)
+        {
+            new_index[i]=kept;
+            if(!removed[i]) prog->code[kept++]=prog->code[i];
+        }
+        new_index[n]=kept;
+        for(i=0;i<prog->num_labels;i++) if(prog->labels[i]>=0) prog->labels[i]=new_index[prog->labels[i]];
+
+        removed_total+=n-kept;
+        prog->code_size=kept;
+        delete[] new_index;
+        delete[] removed;
+        if(!changed) break;
+    }
+    return removed_total;
+}
+
+void GenerateTMCode(TMProgram* prog, TreeNode* syntax_tree, SymbolTable* symbol_table)
+{
+    prog->vars.Set(symbol_table);
+
+    // Standard prelude: mp = dMem[0] (the last address), then clear dMem[0]
+    prog->EmitRM(TM_LD, TM_MP, 0, TM_AC, "load maxaddress from location 0");
+    prog->EmitRM(TM_ST, TM_AC, 0, TM_AC, "clear location 0");
+    GenerateTMStmtSeq(prog, syntax_tree, symbol_table);
+    prog->EmitRO(TM_HALT, 0, 0, 0, "end of program");
+    prog->unoptimized_size=prog->code_size;
+    PeepholeTM(prog);
+    prog->ResolveLabels();
+
+    prog->mem_size=prog->vars.num_vars+prog->max_temps+1;
+}
+
+// Writes the program in Louden's TM assembly format
+void PrintTMCode(FILE* file, TMProgram* prog)
+{
+    int i;
+    fprintf(file, "* TINY Compilation to TM Code\n");
+    fprintf(file, "* Data memory: %d words\n", prog->mem_size);
+    for(i=0;i<prog->vars.num_vars;i++)
+        fprintf(file, "* %s (%s) at %d(%d)\n", prog->vars.names[i], ExprDataTypeStr[prog->vars.types[i]], i, TM_GP);
+
+    for(i=0;i<prog->code_size;i++)
+    {
+        TMInstr* in=&prog->code[i];
+        char operands[64];
+        if(in->op==TM_LDCR) snprintf(operands, sizeof(operands), "%d,%.17g(%d)", in->r, in->real_d, in->s);
+        else if(in->op>=TM_FIRST_RM) snprintf(operands, sizeof(operands), "%d,%d(%d)", in->r, in->d, in->s);
+        else snprintf(operands, sizeof(operands), "%d,%d,%d", in->r, in->s, in->t);
+
+        fprintf(file, "%3d:  %5s  %s \t%s", i, TMOpCodeStr[in->op], operands, in->comment ? in->comment : "");
+        if(in->op>=TM_FIRST_RM && in->s==TM_PC && (in->op!=TM_LDA || in->r==TM_PC)) fprintf(file, " (to %d)", i+1+in->d);
+        fprintf(file, "\n");
+    }
+}
+
+// Instruction predecoded for the simulator, pc relative addresses are made absolute
+struct TMDecodedInstr
+{
+    TMOpCode op;
+    int r, s, t;
+    int d;                  // address when s is -1, else displacement from reg[s]
+    double real_d;
+};
+
+// Runs TM code on data memory of prog->mem_size words, returns the number of
+// instructions executed
+long long RunTMCode(TMProgram* prog, VMValue* mem)
+{
+    int i;
+    int code_size=prog->code_size;
+    int mem_size=prog->mem_size;
+
+    TMDecodedInstr* code=new TMDecodedInstr[code_size+1];
+    for(i=0;i<code_size;i++)
+    {
+        TMInstr* in=&prog->code[i];
+        TMDecodedInstr* out=&code[i];
+        out->op=in->op; out->r=in->r; out->s=in->s; out->t=in->t; out->d=in->d; out->real_d=in->real_d;
+        // At execution time pc holds the address of the next instruction
+        if(in->op>=TM_FIRST_RM && in->s==TM_PC) {out->s=-1; out->d=in->d+i+1;}
+    }
+
+    VMValue reg[TM_NUM_REGS];
+    for(i=0;i<TM_NUM_REGS;i++) reg[i].r=0.0;
+    for(i=0;i<mem_size;i++) mem[i].r=0.0;
+    mem[0].i=mem_size-1;
+
+    long long count=0;
+    while(true)
+    {
+        int pc=reg[TM_PC].i;
+        if(pc<0 || pc>=code_size) {printf("ERROR TM instruction memory access at %d\n", pc); throw 0;}
+        TMDecodedInstr* in=&code[pc];
+        reg[TM_PC].i=pc+1;
+        count++;
+
+        VMValue* r=&reg[in->r];
+        VMValue* s=&reg[in->s>=0 ? in->s : 0];
+        VMValue* t=&reg[in->t];
+        int a=(in->s>=0) ? in->d+reg[in->s].i : in->d;
+
+        switch(in->op)
+        {
+        case TM_HALT: delete[] code; return count;
+        case TM_OUT: WriteInt(r->i); break;
+        case TM_OUTR: WriteReal(r->r); break;
+        case TM_OUTB: WriteBool(r->i); break;
+
+        case TM_ADD: r->i=s->i+t->i; break;
+        case TM_SUB: r->i=s->i-t->i; break;
+        case TM_MUL: r->i=s->i*t->i; break;
+        case TM_DIV: if(t->i==0) {delete[] code; DivisionByZero();} r->i=s->i/t->i; break;
+        case TM_POW: r->i=Power(s->i, t->i); break;
+        case TM_ADDR: r->r=s->r+t->r; break;
+        case TM_SUBR: r->r=s->r-t->r; break;
+        case TM_MULR: r->r=s->r*t->r; break;
+        case TM_DIVR: if(t->r==0.0) {delete[] code; DivisionByZero();} r->r=s->r/t->r; break;
+        case TM_POWR: r->r=RealPower(s->r, t->i); break;
+        case TM_ITOR: r->r=(double)s->i; break;
+        case TM_RTOI: r->i=(int)s->r; break;
+
+        case TM_EQ: r->i=(s->i==t->i); break;
+        case TM_LT: r->i=(s->i<t->i); break;
+        case TM_GT: r->i=(s->i>t->i); break;
+        case TM_GE: r->i=(s->i>=t->i); break;
+        case TM_LE: r->i=(s->i<=t->i); break;
+        case TM_EQR: r->i=(s->r==t->r); break;
+        case TM_LTR: r->i=(s->r<t->r); break;
+        case TM_GTR: r->i=(s->r>t->r); break;
+        case TM_GER: r->i=(s->r>=t->r); break;
+        case TM_LER: r->i=(s->r<=t->r); break;
+
+        case TM_IN: case TM_INR: case TM_INB:
+            ReadValue(prog->vars.names[a], prog->vars.types[a], r);
+            break;
+
+        case TM_LD:
+        case TM_ST:
+            if(a<0 || a>=mem_size) {delete[] code; printf("ERROR TM data memory access at %d\n", a); throw 0;}
+            if(in->op==TM_LD) *r=mem[a]; else mem[a]=*r;
+            break;
+        case TM_LDA: r->i=a; break;
+        case TM_LDC: r->i=in->d; break;
+        case TM_LDCR: r->r=in->real_d; break;
+
+        case TM_JLT: if(r->i<0) reg[TM_PC].i=a; break;
+        case TM_JLE: if(r->i<=0) reg[TM_PC].i=a; break;
+        case TM_JGT: if(r->i>0) reg[TM_PC].i=a; break;
+        case TM_JGE: if(r->i>=0) reg[TM_PC].i=a; break;
+        case TM_JEQ: if(r->i==0) reg[TM_PC].i=a; break;
+        case TM_JNE: if(r->i!=0) reg[TM_PC].i=a; break;
+        }
+    }
+}
+
+void RunTM(TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    TMProgram prog;
+    GenerateTMCode(&prog, syntax_tree, symbol_table);
+
+    VMValue* mem=new VMValue[prog.mem_size];
+    long long count=RunTMCode(&prog, mem);
+    if(options->stats)
+        fprintf(stderr, "[Engine=tm][Instructions=%d][BeforePeephole=%d][DataMemory=%d][Executed=%lld]\n",
+                prog.code_size, prog.unoptimized_size, prog.mem_size, count);
+
+    delete[] mem;
+}
+
+// Writes the program as TM assembly to file_name, returns false if the file cannot be created
+bool EmitTM(TreeNode* syntax_tree, SymbolTable* symbol_table, const char* file_name)
+{
+    OutFile out(file_name);
+    if(!out.file) return false;
+
+    TMProgram prog;
+    GenerateTMCode(&prog, syntax_tree, symbol_table);
+    PrintTMCode(out.file, &prog);
+    printf("[Pass=TMPeephole][InstructionsBefore=%d][InstructionsAfter=%d]\n", prog.unoptimized_size, prog.code_size);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Bytecode Image //////////////////////////////////////////////////////////////////
+
+// --emit=image writes the register code of a program to output.img, and
+// --run-image=FILE maps such an image and runs it without scanning, parsing or
+// analyzing anything. The image is position independent: the header locates every
+// section by its offset from the start of the file, so the register machine runs
+// the code and constants in place. Layout (little-endian on the usual hosts, the
+// endian field rejects images written with another byte order):
+//   ImageHeader
+//   RegInstr code[code_size]
+//   VMValue consts[num_consts]
+//   int const_types[num_consts]
+//   ImageVar vars[num_vars]          variable v is register v
+//   RegLine lines[num_lines]         line table
+//   char strings[strings_size]       NUL terminated variable names
+// IMAGE_VERSION changes whenever the layout or the instruction set changes.
+
+#define IMAGE_MAGIC "TINYIMG"
+#define IMAGE_VERSION 1
+#define IMAGE_ENDIAN 0x01020304
+#define IMAGE_ALIGN 8
+
+struct ImageHeader
+{
+    char magic[8];
+    int version;
+    int endian;
+    int total_size;
+    int num_regs, const_base;
+    int code_offset, code_size;
+    int consts_offset, const_types_offset, num_consts;
+    int vars_offset, num_vars;
+    int lines_offset, num_lines;
+    int strings_offset, strings_size;
+};
+
+struct ImageVar
+{
+    int name;               // offset in strings
+    int type;
+};
+
+// The code, constant types and line table are used in place, so their in-memory
+// layout must be the one written
+typedef char ImageRegInstrLayout[sizeof(RegInstr)==4*sizeof(int) ? 1 : -1];
+typedef char ImageTypeLayout[sizeof(ExprDataType)==sizeof(int) ? 1 : -1];
+
+inline int ImageAlign(int offset) {return (offset+IMAGE_ALIGN-1)&~(IMAGE_ALIGN-1);}
+
+// Writes the image of a generated program, returns its size or 0 if the file cannot be written
+int WriteImage(RegProgram* prog, const char* file_name)
+{
+    int i;
+    ImageHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    h.version=IMAGE_VERSION;
+    h.endian=IMAGE_ENDIAN;
+    h.num_regs=prog->num_regs;
+    h.const_base=prog->const_base;
+    h.code_size=prog->code_size;
+    h.num_consts=prog->num_consts;
+    h.num_vars=prog->vars.num_vars;
+    h.num_lines=prog->num_lines;
+    for(i=0;i<prog->vars.num_vars;i++) h.strings_size+=strlen(prog->vars.names[i])+1;
+
+    h.code_offset=ImageAlign(sizeof(ImageHeader));
+    h.consts_offset=ImageAlign(h.code_offset+h.code_size*sizeof(RegInstr));
+    h.const_types_offset=ImageAlign(h.consts_offset+h.num_consts*sizeof(VMValue));
+    h.vars_offset=ImageAlign(h.const_types_offset+h.num_consts*sizeof(int));
+    h.lines_offset=ImageAlign(h.vars_offset+h.num_vars*sizeof(ImageVar));
+    h.strings_offset=ImageAlign(h.lines_offset+h.num_lines*sizeof(RegLine));
+    h.total_size=ImageAlign(h.strings_offset+h.strings_size);
+
+    unsigned char* image=new unsigned char[h.total_size];
+    memset(image, 0, h.total_size);
+    memcpy(image, &h, sizeof(h));
+    if(h.code_size) memcpy(image+h.code_offset, prog->code, h.code_size*sizeof(RegInstr));
+    if(h.num_consts) memcpy(image+h.consts_offset, prog->consts, h.num_consts*sizeof(VMValue));
+    if(h.num_lines) memcpy(image+h.lines_offset, prog->lines, h.num_lines*sizeof(RegLine));
+
+    int* const_types=(int*)(image+h.const_types_offset);
+    for(i=0;i<h.num_consts;i++) const_types[i]=prog->const_types[i];
+
+    ImageVar* vars=(ImageVar*)(image+h.vars_offset);
+    char* strings=(char*)(image+h.strings_offset);
+    int name=0;
+    for(i=0;i<h.num_vars;i++)
+    {
+        vars[i].name=name;
+        vars[i].type=prog->vars.types[i];
+        strcpy(strings+name, prog->vars.names[i]);
+        name+=strlen(prog->vars.names[i])+1;
+    }
+
+    OutFile out(file_name);
+    bool ok=out.file && fwrite(image, 1, h.total_size, out.file)==(size_t)h.total_size;
+    delete[] image;
+    return ok ? h.total_size : 0;
+}
+
+// Checks that a section of count elements lies inside the image
+inline bool ImageSectionFits(const ImageHeader* h, int offset, int count, int elem_size)
+{
+    return offset>=(int)sizeof(ImageHeader) && offset%IMAGE_ALIGN==0 && count>=0 &&
+           (long long)offset+(long long)count*elem_size<=(long long)h->total_size;
+}
+
+// Checks an image before it runs: the register machine does no checks of its own,
+// so every register, jump target and variable must be in range. Returns 0 if the
+// image is valid, else the problem
+const char* ValidateImage(const unsigned char* image, long long size)
+{
+    int i, j;
+    const ImageHeader* h=(const ImageHeader*)image;
+
+    if(size<(long long)sizeof(ImageHeader) || memcmp(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC))!=0) return "not a TINY image";
+    if(h->endian!=IMAGE_ENDIAN) return "written with another byte order";
+    if(h->version!=IMAGE_VERSION) return "written by another version";
+    if(h->total_size!=size) return "truncated";
+
+    if(!ImageSectionFits(h, h->code_offset, h->code_size, sizeof(RegInstr)) ||
+       !ImageSectionFits(h, h->consts_offset, h->num_consts, sizeof(VMValue)) ||
+       !ImageSectionFits(h, h->const_types_offset, h->num_consts, sizeof(int)) ||
+       !ImageSectionFits(h, h->vars_offset, h->num_vars, sizeof(ImageVar)) ||
+       !ImageSectionFits(h, h->lines_offset, h->num_lines, sizeof(RegLine)) ||
+       !ImageSectionFits(h, h->strings_offset, h->strings_size, 1)) return "section out of range";
+
+    if(h->num_vars>h->const_base || h->const_base+h->num_consts!=h->num_regs) return "bad register layout";
+
+    const char* strings=(const char*)(image+h->strings_offset);
+    if(h->strings_size>0 && strings[h->strings_size-1]!=0) return "bad string table";
+    const ImageVar* vars=(const ImageVar*)(image+h->vars_offset);
+    for(i=0;i<h->num_vars;i++)
+        if(vars[i].name<0 || vars[i].name>=h->strings_size || vars[i].type<INTEGER || vars[i].type>BOOLEAN) return "bad variable";
+
+    const int* const_types=(const int*)(image+h->const_types_offset);
+    for(i=0;i<h->num_consts;i++) if(const_types[i]<INTEGER || const_types[i]>BOOLEAN) return "bad constant";
+
+    // Execution must end at a HALT, it may not run off the end of the code
+    const RegInstr* code=(const RegInstr*)(image+h->code_offset);
+    if(h->code_size==0 || (code[h->code_size-1].op!=RG_HALT && code[h->code_size-1].op!=RG_JMP)) return "code does not end";
+    for(i=0;i<h->code_size;i++)
+    {
+        if(code[i].op<0 || code[i].op>RG_HALT) return "bad opcode";
+        int operand[3]={code[i].a, code[i].b, code[i].c};
+        const char* kinds=reg_op_info[code[i].op].operands;
+        for(j=0;kinds[j];j++)
+        {
+            int limit=(kinds[j]=='t') ? h->code_size : h->num_regs;
+            if(operand[j]<0 || operand[j]>=limit) return "operand out of range";
+        }
+        if((code[i].op==RG_RDI || code[i].op==RG_RDR || code[i].op==RG_RDB) && code[i].a>=h->num_vars) return "read of a non-variable";
+    }
+    return 0;
+}
+
+// Read-only view of an image file, mapped where mmap() is available
+struct MappedImage
+{
+    unsigned char* data;
+    long long size;
+    bool mapped;
+
+    MappedImage() {data=0; size=0; mapped=false;}
+    ~MappedImage()
+    {
+#ifdef TINY_MMAP
+        if(mapped) munmap(data, size);
+#endif
+        if(!mapped && data) delete[] data;
+    }
+
+    bool Open(const char* file_name)
+    {
+#ifdef TINY_MMAP
+        int fd=open(file_name, O_RDONLY);
+        if(fd<0) return false;
+        struct stat st;
+        if(fstat(fd, &st)==0 && st.st_size>0)
+        {
+            void* p=mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p!=MAP_FAILED) {data=(unsigned char*)p; size=st.st_size; mapped=true;}
+        }
+        close(fd);
+        return mapped;
+#else
+        FILE* file=fopen(file_name, "rb");
+        if(!file) return false;
+        fseek(file, 0, SEEK_END);
+        size=ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data=new unsigned char[size>0 ? size : 1];
+        bool ok=size>0 && fread(data, 1, size, file)==(size_t)size;
+        fclose(file);
+        return ok;
+#endif
+    }
+};
+
+// Runs an image on the register machine, the code and constants are used in place
+// Returns false if the image cannot be loaded
+bool RunImage(const char* file_name, CompilerOptions* options)
+{
+    int i;
+    MappedImage image;
+    if(!image.Open(file_name)) {printf("ERROR Cannot open image '%s'\n", file_name); return false;}
+    const char* error=ValidateImage(image.data, image.size);
+    if(error) {printf("ERROR Image '%s' cannot be run: %s\n", file_name, error); return false;}
+
+    const ImageHeader* h=(const ImageHeader*)image.data;
+    const ImageVar* vars=(const ImageVar*)(image.data+h->vars_offset);
+    char* strings=(char*)(image.data+h->strings_offset);
+
+    RegProgram prog;
+    prog.code=(RegInstr*)(image.data+h->code_offset);
+    prog.code_size=h->code_size;
+    prog.consts=(VMValue*)(image.data+h->consts_offset);
+    prog.const_types=(ExprDataType*)(image.data+h->const_types_offset);
+    prog.num_consts=h->num_consts;
+    prog.lines=(RegLine*)(image.data+h->lines_offset);
+    prog.num_lines=h->num_lines;
+    prog.const_base=h->const_base;
+    prog.num_regs=h->num_regs;
+    prog.num_temps=h->const_base-h->num_vars;
+
+    prog.vars.num_vars=h->num_vars;
+    prog.vars.names=new char*[h->num_vars+1];
+    prog.vars.types=new ExprDataType[h->num_vars+1];
+    for(i=0;i<h->num_vars;i++) {prog.vars.names[i]=strings+vars[i].name; prog.vars.types[i]=(ExprDataType)vars[i].type;}
+
+    if(options->disasm) PrintRegCode(&prog);
+
+    VMValue* regs=new VMValue[prog.num_regs+1];
+    for(i=0;i<prog.num_regs;i++) regs[i].r=0.0;
+    long long count=RunRegCode(&prog, regs, options->dispatch);
+    if(options->stats)
+        fprintf(stderr, "[Engine=image][Bytes=%lld][Instructions=%d][Registers=%d][Executed=%lld]\n",
+                image.size, prog.code_size, prog.num_regs, count);
+    delete[] regs;
+
+    // The image owns these
+    prog.code=0; prog.consts=0; prog.const_types=0; prog.lines=0;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// ELF Executable //////////////////////////////////////////////////////////////////
+
+// --emit=elf writes a static x86-64 Linux executable, output.elf, that needs no
+// compiler, assembler, linker or C library on the host that runs it. The program
+// is the JIT's machine code for the whole tree, linked with a small runtime that
+// is generated here as machine code too: buffered output through the write system
+// call, exact %lf formatting of reals, a scanf-like reader over the read system
+// call and the division by zero error. Its output matches the Run Program section.
+//
+// Memory layout: one read-execute segment at ELF_TEXT_VADDR holds the headers, the
+// constant data and the code; one zero-initialized read-write segment at
+// ELF_DATA_VADDR holds the I/O buffers, scratch space and the variable frame. All
+// addresses fit in 32 bits, so the code uses them as immediates.
+
+#define ELF_TEXT_VADDR 0x400000
+#define ELF_DATA_VADDR 0x10000000
+#define ELF_HEADERS_SIZE (64+3*56)
+#define ELF_IO_SIZE 4096
+
+// Offsets in the data segment
+enum ElfData {ELF_OUT_LEN=0, ELF_IN_POS=4, ELF_IN_LEN=8,
+              ELF_LIMBS=64,                     // 18 64-bit limbs for formatting reals
+              ELF_DIGITS=256,                   // 512 bytes, text is built backwards from ELF_DIGITS_END
+              ELF_OUT_BUF=1024, ELF_IN_BUF=ELF_OUT_BUF+ELF_IO_SIZE,
+              ELF_FRAME=ELF_IN_BUF+ELF_IO_SIZE};
+
+#define ELF_NUM_LIMBS 18
+#define ELF_DIGITS_END (ELF_DIGITS+480)
+
+inline int ElfDataAddr(int offset) {return ELF_DATA_VADDR+offset;}
+
+// Emits an instruction with a 32-bit absolute address at its end
+inline void ElfAbs(X86Emitter* x, const char* op, int n, int addr) {x->Bytes(op, n); x->Int32(addr);}
+
+// flush: writes the output buffer to stdout
+// put: appends edx bytes at rsi to the output buffer
+// Both change only rax, rcx, rdx, rsi, rdi and r11
+void ElfOutputRoutines(X86Emitter* x, ElfRuntime* rt)
+{
+    int loop=x->NewLabel(), done=x->NewLabel();
+    x->Bind(rt->flush);
+    ElfAbs(x, "\x8B\x14\x25", 3, ElfDataAddr(ELF_OUT_LEN));        // mov edx, [out_len]
+    x->Byte(0xBE); x->Int32(ElfDataAddr(ELF_OUT_BUF));              // mov esi, out_buf
+    x->Bind(loop);
+    x->Bytes("\x85\xD2", 2); x->Jcc(CC_E, done);                    // test edx, edx
+    x->Byte(0xB8); x->Int32(1);                                     // mov eax, 1 (write)
+    x->Byte(0xBF); x->Int32(1);                                     // mov edi, 1 (stdout)
+    x->Bytes("\x0F\x05", 2);                                        // syscall
+    x->Bytes("\x48\x85\xC0", 3); x->Jcc(CC_LE, done);               // test rax, rax
+    x->Bytes("\x48\x01\xC6", 3);                                    // add rsi, rax
+    x->Bytes("\x29\xC2", 2);                                        // sub edx, eax
+    x->Jmp(loop);
+    x->Bind(done);
+    ElfAbs(x, "\xC7\x04\x25", 3, ElfDataAddr(ELF_OUT_LEN)); x->Int32(0);   // mov dword [out_len], 0
+    x->Byte(0xC3);                                                  // ret
+
+    int copy=x->NewLabel(), room=x->NewLabel(), end=x->NewLabel();
+    x->Bind(rt->put);
+    ElfAbs(x, "\x8B\x04\x25", 3, ElfDataAddr(ELF_OUT_LEN));        // mov eax, [out_len]
+    x->Bind(copy);
+    x->Bytes("\x85\xD2", 2); x->Jcc(CC_E, end);                     // test edx, edx
+    x->Byte(0x3D); x->Int32(ELF_IO_SIZE); x->Jcc(CC_B, room);       // cmp eax, size
+    ElfAbs(x, "\x89\x04\x25", 3, ElfDataAddr(ELF_OUT_LEN));        // mov [out_len], eax
+    x->Bytes("\x56\x52", 2);                                        // push rsi; push rdx
+    x->Call(rt->flush);
+    x->Bytes("\x5A\x5E\x31\xC0", 4);                                // pop rdx; pop rsi; xor eax, eax
+    x->Bind(room);
+    x->Bytes("\x0F\xB6\x0E", 3);                                    // movzx ecx, byte [rsi]
+    ElfAbs(x, "\x88\x88", 2, ElfDataAddr(ELF_OUT_BUF));            // mov [rax+out_buf], cl
+    x->Bytes("\xFF\xC0\x48\xFF\xC6\xFF\xCA", 7);                    // inc eax; inc rsi; dec edx
+    x->Jmp(copy);
+    x->Bind(end);
+    ElfAbs(x, "\x89\x04\x25", 3, ElfDataAddr(ELF_OUT_LEN));        // mov [out_len], eax
+    x->Byte(0xC3);                                                  // ret
+}
+
+// Prepends "Val: " to the text starting at r8 and ending at end_addr (write_int),
+// or starting at rdi and ending at r10 (write_real), then puts it
+void ElfPutValLine(X86Emitter* x, ElfRuntime* rt, bool r8, int end_addr)
+{
+    if(r8)
+    {
+        x->Bytes("\x49\x83\xE8\x05", 4);                            // sub r8, 5
+        x->Bytes("\x41\xC7\x00", 3); x->Int32(0x3A6C6156);          // mov dword [r8], "Val:"
+        x->Bytes("\x41\xC6\x40\x04\x20", 5);                        // mov byte [r8+4], ' '
+        x->Bytes("\x4C\x89\xC6", 3);                                // mov rsi, r8
+        x->Byte(0xBA); x->Int32(end_addr);                          // mov edx, end
+    }
+    else
+    {
+        x->Bytes("\x48\x83\xEF\x05", 4);                            // sub rdi, 5
+        x->Bytes("\xC7\x07", 2); x->Int32(0x3A6C6156);              // mov dword [rdi], "Val:"
+        x->Bytes("\xC6\x47\x04\x20", 4);                            // mov byte [rdi+4], ' '
+        x->Bytes("\x48\x89\xFE", 3);                                // mov rsi, rdi
+        x->Bytes("\x44\x89\xD2", 3);                                // mov edx, r10d (end)
+    }
+    x->Bytes("\x29\xF2", 2);                                        // sub edx, esi
+    x->Jmp(rt->put);
+}
+
+// write_int(edi), write_bool(edi) and write_real(xmm0)
+void ElfWriteRoutines(X86Emitter* x, ElfRuntime* rt)
+{
+    x->Bind(rt->write_bool);
+    x->Byte(0xBE); x->Int32(rt->true_line);                         // mov esi, "Val: true\n"
+    x->Byte(0xBA); x->Int32(10);                                    // mov edx, 10
+    x->Bytes("\x85\xFF", 2); x->Jcc(CC_NE, rt->put);               // test edi, edi
+    x->Byte(0xBE); x->Int32(rt->false_line);                        // mov esi, "Val: false\n"
+    x->Byte(0xBA); x->Int32(11);                                    // mov edx, 11
+    x->Jmp(rt->put);
+
+    // Digits are divided out of the 64-bit absolute value, so INT_MIN needs no care
+    int positive=x->NewLabel(), digit=x->NewLabel(), no_sign=x->NewLabel();
+    int end=ElfDataAddr(ELF_DIGITS+64);
+    x->Bind(rt->write_int);
+    x->Bytes("\x48\x63\xC7", 3);                                    // movsxd rax, edi
+    x->Bytes("\x49\x89\xC1", 3);                                    // mov r9, rax
+    x->Bytes("\x41\xB8", 2); x->Int32(end);                         // mov r8d, end
+    x->Bytes("\x41\xC6\x00\x0A", 4);                                // mov byte [r8], '\n'
+    x->Bytes("\x48\x85\xC0", 3); x->Jcc(CC_GE, positive);           // test rax, rax
+    x->Bytes("\x48\xF7\xD8", 3);                                    // neg rax
+    x->Bind(positive);
+    x->Byte(0xB9); x->Int32(10);                                    // mov ecx, 10
+    x->Bind(digit);
+    x->Bytes("\x31\xD2\x48\xF7\xF1", 5);                            // xor edx, edx; div rcx
+    x->Bytes("\x80\xC2\x30", 3);                                    // add dl, '0'
+    x->Bytes("\x49\xFF\xC8\x41\x88\x10", 6);                        // dec r8; mov [r8], dl
+    x->Bytes("\x48\x85\xC0", 3); x->Jcc(CC_NE, digit);              // test rax, rax
+    x->Bytes("\x4D\x85\xC9", 3); x->Jcc(CC_GE, no_sign);            // test r9, r9
+    x->Bytes("\x49\xFF\xC8\x41\xC6\x00\x2D", 7);                    // dec r8; mov byte [r8], '-'
+    x->Bind(no_sign);
+    ElfPutValLine(x, rt, true, end+1);
+
+    // A real is printed like printf("%lf"): its exact binary value m*2^e is scaled by
+    // 10^6 and rounded half to even into an integer of up to 18 limbs, whose decimal
+    // digits get a point before the last 6
+    int special=x->NewLabel(), subnormal=x->NewLabel(), scaled=x->NewLabel(), right=x->NewLabel();
+    int shift_ok=x->NewLabel(), shift_right=x->NewLabel(), rounded=x->NewLabel(), round_up=x->NewLabel();
+    int store=x->NewLabel(), clear=x->NewLabel(), shift_left=x->NewLabel(), shift_limb=x->NewLabel();
+    int convert=x->NewLabel(), group=x->NewLabel(), divide=x->NewLabel(), group_digit=x->NewLabel();
+    int test_zero=x->NewLabel(), strip=x->NewLabel(), point=x->NewLabel(), inf=x->NewLabel(), sign=x->NewLabel();
+    int prefix=x->NewLabel();
+    int limbs=ElfDataAddr(ELF_LIMBS), digits_end=ElfDataAddr(ELF_DIGITS_END);
+
+    x->Bind(rt->write_real);
+    x->Bytes("\x66\x48\x0F\x7E\xC0", 5);                            // movq rax, xmm0
+    x->Bytes("\x49\x89\xC1", 3);                                    // mov r9, rax (sign)
+    x->Bytes("\x48\x89\xC1\x48\xC1\xE9\x34", 7);                    // mov rcx, rax; shr rcx, 52
+    x->Bytes("\x81\xE1", 2); x->Int32(0x7FF);                       // and ecx, 0x7FF
+    x->Bytes("\x49\xBA", 2); x->Int64(0x000FFFFFFFFFFFFFLL);        // mov r10, mantissa mask
+    x->Bytes("\x4C\x21\xD0", 3);                                    // and rax, r10
+    x->Bytes("\x81\xF9", 2); x->Int32(0x7FF); x->Jcc(CC_E, special);// cmp ecx, 0x7FF
+    x->Bytes("\x85\xC9", 2); x->Jcc(CC_E, subnormal);               // test ecx, ecx
+    x->Bytes("\x48\x0F\xBA\xE8\x34", 5);                            // bts rax, 52
+    x->Bytes("\x81\xE9", 2); x->Int32(1075);                        // sub ecx, 1075
+    x->Jmp(scaled);
+    x->Bind(subnormal);
+    x->Byte(0xB9); x->Int32(-1074);                                 // mov ecx, -1074
+    x->Bind(scaled);
+    x->Bytes("\x41\xBB", 2); x->Int32(1000000);                     // mov r11d, 1000000
+    x->Bytes("\x49\xF7\xE3", 3);                                    // mul r11 (rdx:rax = m*10^6)
+    x->Bytes("\x85\xC9", 2); x->Jcc(CC_GE, store);                  // test ecx, ecx
+
+    // e<0: shift right by -e, at most 127 places (beyond that everything is below half)
+    x->Bind(right);
+    x->Bytes("\xF7\xD9", 2);                                        // neg ecx
+    x->Bytes("\x83\xF9\x7F", 3); x->Jcc(CC_BE, shift_ok);           // cmp ecx, 127
+    x->Byte(0xB9); x->Int32(127);                                   // mov ecx, 127
+    x->Bind(shift_ok);
+    x->Bytes("\x45\x31\xC0\x45\x31\xDB", 6);                        // xor r8d, r8d (round); xor r11d, r11d (sticky)
+    x->Bind(shift_right);
+    x->Bytes("\x4D\x09\xC3", 3);                                    // or r11, r8
+    x->Bytes("\x48\xD1\xEA\x48\xD1\xD8", 6);                        // shr rdx, 1; rcr rax, 1
+    x->Bytes("\x41\x0F\x92\xC0", 4);                                // setc r8b
+    x->Bytes("\xFF\xC9", 2); x->Jcc(CC_NE, shift_right);            // dec ecx
+    x->Bytes("\x4D\x85\xC0", 3); x->Jcc(CC_E, rounded);             // test r8, r8
+    x->Bytes("\x4D\x85\xDB", 3); x->Jcc(CC_NE, round_up);           // test r11, r11
+    x->Bytes("\xA8\x01", 2); x->Jcc(CC_E, rounded);                 // test al, 1
+    x->Bind(round_up);
+    x->Bytes("\x48\x83\xC0\x01\x48\x83\xD2\x00", 8);                // add rax, 1; adc rdx, 0
+    x->Bind(rounded);
+    x->Bytes("\x31\xC9", 2);                                        // xor ecx, ecx
+
+    // Limbs = rdx:rax shifted left by ecx
+    x->Bind(store);
+    ElfAbs(x, "\x48\x89\x04\x25", 4, limbs);                        // mov [limbs], rax
+    ElfAbs(x, "\x48\x89\x14\x25", 4, limbs+8);                      // mov [limbs+8], rdx
+    x->Byte(0xBF); x->Int32(limbs+16);                              // mov edi, limbs+16
+    x->Bytes("\x41\xB8", 2); x->Int32(ELF_NUM_LIMBS-2);             // mov r8d, limbs-2
+    x->Bind(clear);
+    x->Bytes("\x48\xC7\x07", 3); x->Int32(0);                       // mov qword [rdi], 0
+    x->Bytes("\x48\x83\xC7\x08", 4);                                // add rdi, 8
+    x->Bytes("\x41\xFF\xC8", 3); x->Jcc(CC_NE, clear);              // dec r8d
+    x->Bytes("\x85\xC9", 2); x->Jcc(CC_E, convert);                 // test ecx, ecx
+    x->Bind(shift_left);
+    x->Byte(0xBF); x->Int32(limbs);                                 // mov edi, limbs
+    x->Bytes("\x41\xB8", 2); x->Int32(ELF_NUM_LIMBS);               // mov r8d, limbs
+    x->Byte(0xF8);                                                  // clc
+    x->Bind(shift_limb);
+    x->Bytes("\x48\xD1\x17", 3);                                    // rcl qword [rdi], 1
+    x->Bytes("\x48\x8D\x7F\x08", 4);                                // lea rdi, [rdi+8]
+    x->Bytes("\x41\xFF\xC8", 3); x->Jcc(CC_NE, shift_limb);         // dec r8d
+    x->Bytes("\xFF\xC9", 2); x->Jcc(CC_NE, shift_left);             // dec ecx
+
+    // Groups of 9 digits are divided out, they are written backwards from digits_end
+    x->Bind(convert);
+    x->Byte(0xBF); x->Int32(digits_end);                            // mov edi, digits_end
+    x->Bind(group);
+    x->Byte(0xB9); x->Int32(ELF_NUM_LIMBS-1);                       // mov ecx, limbs-1
+    x->Bytes("\x31\xD2", 2);                                        // xor edx, edx
+    x->Bytes("\x41\xB8", 2); x->Int32(1000000000);                  // mov r8d, 10^9
+    x->Bind(divide);
+    ElfAbs(x, "\x48\x8B\x04\xCD", 4, limbs);                        // mov rax, [rcx*8+limbs]
+    x->Bytes("\x49\xF7\xF0", 3);                                    // div r8
+    ElfAbs(x, "\x48\x89\x04\xCD", 4, limbs);                        // mov [rcx*8+limbs], rax
+    x->Bytes("\xFF\xC9", 2); x->Jcc(CC_GE, divide);                 // dec ecx
+    x->Bytes("\x89\xD0", 2);                                        // mov eax, edx
+    x->Bytes("\x41\xB8", 2); x->Int32(9);                           // mov r8d, 9
+    x->Bytes("\x41\xBB", 2); x->Int32(10);                          // mov r11d, 10
+    x->Bind(group_digit);
+    x->Bytes("\x31\xD2\x41\xF7\xF3", 5);                            // xor edx, edx; div r11d
+    x->Bytes("\x80\xC2\x30", 3);                                    // add dl, '0'
+    x->Bytes("\x48\xFF\xCF\x88\x17", 5);                            // dec rdi; mov [rdi], dl
+    x->Bytes("\x41\xFF\xC8", 3); x->Jcc(CC_NE, group_digit);        // dec r8d
+    x->Byte(0xB9); x->Int32(ELF_NUM_LIMBS-1);                       // mov ecx, limbs-1
+    x->Bytes("\x31\xC0", 2);                                        // xor eax, eax
+    x->Bind(test_zero);
+    ElfAbs(x, "\x48\x0B\x04\xCD", 4, limbs);                        // or rax, [rcx*8+limbs]
+    x->Bytes("\xFF\xC9", 2); x->Jcc(CC_GE, test_zero);              // dec ecx
+    x->Bytes("\x48\x85\xC0", 3); x->Jcc(CC_NE, group);              // test rax, rax
+
+    // Leading zeros go, at least 7 digits stay ("0.000000")
+    x->Bind(strip);
+    x->Byte(0xB8); x->Int32(digits_end);                            // mov eax, digits_end
+    x->Bytes("\x29\xF8", 2);                                        // sub eax, edi
+    x->Bytes("\x83\xF8\x07", 3); x->Jcc(CC_BE, point);              // cmp eax, 7
+    x->Bytes("\x80\x3F\x30", 3); x->Jcc(CC_NE, point);              // cmp byte [rdi], '0'
+    x->Bytes("\x48\xFF\xC7", 3);                                    // inc rdi
+    x->Jmp(strip);
+    x->Bind(point);
+    ElfAbs(x, "\x8B\x04\x25", 3, digits_end-6);                     // mov eax, [end-6]
+    ElfAbs(x, "\x0F\xB7\x0C\x25", 4, digits_end-2);                 // movzx ecx, word [end-2]
+    ElfAbs(x, "\x89\x04\x25", 3, digits_end-5);                     // mov [end-5], eax
+    ElfAbs(x, "\x66\x89\x0C\x25", 4, digits_end-1);                 // mov [end-1], cx
+    ElfAbs(x, "\xC6\x04\x25", 3, digits_end-6); x->Byte('.');       // mov byte [end-6], '.'
+    ElfAbs(x, "\xC6\x04\x25", 3, digits_end+1); x->Byte('\n');      // mov byte [end+1], '\n'
+    x->Bytes("\x41\xBA", 2); x->Int32(digits_end+2);                // mov r10d, end+2
+    x->Jmp(sign);
+
+    // inf and nan, a zero mantissa is inf
+    x->Bind(special);
+    x->Byte(0xBF); x->Int32(digits_end-3);                          // mov edi, end-3
+    x->Bytes("\xC7\x07", 2); x->Int32(0x0A666E69);                  // mov dword [rdi], "inf\n"
+    x->Bytes("\x48\x85\xC0", 3); x->Jcc(CC_E, inf);                 // test rax, rax
+    x->Bytes("\xC7\x07", 2); x->Int32(0x0A6E616E);                  // mov dword [rdi], "nan\n"
+    x->Bind(inf);
+    x->Bytes("\x41\xBA", 2); x->Int32(digits_end+1);                // mov r10d, end+1
+
+    x->Bind(sign);
+    x->Bytes("\x4D\x85\xC9", 3); x->Jcc(CC_GE, prefix);             // test r9, r9
+    x->Bytes("\x48\xFF\xCF\xC6\x07\x2D", 6);                        // dec rdi; mov byte [rdi], '-'
+    x->Bind(prefix);
+    ElfPutValLine(x, rt, false, 0);
+}
+
+// peek: eax = next input byte, or -1 at the end of the input, without consuming it
+// Changes only rax, rcx, rdx, rsi, rdi and r11
+void ElfPeekRoutine(X86Emitter* x, ElfRuntime* rt)
+{
+    int have=x->NewLabel(), eof=x->NewLabel();
+    x->Bind(rt->peek);
+    ElfAbs(x, "\x8B\x04\x25", 3, ElfDataAddr(ELF_IN_POS));         // mov eax, [in_pos]
+    ElfAbs(x, "\x3B\x04\x25", 3, ElfDataAddr(ELF_IN_LEN));         // cmp eax, [in_len]
+    x->Jcc(CC_B, have);
+    x->Bytes("\x31\xC0\x31\xFF", 4);                                // xor eax, eax (read); xor edi, edi (stdin)
+    x->Byte(0xBE); x->Int32(ElfDataAddr(ELF_IN_BUF));               // mov esi, in_buf
+    x->Byte(0xBA); x->Int32(ELF_IO_SIZE);                           // mov edx, size
+    x->Bytes("\x0F\x05", 2);                                        // syscall
+    ElfAbs(x, "\xC7\x04\x25", 3, ElfDataAddr(ELF_IN_POS)); x->Int32(0);    // mov dword [in_pos], 0
+    x->Bytes("\x48\x85\xC0", 3); x->Jcc(CC_LE, eof);                // test rax, rax
+    ElfAbs(x, "\x89\x04\x25", 3, ElfDataAddr(ELF_IN_LEN));         // mov [in_len], eax
+    x->Bytes("\x31\xC0", 2);                                        // xor eax, eax
+    x->Bind(have);
+    ElfAbs(x, "\x0F\xB6\x80", 3, ElfDataAddr(ELF_IN_BUF));         // movzx eax, byte [rax+in_buf]
+    x->Byte(0xC3);                                                  // ret
+    x->Bind(eof);
+    ElfAbs(x, "\xC7\x04\x25", 3, ElfDataAddr(ELF_IN_LEN)); x->Int32(0);    // mov dword [in_len], 0
+    x->Byte(0xB8); x->Int32(-1);                                    // mov eax, -1
+    x->Byte(0xC3);                                                  // ret
+}
+
+// Consumes the byte returned by peek and peeks at the next one
+inline void ElfNextInput(X86Emitter* x, ElfRuntime* rt)
+{
+    ElfAbs(x, "\xFF\x04\x25", 3, ElfDataAddr(ELF_IN_POS));         // inc dword [in_pos]
+    x->Call(rt->peek);
+}
+
+// Consumes the letters of word, in any case, from the input (eax = the next byte),
+// jumps to fail at the first one that differs
+void ElfMatchWord(X86Emitter* x, ElfRuntime* rt, const char* word, int fail)
+{
+    for(;*word;word++)
+    {
+        x->Bytes("\x89\xC1\x83\xC9\x20", 5);                        // mov ecx, eax; or ecx, 0x20
+        x->Bytes("\x83\xF9", 2); x->Byte(*word); x->Jcc(CC_NE, fail);  // cmp ecx, letter
+        ElfNextInput(x, rt);
+    }
+}
+
+// read(rdi=prompt, esi=type, rdx=dest) prints the prompt and reads a value like
+// scanf("%d") or scanf("%lf"), a missing number reads as 0
+// Reals may also be spelled inf, infinity or nan, in any case, as scanf() reads them
+// Reals with up to 15 significant digits and a decimal exponent within 22 are
+// converted exactly (one correctly rounded multiply or divide), others may differ
+// from strtod() in the last bit
+void ElfReadRoutine(X86Emitter* x, ElfRuntime* rt)
+{
+    int ws=x->NewLabel(), skip=x->NewLabel(), ws_done=x->NewLabel(), negative=x->NewLabel();
+    int consume_sign=x->NewLabel(), sign_done=x->NewLabel(), int_digit=x->NewLabel(), int_done=x->NewLabel();
+    int int_store=x->NewLabel(), real=x->NewLabel(), real_digit=x->NewLabel(), not_point=x->NewLabel();
+    int significant=x->NewLabel(), extra=x->NewLabel(), real_next=x->NewLabel(), mantissa_done=x->NewLabel();
+    int exp_not_negative=x->NewLabel(), exp_sign=x->NewLabel(), exp_digit=x->NewLabel(), exp_skip=x->NewLabel();
+    int exp_done=x->NewLabel(), exp_add=x->NewLabel(), convert=x->NewLabel(), scale_up=x->NewLabel();
+    int scale_down=x->NewLabel(), scale_done=x->NewLabel(), divide=x->NewLabel(), real_sign=x->NewLabel();
+    int real_store=x->NewLabel(), done=x->NewLabel(), inf_word=x->NewLabel(), inf_value=x->NewLabel();
+    int nan_word=x->NewLabel(), nan_value=x->NewLabel(), no_number=x->NewLabel();
+
+    x->Bind(rt->read);
+    x->Bytes("\x41\x54\x41\x55\x41\x56\x41\x57", 8);                // push r12; push r13; push r14; push r15
+    x->Bytes("\x49\x89\xD4\x41\x89\xF5", 6);                        // mov r12, rdx (dest); mov r13d, esi (type)
+    x->Bytes("\x8B\x17\x48\x8D\x77\x04", 6);                        // mov edx, [rdi]; lea rsi, [rdi+4]
+    x->Call(rt->put);
+    x->Call(rt->flush);
+
+    // White space, then an optional sign (r14d = negative)
+    x->Call(rt->peek);
+    x->Bind(ws);
+    x->Bytes("\x83\xF8\x20", 3); x->Jcc(CC_E, skip);                // cmp eax, ' '
+    x->Bytes("\x83\xF8\x09", 3); x->Jcc(CC_B, ws_done);             // cmp eax, '\t'
+    x->Bytes("\x83\xF8\x0D", 3); x->Jcc(CC_A, ws_done);             // cmp eax, '\r'
+    x->Bind(skip);
+    ElfNextInput(x, rt);
+    x->Jmp(ws);
+    x->Bind(ws_done);
+    x->Bytes("\x45\x31\xF6", 3);                                    // xor r14d, r14d
+    x->Bytes("\x83\xF8\x2D", 3); x->Jcc(CC_E, negative);            // cmp eax, '-'
+    x->Bytes("\x83\xF8\x2B", 3); x->Jcc(CC_NE, sign_done);          // cmp eax, '+'
+    x->Jmp(consume_sign);
+    x->Bind(negative);
+    x->Bytes("\x41\xBE", 2); x->Int32(1);                           // mov r14d, 1
+    x->Bind(consume_sign);
+    ElfNextInput(x, rt);
+    x->Bind(sign_done);
+    x->Bytes("\x41\x83\xFD", 3); x->Byte(REAL); x->Jcc(CC_E, real); // cmp r13d, REAL
+
+    // Int (and bool): r15 accumulates the digits, stored truncated to 32 bits
+    x->Bytes("\x45\x31\xFF", 3);                                    // xor r15d, r15d
+    x->Bind(int_digit);
+    x->Bytes("\x83\xE8\x30\x83\xF8\x09", 6); x->Jcc(CC_A, int_done);// sub eax, '0'; cmp eax, 9
+    x->Bytes("\x4D\x6B\xFF\x0A\x49\x01\xC7", 7);                    // imul r15, r15, 10; add r15, rax
+    ElfNextInput(x, rt);
+    x->Jmp(int_digit);
+    x->Bind(int_done);
+    x->Bytes("\x45\x85\xF6", 3); x->Jcc(CC_E, int_store);           // test r14d, r14d
+    x->Bytes("\x49\xF7\xDF", 3);                                    // neg r15
+    x->Bind(int_store);
+    x->Bytes("\x45\x89\x3C\x24", 4);                                // mov [r12], r15d
+    x->Jmp(done);
+
+    // Real: r15 = up to 18 significant digits, r8d = decimal exponent,
+    // r9d = significant digits, r10d = point seen
+    x->Bind(real);
+    x->Bytes("\x89\xC1\x83\xC9\x20", 5);                            // mov ecx, eax; or ecx, 0x20
+    x->Bytes("\x83\xF9\x69", 3); x->Jcc(CC_E, inf_word);             // cmp ecx, 'i'
+    x->Bytes("\x83\xF9\x6E", 3); x->Jcc(CC_E, nan_word);             // cmp ecx, 'n'
+    x->Bytes("\x45\x31\xFF\x45\x31\xC0\x45\x31\xC9\x45\x31\xD2", 12); // xor r15d, r8d, r9d, r10d
+    x->Bind(real_digit);
+    x->Bytes("\x83\xF8\x2E", 3); x->Jcc(CC_NE, not_point);          // cmp eax, '.'
+    x->Bytes("\x45\x85\xD2", 3); x->Jcc(CC_NE, mantissa_done);      // test r10d, r10d
+    x->Bytes("\x41\xBA", 2); x->Int32(1);                           // mov r10d, 1
+    x->Jmp(real_next);
+    x->Bind(not_point);
+    x->Bytes("\x83\xE8\x30\x83\xF8\x09", 6); x->Jcc(CC_A, mantissa_done); // sub eax, '0'; cmp eax, 9
+    x->Bytes("\x4D\x85\xFF", 3); x->Jcc(CC_NE, significant);        // test r15, r15
+    x->Bytes("\x85\xC0", 2); x->Jcc(CC_NE, significant);            // test eax, eax
+    x->Bytes("\x45\x85\xD2", 3); x->Jcc(CC_E, real_next);           // test r10d, r10d (leading zero)
+    x->Bytes("\x41\xFF\xC8", 3);                                    // dec r8d
+    x->Jmp(real_next);
+    x->Bind(significant);
+    x->Bytes("\x41\x83\xF9\x12", 4); x->Jcc(CC_AE, extra);          // cmp r9d, 18
+    x->Bytes("\x4D\x6B\xFF\x0A\x49\x01\xC7", 7);                    // imul r15, r15, 10; add r15, rax
+    x->Bytes("\x41\xFF\xC1", 3);                                    // inc r9d
+    x->Bytes("\x45\x85\xD2", 3); x->Jcc(CC_E, real_next);           // test r10d, r10d
+    x->Bytes("\x41\xFF\xC8", 3);                                    // dec r8d
+    x->Jmp(real_next);
+    x->Bind(extra);
+    x->Bytes("\x45\x85\xD2", 3); x->Jcc(CC_NE, real_next);          // test r10d, r10d
+    x->Bytes("\x41\xFF\xC0", 3);                                    // inc r8d
+    x->Bind(real_next);
+    ElfNextInput(x, rt);
+    x->Jmp(real_digit);
+
+    // Exponent: r13d = value (saturated), r10d = negative
+    x->Bind(mantissa_done);
+    x->Call(rt->peek);
+    x->Bytes("\x83\xC8\x20\x83\xF8\x65", 6); x->Jcc(CC_NE, convert);// or eax, 0x20; cmp eax, 'e'
+    ElfNextInput(x, rt);
+    x->Bytes("\x45\x31\xD2\x45\x31\xED", 6);                        // xor r10d, r10d; xor r13d, r13d
+    x->Bytes("\x83\xF8\x2D", 3); x->Jcc(CC_NE, exp_not_negative);   // cmp eax, '-'
+    x->Bytes("\x41\xBA", 2); x->Int32(1);                           // mov r10d, 1
+    x->Jmp(exp_sign);
+    x->Bind(exp_not_negative);
+    x->Bytes("\x83\xF8\x2B", 3); x->Jcc(CC_NE, exp_digit);          // cmp eax, '+'
+    x->Bind(exp_sign);
+    ElfNextInput(x, rt);
+    x->Bind(exp_digit);
+    x->Bytes("\x83\xE8\x30\x83\xF8\x09", 6); x->Jcc(CC_A, exp_done);// sub eax, '0'; cmp eax, 9
+    x->Bytes("\x41\x81\xFD", 3); x->Int32(100000); x->Jcc(CC_AE, exp_skip); // cmp r13d, 100000
+    x->Bytes("\x45\x6B\xED\x0A\x41\x01\xC5", 7);                    // imul r13d, r13d, 10; add r13d, eax
+    x->Bind(exp_skip);
+    ElfNextInput(x, rt);
+    x->Jmp(exp_digit);
+    x->Bind(exp_done);
+    x->Bytes("\x45\x85\xD2", 3); x->Jcc(CC_E, exp_add);             // test r10d, r10d
+    x->Bytes("\x41\xF7\xDD", 3);                                    // neg r13d
+    x->Bind(exp_add);
+    x->Bytes("\x45\x01\xE8", 3);                                    // add r8d, r13d
+
+    // xmm0 = r15 * 10^r8d
+    x->Bind(convert);
+    x->Bytes("\xF2\x49\x0F\x2A\xC7", 5);                            // cvtsi2sd xmm0, r15
+    x->Bytes("\x4D\x85\xFF", 3); x->Jcc(CC_E, real_sign);           // test r15, r15
+    x->Bind(scale_up);
+    x->Bytes("\x41\x83\xF8\x16", 4); x->Jcc(CC_LE, scale_down);     // cmp r8d, 22
+    ElfAbs(x, "\xF2\x0F\x59\x04\x25", 5, rt->pow10+22*8);           // mulsd xmm0, [10^22]
+    x->Bytes("\x41\x83\xE8\x16", 4);                                // sub r8d, 22
+    x->Jmp(scale_up);
+    x->Bind(scale_down);
+    x->Bytes("\x41\x83\xF8\xEA", 4); x->Jcc(CC_GE, scale_done);     // cmp r8d, -22
+    ElfAbs(x, "\xF2\x0F\x5E\x04\x25", 5, rt->pow10+22*8);           // divsd xmm0, [10^22]
+    x->Bytes("\x41\x83\xC0\x16", 4);                                // add r8d, 22
+    x->Jmp(scale_down);
+    x->Bind(scale_done);
+    x->Bytes("\x45\x85\xC0", 3); x->Jcc(CC_L, divide);              // test r8d, r8d
+    ElfAbs(x, "\xF2\x42\x0F\x59\x04\xC5", 6, rt->pow10);            // mulsd xmm0, [r8*8+pow10]
+    x->Jmp(real_sign);
+    x->Bind(divide);
+    x->Bytes("\x41\xF7\xD8", 3);                                    // neg r8d
+    ElfAbs(x, "\xF2\x42\x0F\x5E\x04\xC5", 6, rt->pow10);            // divsd xmm0, [r8*8+pow10]
+    x->Jmp(real_sign);
+
+    // inf or infinity
+    x->Bind(inf_word);
+    ElfMatchWord(x, rt, "inf", no_number);
+    x->Bytes("\x89\xC1\x83\xC9\x20", 5);                            // mov ecx, eax; or ecx, 0x20
+    x->Bytes("\x83\xF9\x69", 3); x->Jcc(CC_NE, inf_value);           // cmp ecx, 'i'
+    ElfNextInput(x, rt);
+    ElfMatchWord(x, rt, "nity", no_number);                         // like scanf(), "infin" is no number
+    x->Bind(inf_value);
+    x->Bytes("\x48\xB8", 2); x->Int64(0x7FF0000000000000LL);        // mov rax, +inf
+    x->Bytes("\x66\x48\x0F\x6E\xC0", 5);                            // movq xmm0, rax
+    x->Jmp(real_sign);
+
+    // nan (scanf() leaves a (chars) suffix that strtod() would take in the input)
+    x->Bind(nan_word);
+    ElfMatchWord(x, rt, "nan", no_number);
+    x->Bind(nan_value);
+    x->Bytes("\x48\xB8", 2); x->Int64(0x7FF8000000000000LL);        // mov rax, quiet nan
+    x->Bytes("\x66\x48\x0F\x6E\xC0", 5);                            // movq xmm0, rax
+    x->Jmp(real_sign);
+
+    x->Bind(no_number);
+    x->Bytes("\x0F\x57\xC0", 3);                                    // xorps xmm0, xmm0
+    x->Jmp(real_store);
+
+    x->Bind(real_sign);
+    x->Bytes("\x45\x85\xF6", 3); x->Jcc(CC_E, real_store);          // test r14d, r14d
+    x->Bytes("\x66\x48\x0F\x7E\xC0", 5);                            // movq rax, xmm0
+    x->Bytes("\x48\x0F\xBA\xF8\x3F", 5);                            // btc rax, 63
+    x->Bytes("\x66\x48\x0F\x6E\xC0", 5);                            // movq xmm0, rax
+    x->Bind(real_store);
+    x->Bytes("\xF2\x41\x0F\x11\x04\x24", 6);                        // movsd [r12], xmm0
+
+    x->Bind(done);
+    x->Bytes("\x41\x5F\x41\x5E\x41\x5D\x41\x5C", 8);                // pop r15; pop r14; pop r13; pop r12
+    x->Byte(0xC3);                                                  // ret
+}
+
+// Prints the error, flushes the output and aborts like the interpreter does
+void ElfDivZeroRoutine(X86Emitter* x, ElfRuntime* rt)
+{
+    x->Bind(rt->div_zero);
+    x->Byte(0xBE); x->Int32(rt->error_line);                        // mov esi, "ERROR Division by zero\n"
+    x->Byte(0xBA); x->Int32(23);                                    // mov edx, 23
+    x->Call(rt->put);
+    x->Call(rt->flush);
+    x->Byte(0xB8); x->Int32(39);                                    // mov eax, 39 (getpid)
+    x->Bytes("\x0F\x05", 2);                                        // syscall
+    x->Bytes("\x89\xC7", 2);                                        // mov edi, eax
+    x->Byte(0xBE); x->Int32(6);                                     // mov esi, 6 (SIGABRT)
+    x->Byte(0xB8); x->Int32(62);                                    // mov eax, 62 (kill)
+    x->Bytes("\x0F\x05", 2);                                        // syscall
+    x->Byte(0xB8); x->Int32(231);                                   // mov eax, 231 (exit_group)
+    x->Byte(0xBF); x->Int32(134);                                   // mov edi, 134
+    x->Bytes("\x0F\x05", 2);                                        // syscall
+}
+
+void ElfHalf(X86Emitter* b, int v) {b->Byte(v&0xFF); b->Byte((v>>8)&0xFF);}
+
+void ElfProgramHeader(X86Emitter* b, int type, int flags, int offset, int vaddr, int file_size, int mem_size)
+{
+    b->Int32(type); b->Int32(flags);
+    b->Int64(offset); b->Int64(vaddr); b->Int64(vaddr);
+    b->Int64(file_size); b->Int64(mem_size);
+    b->Int64(0x1000);
+}
+
+// Builds the executable, returns its size or 0 if the file cannot be written
+int EmitElf(TreeNode* syntax_tree, SymbolTable* symbol_table, const char* file_name, int* code_size)
+{
+    int i;
+    VariableLayout vars;
+    vars.Set(symbol_table);
+
+    // Constant data follows the headers: the read prompts, output lines and powers of ten
+    X86Emitter data;
+    ElfRuntime rt;
+    rt.prompts=new int[vars.num_vars+1];
+    for(i=0;i<vars.num_vars;i++)
+    {
+        char prompt[MAX_LINE_LENGTH+64];
+        snprintf(prompt, sizeof(prompt), "Enter %s (%s): ", vars.names[i], ExprDataTypeStr[vars.types[i]]);
+        int len=strlen(prompt);
+        rt.prompts[i]=ELF_TEXT_VADDR+ELF_HEADERS_SIZE+data.size;
+        data.Int32(len); data.Bytes(prompt, len);
+    }
+    rt.true_line=ELF_TEXT_VADDR+ELF_HEADERS_SIZE+data.size; data.Bytes("Val: true\n", 10);
+    rt.false_line=ELF_TEXT_VADDR+ELF_HEADERS_SIZE+data.size; data.Bytes("Val: false\n", 11);
+    rt.error_line=ELF_TEXT_VADDR+ELF_HEADERS_SIZE+data.size; data.Bytes("ERROR Division by zero\n", 23);
+    while(data.size%8) data.Byte(0);
+    rt.pow10=ELF_TEXT_VADDR+ELF_HEADERS_SIZE+data.size;
+    double p=1.0;
+    for(i=0;i<=22;i++) {long long bits; memcpy(&bits, &p, sizeof(bits)); data.Int64(bits); p*=10.0;}
+    while((ELF_HEADERS_SIZE+data.size)%16) data.Byte(0);
+    int code_offset=ELF_HEADERS_SIZE+data.size;
+
+    // _start calls the program with the frame in rdi, then flushes and exits
+    JitCompiler jc;
+    JitRegAlloc alloc;
+    X86Emitter* x=&jc.x;
+    jc.runtime=&rt;
+    jc.alloc=&alloc;
+    rt.write_int=x->NewLabel(); rt.write_real=x->NewLabel(); rt.write_bool=x->NewLabel(); rt.read=x->NewLabel();
+    rt.put=x->NewLabel(); rt.flush=x->NewLabel(); rt.peek=x->NewLabel(); rt.div_zero=x->NewLabel();
+    int program=x->NewLabel();
+
+    x->Byte(0xBF); x->Int32(ElfDataAddr(ELF_FRAME));                // mov edi, frame
+    x->Call(program);
+    x->Bytes("\x85\xC0", 2); x->Jcc(CC_NE, rt.div_zero);            // test eax, eax
+    x->Call(rt.flush);
+    x->Byte(0xB8); x->Int32(231);                                   // mov eax, 231 (exit_group)
+    x->Bytes("\x31\xFF\x0F\x05", 4);                                // xor edi, edi; syscall
+    x->Bind(program);
+    GenerateJit(&jc, syntax_tree, symbol_table);
+    ElfOutputRoutines(x, &rt);
+    ElfWriteRoutines(x, &rt);
+    ElfPeekRoutine(x, &rt);
+    ElfReadRoutine(x, &rt);
+    ElfDivZeroRoutine(x, &rt);
+    x->PatchJumps();
+    delete[] rt.prompts;
+
+    int file_size=code_offset+x->size;
+    int data_size=ELF_FRAME+(vars.num_vars+1)*sizeof(VMValue);
+
+    X86Emitter file;
+    file.Bytes("\x7F" "ELF\x02\x01\x01", 7);                        // 64-bit, little-endian, version 1
+    while(file.size<16) file.Byte(0);
+    ElfHalf(&file, 2); ElfHalf(&file, 62); file.Int32(1);           // ET_EXEC, EM_X86_64, version
+    file.Int64(ELF_TEXT_VADDR+code_offset);                         // entry
+    file.Int64(64); file.Int64(0); file.Int32(0);                   // program headers, no sections, flags
+    ElfHalf(&file, 64); ElfHalf(&file, 56); ElfHalf(&file, 3);      // header size, program header size and count
+    ElfHalf(&file, 64); ElfHalf(&file, 0); ElfHalf(&file, 0);       // no section headers
+    ElfProgramHeader(&file, 1, 5, 0, ELF_TEXT_VADDR, file_size, file_size);     // PT_LOAD, R+X
+    ElfProgramHeader(&file, 1, 6, 0, ELF_DATA_VADDR, 0, data_size);             // PT_LOAD, R+W, zeroed
+    ElfProgramHeader(&file, 0x6474E551, 6, 0, 0, 0, 0);                         // PT_GNU_STACK, not executable
+    file.Bytes((const char*)data.buf, data.size);
+    file.Bytes((const char*)x->buf, x->size);
+
+    OutFile out(file_name);
+    if(!out.file || fwrite(file.buf, 1, file.size, out.file)!=(size_t)file.size) return 0;
+#ifdef TINY_MMAP
+    fchmod(fileno(out.file), 0755);
+#endif
+    *code_size=x->size;
+    return file.size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Benchmark ///////////////////////////////////////////////////////////////////////
+
+bool ContainsRead(TreeNode* node)
+{
+    int i;
+    if(!node) return false;
+    if(node->node_kind==READ_NODE) return true;
+    for(i=0;i<MAX_CHILDREN;i++) if(ContainsRead(node->child[i])) return true;
+    return ContainsRead(node->sibling);
+}
+
+void PrintBenchResult(Engine engine, Dispatch dispatch, int runs, long long count, clock_t ticks)
+{
+    double ms=1000.0*(double)ticks/CLOCKS_PER_SEC;
+    printf("[Engine=%s][Dispatch=%s][Runs=%d][Instructions=%lld][Time=%.3lf ms][PerInstruction=%.3lf ns]\n",
+           EngineStr[engine], DispatchStr[dispatch], runs, count, ms, count>0 ? 1e6*ms/(double)count : 0.0);
+}
+
+// Runs the program runs times on each virtual machine with each dispatch strategy
+// compiled into this build, the program's output is discarded
+void Benchmark(TreeNode* syntax_tree, SymbolTable* symbol_table, int runs)
+{
+    int d, r, i;
+
+    if(ContainsRead(syntax_tree))
+    {
+        printf("ERROR Cannot benchmark a program that reads input\n");
+        return;
+    }
+
+    BytecodeProgram stack_prog;
+    GenerateBytecode(&stack_prog, syntax_tree, symbol_table);
+    RegProgram reg_prog;
+    GenerateRegCode(&reg_prog, syntax_tree, symbol_table);
+    VMValue* slots=new VMValue[reg_prog.num_regs+1];
+
+    discard_output=true;
+    for(d=0;d<NUM_DISPATCHES;d++)
+    {
+        long long count=0;
+        clock_t start=clock();
+        for(r=0;r<runs;r++)
+        {
+            for(i=0;i<stack_prog.vars.num_vars;i++) slots[i].r=0.0;
+            count+=RunBytecode(&stack_prog, slots, (Dispatch)d);
+        }
+        PrintBenchResult(ENGINE_VM, (Dispatch)d, runs, count, clock()-start);
+
+        count=0;
+        start=clock();
+        for(r=0;r<runs;r++)
+        {
+            for(i=0;i<reg_prog.num_regs;i++) slots[i].r=0.0;
+            count+=RunRegCode(&reg_prog, slots, (Dispatch)d);
+        }
+        PrintBenchResult(ENGINE_REG, (Dispatch)d, runs, count, clock()-start);
+    }
+    discard_output=false;
+
+    delete[] slots;
+}
+
+void RunOnEngine(Engine engine, TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    if(engine==ENGINE_VM) RunVM(syntax_tree, symbol_table, options);
+    else if(engine==ENGINE_REG) RunRegVM(syntax_tree, symbol_table, options);
+    else if(engine==ENGINE_JIT) RunJIT(syntax_tree, symbol_table, options);
+    else if(engine==ENGINE_CLOSURE) RunClosures(syntax_tree, symbol_table, options);
+    else if(engine==ENGINE_TM) RunTM(syntax_tree, symbol_table, options);
+    else if(engine==ENGINE_TIERED) RunTiered(syntax_tree, symbol_table, options);
+    else if(engine==ENGINE_TRACE) RunTraced(syntax_tree, symbol_table, options);
+    else RunProgram(syntax_tree, symbol_table);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Self Test ///////////////////////////////////////////////////////////////////////
+
+// --self-test: every rule of SimplifyAlgebra() is applied to an expression built for
+// it, and the result is compared with the expected tree. Each rule also has a case it
+// must leave alone. a and b are int variables, x is a real one, y is undefined. Then the regression
+// programs run on the engines and their output is compared.
+
+TreeNode* TestId(const char* id, ExprDataType type)
+{
+    TreeNode* node=new TreeNode;
+    node->node_kind=ID_NODE;
+    AllocateAndCopy(&node->id, id);
+    node->expr_data_type=node->var_type=type;
+    return node;
+}
+
+TreeNode* TestInt(int v) {return ValueNode(TypedValue(v), 0);}
+TreeNode* TestReal(double v) {return ValueNode(TypedValue(v), 0);}
+TreeNode* TestOper(TokenType oper, ExprDataType type, TreeNode* a, TreeNode* b) {return NewOperNode(oper, type, a, b, 0);}
+
+TreeNode* A() {return TestId("a", INTEGER);}
+TreeNode* B() {return TestId("b", INTEGER);}
+TreeNode* X() {return TestId("x", REAL);}
+
+bool SameTree(TreeNode* a, TreeNode* b)
+{
+    if(a->node_kind!=b->node_kind || a->expr_data_type!=b->expr_data_type) return false;
+    if(a->node_kind==ID_NODE) return Equals(a->id, b->id);
+    if(a->node_kind==NUM_NODE) return IRSameConst(ConstValue(a), ConstValue(b));
+    return a->oper==b->oper && SameTree(a->child[0], b->child[0]) && SameTree(a->child[1], b->child[1]);
+}
+
+// Simplifies expr as the operand of a write, expected is 0 if no rule may apply
+bool CheckAlgebraRule(const char* name, TreeNode* expr, TreeNode* expected, SymbolTable* symbol_table, bool exact_types)
+{
+    TreeNode* stmt=new TreeNode;
+    stmt->node_kind=WRITE_NODE;
+    stmt->child[0]=expr;
+    TreeNode* original=CopyTree(expr);
+
+    int applied=SimplifyAlgebra(stmt, symbol_table, exact_types);
+    bool ok=expected ? applied>0 && SameTree(stmt->child[0], expected) : applied==0 && SameTree(stmt->child[0], original);
+    printf("[Test=%s][Result=%s]\n", name, ok ? "Pass" : "Fail");
+
+    DestroyTree(stmt);
+    DestroyTree(original);
+    if(expected) DestroyTree(expected);
+    return ok;
+}
+
+// Programs run by --self-test at every optimization level on every engine, each must
+// print expected, its output on the tree interpreter without optimization. A runtime
+// error ends the output with the error message.
+struct TestProgram
+{
+    const char* name;
+    const char* source;
+    bool statically_typed;  // whether the compiled engines and backends may run it
+    const char* expected;
+};
+
+TestProgram test_programs[]=
+            {
+                // A declaration that changes the type of its variable
+                {"Redeclaration",
+                 "int x; real x := 0.1; write x; bool b; int b := 5; write b; real r; int r := 7; write r",
+                 false, "Val: 0\nVal: false\nVal: 7.000000\n"},
+                // Declarations that keep the type stay compiled
+                {"RedeclarationSameType",
+                 "int x; int x := 3; real y := 0.5; real y := y + 1; write x; write y",
+                 true, "Val: 3\nVal: 1.500000\n"},
+                // Redeclarations in a loop, which the tiered engines compile after one backedge
+                {"RedeclarationInLoop",
+                 "int i := 0; real s := 0.0; repeat int i := i + 1; real s := s + 0.5 until i = 4; write i; write s",
+                 true, "Val: 4\nVal: 2.000000\n"},
+                // Reading a variable that is never declared or assigned fails, even
+                // where the value is not used
+                {"UndefinedVariable", "int z; z := y; write 1", false, "ERROR Undefined variable 'y'\n"},
+                // A dead store whose value reads an undefined variable
+                {"UndefinedVariableDeadStore", "int x; x := y; x := 1; write x", false, "ERROR Undefined variable 'y'\n"},
+                // x * 0 is only 0 if x can be evaluated
+                {"UndefinedVariableTimesZero", "write y * 0", false, "ERROR Undefined variable 'y'\n"},
+                // Operations the compiler must not evaluate: INT_MIN / -1 traps, and a
+                // real power with a huge exponent takes seconds
+                {"DivisionOverflowNotTaken",
+                 "int x; x := 1; if x > 2 then write (0 - 2147483647 - 1) / (0 - 1) end; write x",
+                 true, "Val: 1\n"},
+                {"LargeRealPowerNotTaken",
+                 "int x; x := 1; if x > 2 then write 2.0 ^ 2000000000 end; write x",
+                 true, "Val: 1\n"},
+                // Only SSA constant propagation sees both operands, and cannot tell that the
+                // branch is never taken
+                {"DivisionOverflowSSA",
+                 "int i; int a; int b; i := 0; a := 0 - 2147483647 - 1; b := 0 - 1;"
+                 "repeat i := i + 1 until i * i > 8; if i > 5 then write a / b end; write i",
+                 true, "Val: 3\n"},
+            };
+
+#define NUM_TEST_PROGRAMS ((int)(sizeof(test_programs)/sizeof(test_programs[0])))
+
+// Engines the test programs run on
+Engine test_engines[]={ENGINE_TREE, ENGINE_VM, ENGINE_REG, ENGINE_JIT, ENGINE_CLOSURE, ENGINE_TM, ENGINE_TIERED, ENGINE_TRACE};
+
+#define NUM_TEST_ENGINES ((int)(sizeof(test_engines)/sizeof(test_engines[0])))
+
+// Backends whose translation of the test programs is run as well, where it can run here
+Emit test_backends[]={EMIT_C, EMIT_IMAGE, EMIT_ELF};
+
+#define NUM_TEST_BACKENDS ((int)(sizeof(test_backends)/sizeof(test_backends[0])))
+
+#define MAX_TEST_OUTPUT 4096
+
+// Makes compiler_info read source, its debug output is discarded
+void SetTestSource(CompilerInfo* compiler_info, const char* source)
+{
+    compiler_info->in_file.file=tmpfile();
+    fputs(source, compiler_info->in_file.file);
+    rewind(compiler_info->in_file.file);
+    compiler_info->debug_file.file=tmpfile();
+}
+
+#ifdef TINY_CAPTURE
+int saved_stdout=-1;
+FILE* capture_file=0;
+
+// Sends stdout to a temporary file until EndCapture()
+void BeginCapture()
+{
+    fflush(stdout);
+    capture_file=tmpfile();
+    saved_stdout=dup(1);
+    dup2(fileno(capture_file), 1);
+}
+
+// Restores stdout and copies what was written since BeginCapture() to buf
+void EndCapture(char* buf, int size)
+{
+    fflush(stdout);
+    dup2(saved_stdout, 1);
+    close(saved_stdout);
+    rewind(capture_file);
+    int n=fread(buf, 1, size-1, capture_file);
+    buf[n]=0;
+    fclose(capture_file);
+}
+
+// Whether the translation of backend emit can be run on this machine
+bool TestBackendAvailable(Emit emit)
+{
+    if(emit==EMIT_C) return system("cc --version >/dev/null 2>&1")==0;
+#if defined(__x86_64__) && defined(__linux__)
+    if(emit==EMIT_ELF) return true;
+#endif
+    return emit==EMIT_IMAGE;
+}
+
+// Translates the program with backend emit to a temporary file and runs the result,
+// which prints to stdout
+void RunTranslation(Emit emit, TreeNode* syntax_tree, SymbolTable* symbol_table, CompilerOptions* options)
+{
+    char file_name[]="/tmp/tinyXXXXXX";
+    int fd=mkstemp(file_name);
+    if(fd<0) {printf("ERROR Cannot create a temporary file\n"); return;}
+    close(fd);
+
+    char exe_name[sizeof(file_name)+4], command[3*sizeof(file_name)+64];
+    sprintf(exe_name, "%s.out", file_name);
+    fflush(NULL);
+    if(emit==EMIT_C && EmitC(syntax_tree, symbol_table, file_name))
+    {
+        sprintf(command, "cc -O2 -w -x c -o %s %s -lm", exe_name, file_name);
+        if(system(command)==0) {system(exe_name); remove(exe_name);}
+    }
+    if(emit==EMIT_IMAGE)
+    {
+        RegProgram prog;
+        GenerateRegCode(&prog, syntax_tree, symbol_table);
+        if(WriteImage(&prog, file_name)) RunImage(file_name, options);
+    }
+    int code_size;
+    if(emit==EMIT_ELF && EmitElf(syntax_tree, symbol_table, file_name, &code_size) && chmod(file_name, 0755)==0)
+        system(file_name);
+    remove(file_name);
+}
+
+// Compiles test at opt_level, runs it on engine with dispatch, or its translation by
+// backend emit if that is not EMIT_NONE, and copies what the program printed to output.
+// Returns whether the program is statically typed.
+bool RunTestProgram(TestProgram* test, int opt_level, Engine engine, Dispatch dispatch, Emit emit, char* output)
+{
+    CompilerInfo compiler_info(0, 0, 0);
+    SetTestSource(&compiler_info, test->source);
+    CompilerOptions* options=&compiler_info.options;
+    options->opt_level=opt_level;
+    options->engine=engine;
+    options->dispatch=dispatch;
+    options->emit=emit;
+    options->tier_threshold=1;
+
+    char text[MAX_TEST_OUTPUT];
+    TreeNode* syntax_tree=0;
+    SymbolTable symbol_table;
+    bool statically_typed=false;
+    BeginCapture();
+    try
+    {
+        syntax_tree=Parse(&compiler_info);
+        Analyze(syntax_tree, &symbol_table);
+        RunOptimizer(&syntax_tree, &symbol_table, options);
+        statically_typed=IsStaticallyTyped(syntax_tree, &symbol_table);
+        printf("Run Program:\n");
+        // Backends only translate statically typed programs, like --emit=
+        if(emit!=EMIT_NONE && statically_typed) RunTranslation(emit, syntax_tree, &symbol_table, options);
+        else RunOnEngine(statically_typed ? engine : ENGINE_TREE, syntax_tree, &symbol_table, options);
+    }
+    catch(int) {}
+    EndCapture(text, MAX_TEST_OUTPUT);
+
+    const char* run=strstr(text, "Run Program:\n");
+    Copy(output, run ? run+13 : text, MAX_TEST_OUTPUT-1);
+    symbol_table.Destroy();
+    if(syntax_tree) DestroyTree(syntax_tree);
+    return statically_typed;
+}
+
+bool test_backend_available[NUM_TEST_BACKENDS];
+
+// Runs test at every optimization level on every test engine, the virtual machines
+// with every dispatch strategy, and through every available test backend
+bool CheckTestProgram(TestProgram* test)
+{
+    char output[MAX_TEST_OUTPUT];
+    int level, e, d, runs=0;
+    bool ok=true;
+    for(level=0;level<=DEFAULT_OPT_LEVEL;level++)
+    {
+        for(e=0;e<NUM_TEST_ENGINES;e++)
+        {
+            Engine engine=test_engines[e];
+            int num_dispatches=engine==ENGINE_VM || engine==ENGINE_REG ? NUM_DISPATCHES : 1;
+            for(d=0;d<num_dispatches;d++)
+            {
+                Dispatch dispatch=num_dispatches>1 ? (Dispatch)d : DEFAULT_DISPATCH;
+                bool statically_typed=RunTestProgram(test, level, engine, dispatch, EMIT_NONE, output);
+                runs++;
+                if(statically_typed==test->statically_typed && Equals(output, test->expected)) continue;
+                printf("[Test=%s][Level=-O%d][Engine=%s][Dispatch=%s][Result=Fail]\n",
+                       test->name, level, EngineStr[engine], DispatchStr[dispatch]);
+                ok=false;
+            }
+        }
+        for(e=0;e<NUM_TEST_BACKENDS;e++)
+        {
+            if(!test_backend_available[e]) continue;
+            bool statically_typed=RunTestProgram(test, level, ENGINE_TREE, DEFAULT_DISPATCH, test_backends[e], output);
+            runs++;
+            if(statically_typed==test->statically_typed && Equals(output, test->expected)) continue;
+            printf("[Test=%s][Level=-O%d][Backend=%s][Result=Fail]\n", test->name, level, EmitStr[test_backends[e]]);
+            ok=false;
+        }
+    }
+    printf("[Test=%s][Runs=%d][Result=%s]\n", test->name, runs, ok ? "Pass" : "Fail");
+    return ok;
+}
+#endif
+
+bool ContainsOper(TreeNode* node, TokenType oper)
+{
+    int i;
+    if(!node) return false;
+    if(node->node_kind==OPER_NODE && node->oper==oper) return true;
+    for(i=0;i<MAX_CHILDREN;i++) if(ContainsOper(node->child[i], oper)) return true;
+    return ContainsOper(node->sibling, oper);
+}
+
+// Specializes source for the known input, which must use inputs_used values and
+// leave a division in the residual program
+bool CheckSpecialization(const char* name, const char* source, const char* known, int inputs_used)
+{
+    CompilerInfo compiler_info(0, 0, 0);
+    SetTestSource(&compiler_info, source);
+    FILE* inputs=tmpfile();
+    fputs(known, inputs);
+    rewind(inputs);
+
+    TreeNode* syntax_tree=0;
+    SymbolTable symbol_table;
+    bool ok=false;
+    try
+    {
+        syntax_tree=Parse(&compiler_info);
+        Analyze(syntax_tree, &symbol_table);
+        int used=Specialize(&syntax_tree, &symbol_table, inputs);
+        ok=used==inputs_used && ContainsOper(syntax_tree, DIVIDE);
+    }
+    catch(int) {}
+    printf("[Test=%s][Result=%s]\n", name, ok ? "Pass" : "Fail");
+
+    fclose(inputs);
+    symbol_table.Destroy();
+    if(syntax_tree) DestroyTree(syntax_tree);
+    return ok;
+}
+
+// Checks whether MayFail() reports that expr can stop the program
+bool CheckMayFail(const char* name, TreeNode* expr, SymbolTable* symbol_table, bool expected)
+{
+    bool ok=MayFail(expr, symbol_table)==expected;
+    printf("[Test=%s][Result=%s]\n", name, ok ? "Pass" : "Fail");
+    DestroyTree(expr);
+    return ok;
+}
+
+bool RunSelfTests()
+{
+    int failed=0, total=0;
+    SymbolTable symbol_table;
+    symbol_table.Insert("a", 0, INTEGER);
+    symbol_table.Insert("b", 0, INTEGER);
+    symbol_table.Insert("x", 0, REAL);
+#define ALGEBRA_TEST(name, expr, expected, exact_types) \
+    {total++; if(!CheckAlgebraRule(name, expr, expected, &symbol_table, exact_types)) failed++;}
+
+    ALGEBRA_TEST("AndToSquares", TestOper(AND_OP, INTEGER, A(), B()),
+                 TestOper(TIMES, INTEGER, TestOper(MINUS, INTEGER, A(), B()), TestOper(PLUS, INTEGER, A(), B())), true);
+    ALGEBRA_TEST("AndOfExpression", TestOper(AND_OP, INTEGER, TestOper(PLUS, INTEGER, A(), B()), B()), 0, true);
+    ALGEBRA_TEST("AndOfReals", TestOper(AND_OP, REAL, X(), X()), 0, true);
+
+    ALGEBRA_TEST("SquareInt", TestOper(POWER, INTEGER, A(), TestInt(2)), TestOper(TIMES, INTEGER, A(), A()), false);
+    ALGEBRA_TEST("SquareReal", TestOper(POWER, REAL, X(), TestInt(2)), TestOper(TIMES, REAL, X(), X()), true);
+    ALGEBRA_TEST("SquareRealDynamic", TestOper(POWER, REAL, X(), TestInt(2)), 0, false);
+    ALGEBRA_TEST("SquareOfExpression", TestOper(POWER, INTEGER, TestOper(PLUS, INTEGER, A(), B()), TestInt(2)), 0, true);
+    ALGEBRA_TEST("CubeInt", TestOper(POWER, INTEGER, A(), TestInt(3)),
+                 TestOper(TIMES, INTEGER, TestOper(TIMES, INTEGER, A(), A()), A()), false);
+    ALGEBRA_TEST("CubeReal", TestOper(POWER, REAL, X(), TestInt(3)), 0, true);
+    ALGEBRA_TEST("FourthPower", TestOper(POWER, INTEGER, A(), TestInt(4)), 0, true);
+
+    ALGEBRA_TEST("TimesOne", TestOper(TIMES, INTEGER, A(), TestInt(1)), A(), false);
+    ALGEBRA_TEST("OneTimes", TestOper(TIMES, INTEGER, TestInt(1), A()), A(), false);
+    ALGEBRA_TEST("TimesOneReal", TestOper(TIMES, REAL, X(), TestReal(1.0)), X(), true);
+    ALGEBRA_TEST("TimesOneRealDynamic", TestOper(TIMES, REAL, X(), TestReal(1.0)), 0, false);
+    ALGEBRA_TEST("IntTimesRealOne", TestOper(TIMES, REAL, A(), TestReal(1.0)), 0, true);
+
+    ALGEBRA_TEST("TimesZero", TestOper(TIMES, INTEGER, A(), TestInt(0)), TestInt(0), false);
+    ALGEBRA_TEST("ZeroTimes", TestOper(TIMES, INTEGER, TestInt(0), A()), TestInt(0), false);
+    ALGEBRA_TEST("TimesZeroMayFail", TestOper(TIMES, INTEGER, TestOper(DIVIDE, INTEGER, A(), B()), TestInt(0)), 0, true);
+    ALGEBRA_TEST("TimesZeroUndefined", TestOper(TIMES, INTEGER, TestId("y", INTEGER), TestInt(0)), 0, true);
+    ALGEBRA_TEST("TimesZeroReal", TestOper(TIMES, REAL, X(), TestReal(0.0)), 0, true);
+
+    ALGEBRA_TEST("PlusZero", TestOper(PLUS, INTEGER, A(), TestInt(0)), A(), false);
+    ALGEBRA_TEST("ZeroPlus", TestOper(PLUS, INTEGER, TestInt(0), A()), A(), false);
+    ALGEBRA_TEST("PlusZeroReal", TestOper(PLUS, REAL, X(), TestReal(0.0)), 0, true);
+
+    ALGEBRA_TEST("MinusZero", TestOper(MINUS, INTEGER, A(), TestInt(0)), A(), false);
+    ALGEBRA_TEST("MinusZeroReal", TestOper(MINUS, REAL, X(), TestReal(0.0)), X(), true);
+    ALGEBRA_TEST("ZeroMinus", TestOper(MINUS, INTEGER, TestInt(0), A()), 0, true);
+
+    ALGEBRA_TEST("DoubleNegation", TestOper(MINUS, INTEGER, TestInt(0), TestOper(MINUS, INTEGER, TestInt(0), A())), A(), false);
+    ALGEBRA_TEST("DoubleNegationReal",
+                 TestOper(MINUS, REAL, TestReal(0.0), TestOper(MINUS, REAL, TestReal(0.0), X())), 0, true);
+#undef ALGEBRA_TEST
+
+#define MAY_FAIL_TEST(name, expr, expected) {total++; if(!CheckMayFail(name, expr, &symbol_table, expected)) failed++;}
+    MAY_FAIL_TEST("DivideByMinusOne", TestOper(DIVIDE, INTEGER, A(), TestInt(-1)), true);
+    MAY_FAIL_TEST("IntMinDivideByMinusOne", TestOper(DIVIDE, INTEGER, TestInt(-2147483647-1), TestInt(-1)), true);
+    MAY_FAIL_TEST("ConstantDivideByMinusOne", TestOper(DIVIDE, INTEGER, TestInt(5), TestInt(-1)), false);
+    MAY_FAIL_TEST("RealDivideByMinusOne", TestOper(DIVIDE, REAL, X(), TestInt(-1)), false);
+    MAY_FAIL_TEST("UndefinedVariable", TestOper(PLUS, INTEGER, TestId("y", INTEGER), TestInt(1)), true);
+#undef MAY_FAIL_TEST
+
+    // m is only known at runtime, so the branch is specialized with n = 0 and its
+    // INT_MIN / -1 must stay in the residual program
+    total++;
+    if(!CheckSpecialization("SpecializeDivisionOverflow",
+                            "int n; int m; read n; read m; if m > 2 then write (n - 2147483647 - 1) / (n - 1) end; write m",
+                            "0", 1)) failed++;
+    symbol_table.Destroy();
+
+#ifdef TINY_CAPTURE
+    int i;
+    for(i=0;i<NUM_TEST_BACKENDS;i++)
+    {
+        test_backend_available[i]=TestBackendAvailable(test_backends[i]);
+        if(!test_backend_available[i]) printf("[Backend=%s][Result=Skipped]\n", EmitStr[test_backends[i]]);
+    }
+    for(i=0;i<NUM_TEST_PROGRAMS;i++) {total++; if(!CheckTestProgram(&test_programs[i])) failed++;}
+#else
+    printf("[Test=Programs][Result=Skipped]\n");
+#endif
+
+    printf("[Tests=%d][Failed=%d]\n", total, failed);
+    return failed==0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Scanner and Compiler ////////////////////////////////////////////////////////////
+
+void StartCompiler(CompilerInfo* pci)
+{
+    TreeNode* syntax_tree=Parse(pci);
+
+    SymbolTable symbol_table;
+    Analyze(syntax_tree, &symbol_table);
+
+    printf("Symbol Table:\n");
+    symbol_table.Print();
+    printf("---------------------------------\n"); fflush(NULL);
+
+    printf("Syntax Tree:\n");
+    PrintTree(syntax_tree);
+    printf("---------------------------------\n"); fflush(NULL);
+
+    if(pci->options.specialize_str)
+    {
+        FILE* inputs=fopen(pci->options.specialize_str, "r");
+        if(!inputs)
+        {
+            printf("ERROR Cannot open known input file '%s'\n", pci->options.specialize_str);
+            throw 0;
+        }
+        int size=syntax_tree ? CountListNodes(syntax_tree) : 0;
+        int used=Specialize(&syntax_tree, &symbol_table, inputs);
+        fclose(inputs);
+
+        printf("Residual Program:\n");
+        printf("[InputsUsed=%d][Size=%d->%d]\n", used, size, syntax_tree ? CountListNodes(syntax_tree) : 0);
+        if(syntax_tree) PrintTree(syntax_tree);
+        printf("---------------------------------\n"); fflush(NULL);
+    }
+
+    printf("Optimizer:\n");
+    RunOptimizer(&syntax_tree, &symbol_table, &pci->options);
+    printf("---------------------------------\n"); fflush(NULL);
+
+    bool statically_typed=IsStaticallyTyped(syntax_tree, &symbol_table);
+
+    if(pci->options.disasm && statically_typed)
+    {
+        RegProgram prog;
+        GenerateRegCode(&prog, syntax_tree, &symbol_table);
+        printf("Register Code:\n");
+        PrintRegCode(&prog);
+        printf("---------------------------------\n"); fflush(NULL);
+    }
+
+    if(pci->options.emit==EMIT_C)
+    {
+        printf("C Code:\n");
+        if(!statically_typed) printf("ERROR Only statically typed programs can be translated to C\n");
+        else if(!EmitC(syntax_tree, &symbol_table, "output.c")) printf("ERROR Cannot create output.c\n");
+        else printf("Written to output.c, compile with: cc -O2 output.c\n");
+        printf("---------------------------------\n"); fflush(NULL);
+    }
+
+    if(pci->options.emit==EMIT_TM)
+    {
+        printf("TM Code:\n");
+        if(!statically_typed) printf("ERROR Only statically typed programs can be compiled to TM code\n");
+        else if(!EmitTM(syntax_tree, &symbol_table, "output.tm")) printf("ERROR Cannot create output.tm\n");
+        else printf("Written to output.tm\n");
+        printf("---------------------------------\n"); fflush(NULL);
+    }
+
+    if(pci->options.emit==EMIT_IMAGE)
+    {
+        printf("Image:\n");
+        if(!statically_typed) printf("ERROR Only statically typed programs can be compiled to an image\n");
+        else
+        {
+            RegProgram prog;
+            GenerateRegCode(&prog, syntax_tree, &symbol_table);
+            int size=WriteImage(&prog, "output.img");
+            if(!size) printf("ERROR Cannot create output.img\n");
+            else printf("[Version=%d][Bytes=%d][Instructions=%d][Constants=%d][Variables=%d][Lines=%d]\n"
+                        "Written to output.img, run with: --run-image=output.img\n",
+                        IMAGE_VERSION, size, prog.code_size, prog.num_consts, prog.vars.num_vars, prog.num_lines);
+        }
+        printf("---------------------------------\n"); fflush(NULL);
+    }
+
+    if(pci->options.emit==EMIT_ELF)
+    {
+        printf("ELF Executable:\n");
+        int code_size=0, size=0;
+        if(!statically_typed) printf("ERROR Only statically typed programs can be compiled to an executable\n");
+        else if(!(size=EmitElf(syntax_tree, &symbol_table, "output.elf", &code_size))) printf("ERROR Cannot create output.elf\n");
+        else printf("[Bytes=%d][CodeBytes=%d]\nWritten to output.elf, run with: ./output.elf\n", size, code_size);
+        printf("---------------------------------\n"); fflush(NULL);
+    }
+
+    if(pci->options.bench_runs>0)
+    {
+        printf("Benchmark:\n");
+        if(statically_typed) Benchmark(syntax_tree, &symbol_table, pci->options.bench_runs);
+        else printf("ERROR Only statically typed programs can be benchmarked\n");
+        printf("---------------------------------\n"); fflush(NULL);
+
+        symbol_table.Destroy();
+        if(syntax_tree) DestroyTree(syntax_tree);
+        return;
+    }
+
+    printf("Run Program:\n");
+    Engine engine=pci->options.engine;
+    if(engine!=ENGINE_TREE && !statically_typed)
+    {
+        fprintf(stderr, "Note: program is not statically typed, running it on the tree engine\n");
+        engine=ENGINE_TREE;
+    }
+    RunOnEngine(engine, syntax_tree, &symbol_table, &pci->options);
+    printf("---------------------------------\n"); fflush(NULL);
+
+    symbol_table.Destroy();
+    if(syntax_tree) DestroyTree(syntax_tree);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Scanner only ////////////////////////////////////////////////////////////////////
+
+void StartScanner(CompilerInfo* pci)
+{
+    Token token;
+
+    while(true)
+    {
+        GetNextToken(pci, &token);
+        printf("[%d] %s (%s)\n", pci->in_file.cur_line_num, token.str, TokenTypeStr[token.type]); fflush(NULL);
+        if(token.type==ENDFILE || token.type==ERROR) break;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+void PrintUsage()
+{
+    int i, j;
+    printf("Usage: myfile [options] [input file]\n");
+    printf("  --engine=E   run the program with engine E:");
+    for(i=0;i<NUM_ENGINES;i++) printf(" %s", EngineStr[i]);
+    printf(" (default %s)\n", EngineStr[ENGINE_TREE]);
+    printf("  --stats      print execution statistics to stderr\n");
+    printf("  --disasm     print the register code generated for the program\n");
+    printf("  --ir         print the SSA form the optimizer works on\n");
+    printf("  --dispatch=D instruction dispatch of the virtual machines:");
+    for(i=0;i<NUM_DISPATCHES;i++) printf(" %s", DispatchStr[i]);
+    printf(" (default %s)\n", DispatchStr[DEFAULT_DISPATCH]);
+    printf("  --emit=T     also translate the program: c (standalone C, output.c) or\n");
+    printf("               tm (Tiny Machine assembly, output.tm), image (bytecode image, output.img)\n");
+    printf("               or elf (x86-64 Linux executable, output.elf)\n");
+    printf("  --run-image=F  run bytecode image F, only the program's output is printed\n");
+    printf("  --tier-threshold=N  loop backedges before the tiered and trace engines compile a loop\n");
+    printf("               (default %d)\n", DEFAULT_TIER_THRESHOLD);
+    printf("  --unroll=N   copies of a loop body per test of its condition when loops with\n");
+    printf("               a known trip count are unrolled, 1 turns unrolling off (default %d)\n", DEFAULT_UNROLL_FACTOR);
+    printf("  -O0, -O1, -O2  optimization level: no passes, tree passes only, or every pass with\n");
+    printf("               groups of passes repeated while they change the program (default -O%d)\n", DEFAULT_OPT_LEVEL);
+    printf("  --enable-pass=P, --disable-pass=P  run or skip optimization pass P whatever the level:");
+    int listed=0;
+    for(i=0;i<NUM_OPT_PASSES;i++)
+    {
+        for(j=0;j<i;j++) if(Equals(opt_passes[j].name, opt_passes[i].name)) break;
+        if(j==i) printf("%s %s", listed++%4==0 ? "\n              " : "", opt_passes[i].name);
+    }
+    printf("\n");
+    printf("  --opt-report print the time each optimization pass takes and the program size after it\n");
+    printf("  --specialize=F  run what only depends on the values in F at compile time, F holds\n");
+    printf("               the input of the first read statements, the rest is read when the program runs\n");
+    printf("  --self-test  check every algebraic simplification rule and run the regression programs\n");
+    printf("               on every engine, print the results\n");
+    printf("  --bench=N    run the program N times on each virtual machine and dispatch,\n");
+    printf("               output is discarded, and print the times instead\n");
+}
+
+// Fills options from the command line, returns false on an invalid option
+bool ParseOptions(int argc, char* argv[], CompilerOptions* options)
+{
+    int i, j;
+    for(i=1;i<argc;i++)
+    {
+        const char* arg=argv[i];
+        if(StartsWith(arg, "--engine="))
+        {
+            for(j=0;j<NUM_ENGINES;j++) if(Equals(arg+9, EngineStr[j])) break;
+            if(j==NUM_ENGINES) {printf("ERROR Unknown engine '%s'\n", arg+9); return false;}
+            options->engine=(Engine)j;
+        }
+        else if(Equals(arg, "--stats")) options->stats=true;
+        else if(Equals(arg, "--disasm")) options->disasm=true;
+        else if(Equals(arg, "--ir")) options->print_ir=true;
+        else if(StartsWith(arg, "--dispatch="))
+        {
+            for(j=0;j<NUM_DISPATCHES;j++) if(Equals(arg+11, DispatchStr[j])) break;
+            if(j==NUM_DISPATCHES) {printf("ERROR Dispatch '%s' is not available in this build\n", arg+11); return false;}
+            options->dispatch=(Dispatch)j;
+        }
+        else if(StartsWith(arg, "--bench="))
+        {
+            options->bench_runs=atoi(arg+8);
+            if(options->bench_runs<=0) {printf("ERROR Invalid number of benchmark runs '%s'\n", arg+8); return false;}
+        }
+        else if(StartsWith(arg, "--tier-threshold="))
+        {
+            options->tier_threshold=atoi(arg+17);
+            if(options->tier_threshold<=0) {printf("ERROR Invalid tier threshold '%s'\n", arg+17); return false;}
+        }
+        else if(StartsWith(arg, "--unroll="))
+        {
+            options->unroll_factor=atoi(arg+9);
+            if(options->unroll_factor<=0) {printf("ERROR Invalid unroll factor '%s'\n", arg+9); return false;}
+        }
+        else if(Equals(arg, "-O0") || Equals(arg, "-O1") || Equals(arg, "-O2")) options->opt_level=arg[2]-'0';
+        else if(StartsWith(arg, "--enable-pass=") || StartsWith(arg, "--disable-pass="))
+        {
+            bool enable=StartsWith(arg, "--enable-pass=");
+            const char* name=arg+(enable ? 14 : 15);
+            for(j=0;j<NUM_OPT_PASSES;j++) if(Equals(name, opt_passes[j].name)) break;
+            if(j==NUM_OPT_PASSES) {printf("ERROR Unknown optimization pass '%s'\n", name); return false;}
+            if(options->num_pass_switches==MAX_PASS_SWITCHES) {printf("ERROR Too many pass options\n"); return false;}
+            options->pass_switch[options->num_pass_switches]=name;
+            options->pass_enabled[options->num_pass_switches++]=enable;
+        }
+        else if(Equals(arg, "--opt-report")) options->opt_report=true;
+        else if(StartsWith(arg, "--specialize=")) options->specialize_str=arg+13;
+        else if(Equals(arg, "--self-test")) options->self_test=true;
+        else if(StartsWith(arg, "--run-image=")) options->image_str=arg+12;
+        else if(StartsWith(arg, "--emit="))
+        {
+            for(j=0;j<NUM_EMITS;j++) if(Equals(arg+7, EmitStr[j])) break;
+            if(j==NUM_EMITS) {printf("ERROR Unknown translation '%s'\n", arg+7); return false;}
+            options->emit=(Emit)j;
+        }
+        else if(arg[0]=='-') {printf("ERROR Unknown option '%s'\n", arg); PrintUsage(); return false;}
+        else options->in_str=arg;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    CompilerOptions options;
+    if(!ParseOptions(argc, argv, &options)) return 1;
+
+    if(options.self_test) return RunSelfTests() ? 0 : 1;
+
+    // A bytecode image starts running at once, without the compiler's reports
+    if(options.image_str) return RunImage(options.image_str, &options) ? 0 : 1;
+
+    printf("Start main()\n"); fflush(NULL);
+
+    CompilerInfo compiler_info(options.in_str, "output.txt", "debug.txt");
+    compiler_info.options=options;
+    if(!compiler_info.in_file.file)
+    {
+        printf("ERROR Cannot open input file '%s'\n", options.in_str);
+        return 1;
+    }
 
     StartCompiler(&compiler_info);
 